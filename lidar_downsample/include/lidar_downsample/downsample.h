@@ -0,0 +1,198 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef MODULES_DRIVERS_LIDAR_DOWNSAMPLE_DOWNSAMPLE_H_
+#define MODULES_DRIVERS_LIDAR_DOWNSAMPLE_DOWNSAMPLE_H_
+
+#include <stdint.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace apollo {
+namespace drivers {
+namespace lidar_downsample {
+
+// how the points of the reduced cloud are picked
+enum ReductionMode {
+  REDUCTION_NONE,
+  // the first point of every leaf_size cube
+  REDUCTION_VOXEL,
+  // every ring_stride-th ring, every azimuth_stride-th firing of a ring
+  REDUCTION_STRIDE
+};
+
+// empty slot and unknown voxel, no voxel key has the top bit set
+static const uint64_t NO_VOXEL = ~0ULL;
+
+// "none", "voxel" or "stride", REDUCTION_NONE for anything else
+inline ReductionMode reduction_mode(const std::string& name) {
+  if (name == "voxel") {
+    return REDUCTION_VOXEL;
+  }
+  if (name == "stride") {
+    return REDUCTION_STRIDE;
+  }
+  return REDUCTION_NONE;
+}
+
+/**
+ * @brief decides point by point which points join the reduced cloud, while
+ *   the full cloud is written. Shared by the decoders of all lidars.
+ *   The voxel grid keeps the first point of every voxel, found in an open
+ *   addressing hash table of which only the slots filled by the last cloud
+ *   are cleared. Neighbouring firings of a ring mostly fall in the same
+ *   voxel, so the last voxel of every ring is checked before the table.
+ *   The stride counts the firings of every ring, so it needs no organized
+ *   cloud. A ring is whatever the decoder numbers its lasers with.
+ */
+class Downsampler {
+ public:
+  Downsampler()
+      : mode_(REDUCTION_NONE),
+        inverse_leaf_(0),
+        ring_stride_(1),
+        azimuth_stride_(1) {}
+
+  void configure(ReductionMode mode, double leaf_size, int ring_stride,
+                 int azimuth_stride) {
+    mode_ = mode;
+    if (mode_ == REDUCTION_VOXEL && leaf_size <= 0) {
+      mode_ = REDUCTION_NONE;
+    }
+    inverse_leaf_ = leaf_size > 0 ? 1.0 / leaf_size : 0;
+    ring_stride_ = ring_stride > 1 ? ring_stride : 1;
+    azimuth_stride_ = azimuth_stride > 1 ? azimuth_stride : 1;
+  }
+
+  bool enabled() const { return mode_ != REDUCTION_NONE; }
+
+  /**
+  * @brief start a new cloud
+  */
+  void reset() {
+    for (size_t i = 0; i < filled_.size(); ++i) {
+      slots_[filled_[i]] = NO_VOXEL;
+    }
+    filled_.clear();
+    ring_firings_.assign(ring_firings_.size(), 0);
+    ring_voxels_.assign(ring_voxels_.size(), NO_VOXEL);
+  }
+
+  /**
+  * @brief whether the point also goes to the reduced cloud
+  */
+  bool keep(float x, float y, float z, int ring) {
+    if (mode_ == REDUCTION_STRIDE) {
+      return keep_stride(ring) && !std::isnan(x);
+    }
+    if (mode_ == REDUCTION_VOXEL) {
+      return keep_voxel(x, y, z, ring);
+    }
+    return false;
+  }
+
+ private:
+  bool keep_stride(int ring) {
+    if (ring < 0) {
+      return false;
+    }
+    if (ring >= static_cast<int>(ring_firings_.size())) {
+      ring_firings_.resize(ring + 1, 0);
+    }
+    const uint32_t firing = ring_firings_[ring]++;
+    return ring % ring_stride_ == 0 && firing % azimuth_stride_ == 0;
+  }
+
+  bool keep_voxel(float x, float y, float z, int ring) {
+    if (std::isnan(x) || std::isnan(y) || std::isnan(z)) {
+      return false;
+    }
+    // 21 bits per axis, about 100 km either way at 10 cm
+    const uint64_t key =
+        voxel_index(x) | (voxel_index(y) << 21) | (voxel_index(z) << 42);
+    if (ring >= 0) {
+      if (ring >= static_cast<int>(ring_voxels_.size())) {
+        ring_voxels_.resize(ring + 1, NO_VOXEL);
+      }
+      if (ring_voxels_[ring] == key) {
+        return false;
+      }
+      ring_voxels_[ring] = key;
+    }
+    if (2 * (filled_.size() + 1) > slots_.size()) {
+      grow();
+    }
+
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash(key) & mask;
+    while (slots_[i] != NO_VOXEL) {
+      if (slots_[i] == key) {
+        return false;
+      }
+      i = (i + 1) & mask;
+    }
+    slots_[i] = key;
+    filled_.push_back(i);
+    return true;
+  }
+
+  uint64_t voxel_index(float v) const {
+    // shifted to positive, so that truncating is flooring
+    const double index = v * inverse_leaf_ + (1 << 20);
+    return static_cast<uint64_t>(index > 0 ? index : 0) & 0x1fffff;
+  }
+
+  static size_t hash(uint64_t key) {
+    key ^= key >> 31;
+    key *= 0x9e3779b97f4a7c15ULL;
+    return static_cast<size_t>(key ^ (key >> 29));
+  }
+
+  // double the table, keeping the voxels of the current cloud
+  void grow() {
+    std::vector<uint64_t> old;
+    old.swap(slots_);
+    slots_.assign(old.empty() ? 65536 : 2 * old.size(), NO_VOXEL);
+    const size_t mask = slots_.size() - 1;
+    for (size_t j = 0; j < filled_.size(); ++j) {
+      const uint64_t key = old[filled_[j]];
+      size_t i = hash(key) & mask;
+      while (slots_[i] != NO_VOXEL) {
+        i = (i + 1) & mask;
+      }
+      slots_[i] = key;
+      filled_[j] = i;
+    }
+  }
+
+  ReductionMode mode_;
+  double inverse_leaf_;
+  int ring_stride_;
+  int azimuth_stride_;
+  std::vector<uint64_t> slots_;
+  // slots holding a voxel of the current cloud
+  std::vector<uint32_t> filled_;
+  std::vector<uint32_t> ring_firings_;
+  std::vector<uint64_t> ring_voxels_;
+};
+
+}  // namespace lidar_downsample
+}  // namespace drivers
+}  // namespace apollo
+
+#endif  // MODULES_DRIVERS_LIDAR_DOWNSAMPLE_DOWNSAMPLE_H_
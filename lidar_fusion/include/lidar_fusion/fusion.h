@@ -0,0 +1,190 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef MODULES_DRIVERS_LIDAR_FUSION_FUSION_H_
+#define MODULES_DRIVERS_LIDAR_FUSION_FUSION_H_
+
+#include <boost/thread.hpp>
+#include <eigen_conversions/eigen_msg.h>
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <tf2_ros/transform_listener.h>
+#include <Eigen/Eigen>
+
+#include <string>
+#include <vector>
+
+namespace apollo {
+namespace drivers {
+namespace lidar_fusion {
+
+// fused clouds recycled once every subscriber released them
+#define OUTPUT_POOL_SIZE 3
+
+/**
+ * @brief where the fields of a sensor's clouds are, parsed once per field
+ *   list. A cloud without a timestamp field is compensated at its stamp.
+ */
+struct CloudLayout {
+  uint32_t point_step;
+  int x_offset;
+  int y_offset;
+  int z_offset;
+  bool double_coordinates;
+  int intensity_offset;  // -1 without intensity
+  uint8_t intensity_type;
+  int timestamp_offset;  // -1 without double timestamps
+};
+
+struct SensorStats {
+  uint64_t received;    // clouds received
+  uint64_t fused;       // clouds in a published fused cloud
+  uint64_t late;        // clouds that arrived after their window was closed
+  uint64_t missing;     // fused clouds published without this sensor
+  double sum_lateness;  // seconds the fused clouds arrived after the
+  double max_lateness;  // reference cloud, since the last report
+};
+
+class Fusion {
+ public:
+  Fusion(ros::NodeHandle node, ros::NodeHandle private_nh);
+  virtual ~Fusion() {}
+
+ private:
+  struct Sensor {
+    std::string topic;
+    ros::Subscriber sub;
+    // under lock_, the cloud waiting for the window of the reference cloud
+    sensor_msgs::PointCloud2ConstPtr pending;
+    ros::WallTime arrival;
+    SensorStats stats;
+    // only used by fuse(), the layout of the last cloud and the fields it
+    // was parsed from, and vehicle frame <- sensor frame
+    std::vector<sensor_msgs::PointField> fields;
+    CloudLayout layout;
+    bool layout_valid;
+    std::string extrinsic_frame_id;
+    Eigen::Matrix3d extrinsic_rotation;
+    Eigen::Vector3d extrinsic_translation;
+  };
+
+  /**
+  * @brief keep the cloud of a sensor for the current window, the cloud of
+  *   the first sensor opens a window
+  */
+  void cloud_callback(const sensor_msgs::PointCloud2ConstPtr& msg,
+                      size_t sensor);
+  /**
+  * @brief close the window of the reference cloud with the clouds that made
+  *   it in time, unless the window of the timer was already closed
+  */
+  void window_callback(const ros::WallTimerEvent& event, uint64_t generation);
+  /**
+  * @brief log the per sensor statistics and reset the lateness
+  */
+  void stats_callback(const ros::WallTimerEvent& event);
+  /**
+  * @brief take the clouds of the window, one per sensor or NULL, with lock_
+  *   held
+  */
+  void close_window(std::vector<sensor_msgs::PointCloud2ConstPtr>* clouds,
+                    double* reference_time);
+  /**
+  * @brief compensate the clouds to the reference time, transform them to the
+  *   vehicle frame and publish them as one cloud
+  */
+  void fuse(const std::vector<sensor_msgs::PointCloud2ConstPtr>& clouds,
+            double reference_time);
+  void get_timestamp_interval(const sensor_msgs::PointCloud2& msg,
+                              const CloudLayout& layout,
+                              double* timestamp_min, double* timestamp_max);
+  /**
+  * @brief check the fields of the cloud, parsed again only when they differ
+  *   from the previous cloud of the sensor
+  */
+  bool check_layout(const sensor_msgs::PointCloud2ConstPtr& msg,
+                    Sensor* sensor);
+  bool query_extrinsic(const std::string& frame_id, Sensor* sensor);
+  /**
+  * @brief poses of the vehicle every pose_interval from start to end, shared
+  *   by the clouds of a window
+  */
+  bool query_poses(double start, double end);
+  /**
+  * @brief vehicle pose at a time between the queried poses
+  */
+  Eigen::Affine3d interpolate_pose(double timestamp) const;
+  bool query_pose_affine_from_tf2(const double timestamp,
+                                  Eigen::Affine3d* pose);
+  /**
+  * @brief append the points of a cloud to the output, moved with the
+  *   transform of their timestamp bucket
+  */
+  template <typename Scalar>
+  void append(const sensor_msgs::PointCloud2& msg, const Sensor& sensor,
+              double timestamp_min, double timestamp_max,
+              const Eigen::Affine3d& inverse_reference,
+              sensor_msgs::PointCloud2* output, uint32_t* points);
+  /**
+  * @brief a released cloud from the pool with room for points points
+  */
+  sensor_msgs::PointCloud2Ptr output_cloud(uint32_t points);
+
+  std::vector<Sensor> sensors_;
+  ros::NodeHandle node_;
+  ros::Publisher fusion_pub_;
+  // one shot per window, only replaced by the reference cloud callback and
+  // never under lock_, dropping a timer waits for its running callback
+  ros::WallTimer window_timer_;
+  ros::WallTimer stats_timer_;
+  tf2_ros::Buffer tf2_buffer_;
+  tf2_ros::TransformListener tf2_transform_listener_;
+
+  std::string world_frame_id_;
+  std::string vehicle_frame_id_;
+  float tf_timeout_;
+  double sync_window_;
+  double pose_interval_;
+  double bucket_interval_;
+  int max_points_;
+
+  // sensors_, the window and the statistics
+  boost::mutex lock_;
+  bool window_open_;
+  // bumped for every window, a timer only closes the window it was armed for
+  uint64_t window_generation_;
+  double window_time_;
+  ros::WallTime window_arrival_;
+  // the reference time of the last fused cloud, older clouds are late
+  double last_reference_time_;
+  uint64_t uncompensated_;
+
+  // fuse() runs one window at a time, these are only used by it
+  boost::mutex fuse_lock_;
+  double poses_start_;
+  std::vector<Eigen::Vector3d> pose_positions_;
+  std::vector<Eigen::Quaterniond,
+              Eigen::aligned_allocator<Eigen::Quaterniond> > pose_rotations_;
+  std::vector<Eigen::Matrix3f> bucket_rotations_;
+  std::vector<Eigen::Vector3f> bucket_translations_;
+  std::vector<sensor_msgs::PointCloud2Ptr> output_pool_;
+};
+
+}  // namespace lidar_fusion
+}  // namespace drivers
+}  // namespace apollo
+
+#endif  // MODULES_DRIVERS_LIDAR_FUSION_FUSION_H_
@@ -0,0 +1,581 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "lidar_fusion/fusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace apollo {
+namespace drivers {
+namespace lidar_fusion {
+
+// the fused point, float x y z intensity and double timestamp
+const uint32_t kOutputPointStep = 24;
+// longest span of poses queried for a window, a bad timestamp would
+// otherwise query thousands of poses
+const double kMaxPoseSpan = 1.0;
+
+Fusion::Fusion(ros::NodeHandle node, ros::NodeHandle private_nh)
+    : node_(node),
+      tf2_transform_listener_(tf2_buffer_, node),
+      window_open_(false),
+      window_generation_(0),
+      window_time_(0),
+      last_reference_time_(0),
+      uncompensated_(0),
+      poses_start_(0) {
+  std::vector<std::string> topics;
+  private_nh.getParam("topics", topics);
+  private_nh.param("world_frame_id", world_frame_id_, std::string("world"));
+  private_nh.param("vehicle_frame_id", vehicle_frame_id_,
+                   std::string("novatel"));
+  std::string topic_fused_pointcloud;
+  private_nh.param("topic_fused_pointcloud", topic_fused_pointcloud,
+                   std::string("/apollo/sensor/lidar/fusion/PointCloud2"));
+  private_nh.param("tf_query_timeout", tf_timeout_, 0.1f);
+  private_nh.param("sync_window", sync_window_, 0.05);
+  private_nh.param("pose_interval", pose_interval_, 0.01);
+  private_nh.param("bucket_interval", bucket_interval_, 0.0005);
+  private_nh.param("max_points", max_points_, 400000);
+  double stats_interval = 10.0;
+  private_nh.param("stats_interval", stats_interval, 10.0);
+
+  if (topics.empty()) {
+    ROS_ERROR("No lidar topics to fuse, set the topics parameter");
+    return;
+  }
+  if (sync_window_ <= 0 || pose_interval_ <= 0 || bucket_interval_ <= 0) {
+    ROS_ERROR("sync_window, pose_interval and bucket_interval must be "
+              "positive");
+    return;
+  }
+
+  // advertise output point cloud (before subscribing to input data)
+  fusion_pub_ =
+      node.advertise<sensor_msgs::PointCloud2>(topic_fused_pointcloud, 10);
+
+  sensors_.resize(topics.size());
+  for (size_t i = 0; i < topics.size(); ++i) {
+    Sensor& sensor = sensors_[i];
+    sensor.topic = topics[i];
+    sensor.layout_valid = false;
+    sensor.stats = SensorStats();
+    sensor.sub = node.subscribe<sensor_msgs::PointCloud2>(
+        topics[i], 10, boost::bind(&Fusion::cloud_callback, this, _1, i));
+    ROS_INFO_STREAM("Fusing " << topics[i]
+                              << (i == 0 ? ", the reference" : ""));
+  }
+
+  stats_timer_ = node.createWallTimer(ros::WallDuration(stats_interval),
+                                      &Fusion::stats_callback, this);
+}
+
+void Fusion::cloud_callback(const sensor_msgs::PointCloud2ConstPtr& msg,
+                            size_t index) {
+  std::vector<sensor_msgs::PointCloud2ConstPtr> clouds;
+  double reference_time = 0;
+  uint64_t opened = 0;
+  {
+    boost::mutex::scoped_lock lock(lock_);
+    Sensor& sensor = sensors_[index];
+    const double stamp = msg->header.stamp.toSec();
+    ++sensor.stats.received;
+
+    // its window was already published, a sync_window under half the lidar
+    // period keeps the windows apart
+    if (stamp <= last_reference_time_ + (index == 0 ? 0 : sync_window_)) {
+      ++sensor.stats.late;
+      return;
+    }
+
+    if (index == 0) {
+      if (window_open_) {
+        // the previous window never completed, fuse what it has
+        close_window(&clouds, &reference_time);
+      }
+      window_open_ = true;
+      window_time_ = stamp;
+      window_arrival_ = ros::WallTime::now();
+      opened = ++window_generation_;
+    }
+    sensor.pending = msg;
+    sensor.arrival = ros::WallTime::now();
+
+    if (clouds.empty()) {
+      // every sensor is in, no need to wait for the timer
+      bool complete = window_open_;
+      for (size_t i = 0; complete && i < sensors_.size(); ++i) {
+        complete = sensors_[i].pending &&
+                   std::abs(sensors_[i].pending->header.stamp.toSec() -
+                            window_time_) <= sync_window_;
+      }
+      if (complete) {
+        // the timer of the window finds it closed and returns
+        close_window(&clouds, &reference_time);
+      }
+    }
+  }
+
+  if (opened != 0) {
+    // a timer callback blocked on lock_ must be able to finish before the
+    // previous timer is dropped
+    window_timer_ = node_.createWallTimer(
+        ros::WallDuration(sync_window_),
+        boost::bind(&Fusion::window_callback, this, _1, opened), true);
+  }
+  if (!clouds.empty()) {
+    fuse(clouds, reference_time);
+  }
+}
+
+void Fusion::window_callback(const ros::WallTimerEvent& event,
+                             uint64_t generation) {
+  std::vector<sensor_msgs::PointCloud2ConstPtr> clouds;
+  double reference_time = 0;
+  {
+    boost::mutex::scoped_lock lock(lock_);
+    // fired after its window was closed, maybe with the next one open
+    if (!window_open_ || generation != window_generation_) {
+      return;
+    }
+    close_window(&clouds, &reference_time);
+  }
+
+  fuse(clouds, reference_time);
+}
+
+void Fusion::close_window(
+    std::vector<sensor_msgs::PointCloud2ConstPtr>* clouds,
+    double* reference_time) {
+  clouds->assign(sensors_.size(), sensor_msgs::PointCloud2ConstPtr());
+  for (size_t i = 0; i < sensors_.size(); ++i) {
+    Sensor& sensor = sensors_[i];
+    if (sensor.pending &&
+        std::abs(sensor.pending->header.stamp.toSec() - window_time_) <=
+            sync_window_) {
+      const double lateness =
+          std::max((sensor.arrival - window_arrival_).toSec(), 0.0);
+      ++sensor.stats.fused;
+      sensor.stats.sum_lateness += lateness;
+      sensor.stats.max_lateness = std::max(sensor.stats.max_lateness,
+                                           lateness);
+      (*clouds)[i] = sensor.pending;
+      sensor.pending.reset();
+    } else {
+      ++sensor.stats.missing;
+      // a cloud older than the window will never be fused
+      if (sensor.pending &&
+          sensor.pending->header.stamp.toSec() < window_time_) {
+        sensor.pending.reset();
+      }
+    }
+  }
+  *reference_time = window_time_;
+  last_reference_time_ = window_time_;
+  window_open_ = false;
+}
+
+void Fusion::stats_callback(const ros::WallTimerEvent& event) {
+  boost::mutex::scoped_lock lock(lock_);
+  for (size_t i = 0; i < sensors_.size(); ++i) {
+    SensorStats& stats = sensors_[i].stats;
+    ROS_INFO("%s: received %lu, fused %lu, late %lu, missing %lu, "
+             "lateness mean %.1f ms max %.1f ms",
+             sensors_[i].topic.c_str(), stats.received, stats.fused,
+             stats.late, stats.missing,
+             stats.fused > 0 ? stats.sum_lateness * 1000.0 / stats.fused : 0,
+             stats.max_lateness * 1000.0);
+    stats.sum_lateness = 0;
+    stats.max_lateness = 0;
+    stats.fused = 0;
+  }
+  if (uncompensated_ > 0) {
+    ROS_WARN("%lu fused clouds dropped without poses", uncompensated_);
+  }
+}
+
+void Fusion::fuse(const std::vector<sensor_msgs::PointCloud2ConstPtr>& clouds,
+                  double reference_time) {
+  boost::mutex::scoped_lock lock(fuse_lock_);
+
+  // the clouds that can be fused and the time span of all their points
+  std::vector<bool> valid(clouds.size(), false);
+  std::vector<double> timestamp_min(clouds.size());
+  std::vector<double> timestamp_max(clouds.size());
+  double start = reference_time;
+  double end = reference_time;
+  uint32_t total = 0;
+  for (size_t i = 0; i < clouds.size(); ++i) {
+    if (!clouds[i]) {
+      continue;
+    }
+    Sensor& sensor = sensors_[i];
+    if (!check_layout(clouds[i], &sensor) ||
+        !query_extrinsic(clouds[i]->header.frame_id, &sensor)) {
+      continue;
+    }
+    get_timestamp_interval(*clouds[i], sensor.layout, &timestamp_min[i],
+                           &timestamp_max[i]);
+    start = std::min(start, timestamp_min[i]);
+    end = std::max(end, timestamp_max[i]);
+    total += clouds[i]->width * clouds[i]->height;
+    valid[i] = true;
+  }
+
+  if (!query_poses(start, end)) {
+    boost::mutex::scoped_lock stats_lock(lock_);
+    ++uncompensated_;
+    return;
+  }
+
+  const Eigen::Affine3d inverse_reference =
+      interpolate_pose(reference_time).inverse();
+  sensor_msgs::PointCloud2Ptr output = output_cloud(total);
+  uint32_t points = 0;
+  for (size_t i = 0; i < clouds.size(); ++i) {
+    if (!valid[i]) {
+      continue;
+    }
+    if (sensors_[i].layout.double_coordinates) {
+      append<double>(*clouds[i], sensors_[i], timestamp_min[i],
+                     timestamp_max[i], inverse_reference, output.get(),
+                     &points);
+    } else {
+      append<float>(*clouds[i], sensors_[i], timestamp_min[i],
+                    timestamp_max[i], inverse_reference, output.get(),
+                    &points);
+    }
+  }
+
+  output->header.stamp.fromSec(reference_time);
+  output->header.frame_id = vehicle_frame_id_;
+  output->width = points;
+  output->row_step = points * kOutputPointStep;
+  output->data.resize(output->row_step);
+  fusion_pub_.publish(output);
+}
+
+void Fusion::get_timestamp_interval(const sensor_msgs::PointCloud2& msg,
+                                    const CloudLayout& layout,
+                                    double* timestamp_min,
+                                    double* timestamp_max) {
+  if (layout.timestamp_offset < 0 || msg.data.empty()) {
+    *timestamp_min = msg.header.stamp.toSec();
+    *timestamp_max = *timestamp_min;
+    return;
+  }
+
+  *timestamp_min = std::numeric_limits<double>::max();
+  *timestamp_max = -std::numeric_limits<double>::max();
+  const uint32_t total = msg.width * msg.height;
+  const uint8_t* point = &msg.data[0] + layout.timestamp_offset;
+  for (uint32_t i = 0; i < total; ++i, point += layout.point_step) {
+    double timestamp;
+    memcpy(&timestamp, point, sizeof(timestamp));
+    *timestamp_min = std::min(*timestamp_min, timestamp);
+    *timestamp_max = std::max(*timestamp_max, timestamp);
+  }
+}
+
+bool Fusion::check_layout(const sensor_msgs::PointCloud2ConstPtr& msg,
+                          Sensor* sensor) {
+  if (msg->data.size() <
+      static_cast<size_t>(msg->width) * msg->height * msg->point_step) {
+    ROS_WARN_THROTTLE(1, "%s: cloud data shorter than its points",
+                      sensor->topic.c_str());
+    return false;
+  }
+  bool same_fields = sensor->layout_valid &&
+                     msg->point_step == sensor->layout.point_step &&
+                     msg->fields.size() == sensor->fields.size();
+  for (size_t i = 0; same_fields && i < sensor->fields.size(); ++i) {
+    const sensor_msgs::PointField& f = msg->fields[i];
+    same_fields = f.offset == sensor->fields[i].offset &&
+                  f.datatype == sensor->fields[i].datatype &&
+                  f.count == sensor->fields[i].count &&
+                  f.name == sensor->fields[i].name;
+  }
+  if (same_fields) {
+    return true;
+  }
+
+  CloudLayout layout;
+  layout.point_step = msg->point_step;
+  layout.x_offset = -1;
+  layout.y_offset = -1;
+  layout.z_offset = -1;
+  layout.double_coordinates = false;
+  layout.intensity_offset = -1;
+  layout.intensity_type = 0;
+  layout.timestamp_offset = -1;
+  uint8_t coordinate_type = 0;
+  bool valid = true;
+  for (size_t i = 0; i < msg->fields.size(); ++i) {
+    const sensor_msgs::PointField& field = msg->fields[i];
+    const bool coordinate =
+        field.name == "x" || field.name == "y" || field.name == "z";
+    if (coordinate) {
+      if (field.datatype != sensor_msgs::PointField::FLOAT32 &&
+          field.datatype != sensor_msgs::PointField::FLOAT64) {
+        valid = false;
+      } else if (coordinate_type != 0 && field.datatype != coordinate_type) {
+        valid = false;
+      }
+      coordinate_type = field.datatype;
+      int* offset = field.name == "x"
+                        ? &layout.x_offset
+                        : (field.name == "y" ? &layout.y_offset
+                                             : &layout.z_offset);
+      *offset = field.offset;
+    } else if (field.name == "intensity" &&
+               (field.datatype == sensor_msgs::PointField::UINT8 ||
+                field.datatype == sensor_msgs::PointField::FLOAT32)) {
+      layout.intensity_offset = field.offset;
+      layout.intensity_type = field.datatype;
+    } else if (field.name == "timestamp" &&
+               field.datatype == sensor_msgs::PointField::FLOAT64) {
+      layout.timestamp_offset = field.offset;
+    }
+  }
+  layout.double_coordinates =
+      coordinate_type == sensor_msgs::PointField::FLOAT64;
+
+  if (!valid || layout.x_offset < 0 || layout.y_offset < 0 ||
+      layout.z_offset < 0) {
+    ROS_WARN_THROTTLE(1, "%s: cloud without float or double x, y and z",
+                      sensor->topic.c_str());
+    sensor->layout_valid = false;
+    return false;
+  }
+  if (layout.timestamp_offset < 0) {
+    ROS_WARN("%s: no double timestamp field, compensating at the stamp",
+             sensor->topic.c_str());
+  }
+  sensor->fields = msg->fields;
+  sensor->layout = layout;
+  sensor->layout_valid = true;
+  return true;
+}
+
+bool Fusion::query_extrinsic(const std::string& frame_id, Sensor* sensor) {
+  if (!sensor->extrinsic_frame_id.empty() &&
+      frame_id == sensor->extrinsic_frame_id) {
+    return true;
+  }
+
+  Eigen::Affine3d extrinsic = Eigen::Affine3d::Identity();
+  if (frame_id != vehicle_frame_id_) {
+    geometry_msgs::TransformStamped stamped_transform;
+    try {
+      // the lidars are mounted on the vehicle, the latest is the transform
+      stamped_transform = tf2_buffer_.lookupTransform(
+          vehicle_frame_id_, frame_id, ros::Time(0));
+    } catch (tf2::TransformException& ex) {
+      ROS_WARN_STREAM_THROTTLE(1, "Can not find extrinsic of " << frame_id
+                                      << ". Error info: " << ex.what());
+      return false;
+    }
+    tf::transformMsgToEigen(stamped_transform.transform, extrinsic);
+  }
+  sensor->extrinsic_rotation = extrinsic.linear();
+  sensor->extrinsic_translation = extrinsic.translation();
+  sensor->extrinsic_frame_id = frame_id;
+  return true;
+}
+
+bool Fusion::query_poses(double start, double end) {
+  if (end - start > kMaxPoseSpan) {
+    ROS_WARN_THROTTLE(1, "Points of the window span %.3f s, more than %.1f s",
+                      end - start, kMaxPoseSpan);
+    return false;
+  }
+  // the last pose is at end so that no extrapolation is needed
+  const size_t count =
+      static_cast<size_t>(std::ceil((end - start) / pose_interval_)) + 1;
+  poses_start_ = end - (count - 1) * pose_interval_;
+  pose_positions_.resize(std::max<size_t>(count, 2));
+  pose_rotations_.resize(std::max<size_t>(count, 2));
+
+  // the newest first, it is the one tf2 may have to wait for
+  for (size_t i = count; i-- > 0;) {
+    Eigen::Affine3d pose;
+    if (!query_pose_affine_from_tf2(poses_start_ + i * pose_interval_,
+                                    &pose)) {
+      return false;
+    }
+    pose_positions_[i] = pose.translation();
+    pose_rotations_[i] = Eigen::Quaterniond(pose.linear());
+  }
+  if (count == 1) {
+    pose_positions_[1] = pose_positions_[0];
+    pose_rotations_[1] = pose_rotations_[0];
+  }
+  return true;
+}
+
+Eigen::Affine3d Fusion::interpolate_pose(double timestamp) const {
+  const double position = (timestamp - poses_start_) / pose_interval_;
+  const int last = static_cast<int>(pose_positions_.size()) - 2;
+  const int i = std::min(std::max(static_cast<int>(position), 0), last);
+  const double t = std::min(std::max(position - i, 0.0), 1.0);
+  const Eigen::Vector3d translation =
+      pose_positions_[i] + t * (pose_positions_[i + 1] - pose_positions_[i]);
+  const Eigen::Quaterniond rotation =
+      pose_rotations_[i].slerp(t, pose_rotations_[i + 1]);
+  return Eigen::Translation3d(translation) * rotation;
+}
+
+bool Fusion::query_pose_affine_from_tf2(const double timestamp,
+                                        Eigen::Affine3d* pose) {
+  ros::Time query_time(timestamp);
+  std::string err_string;
+  if (!tf2_buffer_.canTransform(world_frame_id_, vehicle_frame_id_,
+                                query_time, ros::Duration(tf_timeout_),
+                                &err_string)) {
+    ROS_WARN_STREAM_THROTTLE(1, "Can not find transform. "
+                                    << std::fixed << timestamp
+                                    << " Error info: " << err_string);
+    return false;
+  }
+
+  geometry_msgs::TransformStamped stamped_transform;
+  try {
+    stamped_transform = tf2_buffer_.lookupTransform(
+        world_frame_id_, vehicle_frame_id_, query_time);
+  } catch (tf2::TransformException& ex) {
+    ROS_ERROR_STREAM(ex.what());
+    return false;
+  }
+
+  tf::transformMsgToEigen(stamped_transform.transform, *pose);
+  return true;
+}
+
+template <typename Scalar>
+void Fusion::append(const sensor_msgs::PointCloud2& msg, const Sensor& sensor,
+                    double timestamp_min, double timestamp_max,
+                    const Eigen::Affine3d& inverse_reference,
+                    sensor_msgs::PointCloud2* output, uint32_t* points) {
+  const CloudLayout& layout = sensor.layout;
+  const uint32_t total = msg.width * msg.height;
+  if (total == 0) {
+    return;
+  }
+
+  // vehicle frame at the reference time <- sensor frame, one transform per
+  // bucket of timestamps
+  Eigen::Affine3d extrinsic = Eigen::Affine3d::Identity();
+  extrinsic.linear() = sensor.extrinsic_rotation;
+  extrinsic.translation() = sensor.extrinsic_translation;
+  const int buckets =
+      static_cast<int>((timestamp_max - timestamp_min) / bucket_interval_) + 1;
+  bucket_rotations_.resize(buckets);
+  bucket_translations_.resize(buckets);
+  for (int b = 0; b < buckets; ++b) {
+    const double timestamp = std::min(
+        timestamp_min + (b + 0.5) * bucket_interval_, timestamp_max);
+    const Eigen::Affine3d transform =
+        inverse_reference * interpolate_pose(timestamp) * extrinsic;
+    bucket_rotations_[b] = transform.linear().cast<float>();
+    bucket_translations_[b] = transform.translation().cast<float>();
+  }
+
+  const double stamp = msg.header.stamp.toSec();
+  const uint8_t* point = &msg.data[0];
+  uint8_t* out = &output->data[*points * kOutputPointStep];
+  uint32_t appended = 0;
+  for (uint32_t i = 0; i < total; ++i, point += layout.point_step) {
+    Scalar x, y, z;
+    memcpy(&x, point + layout.x_offset, sizeof(x));
+    memcpy(&y, point + layout.y_offset, sizeof(y));
+    memcpy(&z, point + layout.z_offset, sizeof(z));
+    if (std::isnan(x) || std::isnan(y) || std::isnan(z)) {
+      continue;
+    }
+
+    double timestamp = stamp;
+    int b = 0;
+    if (layout.timestamp_offset >= 0) {
+      memcpy(&timestamp, point + layout.timestamp_offset, sizeof(timestamp));
+      b = std::min(static_cast<int>((timestamp - timestamp_min) /
+                                    bucket_interval_),
+                   buckets - 1);
+    }
+
+    float values[4];
+    Eigen::Map<Eigen::Vector3f> fused(values);
+    fused = bucket_rotations_[b] *
+                Eigen::Vector3f(static_cast<float>(x), static_cast<float>(y),
+                                static_cast<float>(z)) +
+            bucket_translations_[b];
+    values[3] = 0;
+    if (layout.intensity_type == sensor_msgs::PointField::UINT8) {
+      values[3] = point[layout.intensity_offset];
+    } else if (layout.intensity_type == sensor_msgs::PointField::FLOAT32) {
+      memcpy(&values[3], point + layout.intensity_offset, sizeof(float));
+    }
+
+    memcpy(out, values, sizeof(values));
+    memcpy(out + sizeof(values), &timestamp, sizeof(timestamp));
+    out += kOutputPointStep;
+    ++appended;
+  }
+  *points += appended;
+}
+
+sensor_msgs::PointCloud2Ptr Fusion::output_cloud(uint32_t points) {
+  sensor_msgs::PointCloud2Ptr cloud;
+  for (size_t i = 0; i < output_pool_.size(); ++i) {
+    // no subscriber holds it any more
+    if (output_pool_[i].unique()) {
+      cloud = output_pool_[i];
+      break;
+    }
+  }
+
+  if (!cloud) {
+    cloud.reset(new sensor_msgs::PointCloud2());
+    const char* names[] = {"x", "y", "z", "intensity", "timestamp"};
+    for (int i = 0; i < 5; ++i) {
+      sensor_msgs::PointField field;
+      field.name = names[i];
+      field.offset = 4 * i;
+      field.datatype = i < 4 ? sensor_msgs::PointField::FLOAT32
+                             : sensor_msgs::PointField::FLOAT64;
+      field.count = 1;
+      cloud->fields.push_back(field);
+    }
+    cloud->height = 1;
+    cloud->is_bigendian = false;
+    cloud->is_dense = true;
+    cloud->point_step = kOutputPointStep;
+    cloud->data.reserve(static_cast<size_t>(std::max<int>(max_points_, 0)) *
+                        kOutputPointStep);
+    if (output_pool_.size() < OUTPUT_POOL_SIZE) {
+      output_pool_.push_back(cloud);
+    }
+  }
+
+  cloud->data.resize(static_cast<size_t>(points) * kOutputPointStep);
+  return cloud;
+}
+
+}  // namespace lidar_fusion
+}  // namespace drivers
+}  // namespace apollo
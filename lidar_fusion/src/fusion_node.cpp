@@ -0,0 +1,36 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <ros/ros.h>
+
+#include "lidar_fusion/fusion.h"
+
+/** Main node entry point. */
+int main(int argc, char **argv) {
+  ROS_INFO("Fusion node init");
+  ros::init(argc, argv, "lidar_fusion_node");
+  ros::NodeHandle node;
+  ros::NodeHandle priv_nh("~");
+
+  apollo::drivers::lidar_fusion::Fusion fusion(node, priv_nh);
+
+  // the window timer fires while clouds are being fused
+  ros::AsyncSpinner spinner(2);
+  spinner.start();
+  ros::waitForShutdown();
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/ros.h>
+
+#include "lidar_fusion/fusion.h"
+
+namespace apollo {
+namespace drivers {
+namespace lidar_fusion {
+
+class FusionNodelet : public nodelet::Nodelet {
+ public:
+  FusionNodelet() {}
+  ~FusionNodelet() {}
+
+ private:
+  virtual void onInit();
+  boost::shared_ptr<Fusion> fusion_;
+};
+
+/** @brief Nodelet initialization. */
+void FusionNodelet::onInit() {
+  ROS_INFO("Fusion nodelet init");
+  fusion_.reset(new Fusion(getNodeHandle(), getPrivateNodeHandle()));
+}
+
+}  // namespace lidar_fusion
+}  // namespace drivers
+}  // namespace apollo
+
+PLUGINLIB_DECLARE_CLASS(lidar_fusion, FusionNodelet,
+                        apollo::drivers::lidar_fusion::FusionNodelet,
+                        nodelet::Nodelet);
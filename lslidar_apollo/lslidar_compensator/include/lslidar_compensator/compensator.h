@@ -25,10 +25,22 @@ limitations under the License.                                              /
 #include <tf2_ros/transform_listener.h>
 #include <Eigen/Eigen>
 
+#include <vector>
+
 namespace apollo {
 namespace drivers {
 namespace lslidar_compensator{
 
+// how the points of the pointcloud2 are read, detected once per field list
+enum PointLayout {
+  LAYOUT_INVALID,
+  // float x, y, z at 0, 4, 8 and double timestamp at 24, the decoder's points
+  LAYOUT_XYZIT,
+  // any offsets, float or double coordinates
+  LAYOUT_FLOAT,
+  LAYOUT_DOUBLE
+};
+
 class Compensator {
  public:
   Compensator(ros::NodeHandle node, ros::NodeHandle private_nh);
@@ -48,24 +60,54 @@ class Compensator {
                                   Eigen::Affine3d& pose);
   /**
   * @brief check if message is valid, check width, height, timestamp.
-  *   set timestamp_offset and point data type
+  *   set timestamp_offset and point layout, the fields are only parsed
+  *   when they differ from the previous message
   */
   bool check_message(const sensor_msgs::PointCloud2ConstPtr& msg);
   /**
+  * @brief parse the fields of the message into the offsets and layout_
+  */
+  bool parse_fields(const sensor_msgs::PointCloud2ConstPtr& msg);
+  /**
+  * @brief compensate and publish the message, reading the points with layout
+  */
+  template <typename Layout>
+  void compensate(const sensor_msgs::PointCloud2ConstPtr& msg,
+                  const Layout& layout);
+  /**
   * @brief motion compensation for point cloud
   */
-  template <typename Scalar>
-  void motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
+  template <typename Layout>
+  void motion_compensation(const Layout& layout,
+                           sensor_msgs::PointCloud2::Ptr& msg,
                            const double timestamp_min,
                            const double timestamp_max,
                            const Eigen::Affine3d& pose_min_time,
                            const Eigen::Affine3d& pose_max_time);
   /**
+  * @brief motion compensation with a cubic B-spline through the poses of the
+  *   sweep, sampled from tf2 every spline_knot_interval seconds. Points are
+  *   moved with the transform of their timestamp bucket.
+  *   returns false if the poses of the sweep are not available.
+  */
+  template <typename Layout>
+  bool spline_motion_compensation(const Layout& layout,
+                                  sensor_msgs::PointCloud2::Ptr& msg,
+                                  const double timestamp_min,
+                                  const double timestamp_max,
+                                  const Eigen::Affine3d& pose_max_time);
+  /**
+  * @brief pose of the uniform cubic B-spline in segment of control pose
+  *   first, at u in [0, 1]
+  */
+  Eigen::Affine3d spline_pose(const int first, const double u) const;
+  /**
   * @brief get min timestamp and max timestamp from points in pointcloud2
   */
-  inline void get_timestamp_interval(
-      const sensor_msgs::PointCloud2ConstPtr& msg, double& timestamp_min,
-      double& timestamp_max);
+  template <typename Layout>
+  void get_timestamp_interval(const Layout& layout,
+                              const sensor_msgs::PointCloud2ConstPtr& msg,
+                              double& timestamp_min, double& timestamp_max);
   /**
   * @brief get point field size by sensor_msgs::datatype
   */
@@ -85,12 +127,28 @@ class Compensator {
   std::string world_frame_id_;
   float tf_timeout_;
 
+  // "linear" between the poses at min and max timestamp, or "spline"
+  std::string compensation_mode_;
+  double spline_knot_interval_;
+  double spline_bucket_interval_;
+  // control poses of the spline and transforms of the timestamp buckets,
+  // kept between sweeps to avoid allocations
+  std::vector<Eigen::Vector3d> knot_positions_;
+  std::vector<Eigen::Quaterniond,
+              Eigen::aligned_allocator<Eigen::Quaterniond> > knot_rotations_;
+  std::vector<Eigen::Matrix3f> bucket_rotations_;
+  std::vector<Eigen::Vector3f> bucket_translations_;
+
   // variables for point fields value, we get point x,y,z by these offset
   int x_offset_;
   int y_offset_;
   int z_offset_;
   int timestamp_offset_;
   uint timestamp_data_size_;
+  // fields and point step the offsets were parsed from
+  std::vector<sensor_msgs::PointField> fields_;
+  uint32_t point_step_;
+  PointLayout layout_;
 
   // topic names
   std::string topic_compensated_pointcloud_;
@@ -21,13 +21,84 @@ namespace apollo {
 namespace drivers {
 namespace lslidar_compensator {
 
+// point step of the decoder's PointXYZIT
+const int kXYZITPointStep = 32;
+
+// the coordinates are read as float or double only
+static bool is_coordinate_type(int datatype) {
+  return datatype == sensor_msgs::PointField::FLOAT32 ||
+         datatype == sensor_msgs::PointField::FLOAT64;
+}
+
+/**
+ * @brief the decoder's point, the offsets are constants the compiler folds
+ *   into the loops
+ */
+template <int PointStep>
+struct XYZITLayout {
+  typedef float Scalar;
+  int step() const { return PointStep; }
+  float* x(uint8_t* point) const { return reinterpret_cast<float*>(point); }
+  float* y(uint8_t* point) const {
+    return reinterpret_cast<float*>(point + 4);
+  }
+  float* z(uint8_t* point) const {
+    return reinterpret_cast<float*>(point + 8);
+  }
+  double timestamp(const uint8_t* point) const {
+    double t;
+    memcpy(&t, point + 24, sizeof(t));
+    return t;
+  }
+};
+
+/**
+ * @brief any layout, with the offsets parsed from the fields
+ */
+template <typename ScalarType>
+struct GenericLayout {
+  typedef ScalarType Scalar;
+  GenericLayout(int point_step, int x_offset, int y_offset, int z_offset,
+                int timestamp_offset, uint timestamp_size)
+      : point_step_(point_step),
+        x_offset_(x_offset),
+        y_offset_(y_offset),
+        z_offset_(z_offset),
+        timestamp_offset_(timestamp_offset),
+        timestamp_size_(timestamp_size) {}
+  int step() const { return point_step_; }
+  Scalar* x(uint8_t* point) const {
+    return reinterpret_cast<Scalar*>(point + x_offset_);
+  }
+  Scalar* y(uint8_t* point) const {
+    return reinterpret_cast<Scalar*>(point + y_offset_);
+  }
+  Scalar* z(uint8_t* point) const {
+    return reinterpret_cast<Scalar*>(point + z_offset_);
+  }
+  double timestamp(const uint8_t* point) const {
+    double t = 0.0;
+    memcpy(&t, point + timestamp_offset_, timestamp_size_);
+    return t;
+  }
+
+  int point_step_;
+  int x_offset_;
+  int y_offset_;
+  int z_offset_;
+  int timestamp_offset_;
+  uint timestamp_size_;
+};
+
 Compensator::Compensator(ros::NodeHandle node, ros::NodeHandle private_nh)
     : tf2_transform_listener_(tf2_buffer_, node),
       x_offset_(-1),
       y_offset_(-1),
       z_offset_(-1),
       timestamp_offset_(-1),
-      timestamp_data_size_(0) {
+      timestamp_data_size_(0),
+      point_step_(0),
+      layout_(LAYOUT_INVALID) {
   private_nh.param("child_frame_id", child_frame_id_,
                    std::string("lslidar"));
   private_nh.param("world_frame_id", world_frame_id_,
@@ -38,6 +109,19 @@ Compensator::Compensator(ros::NodeHandle node, ros::NodeHandle private_nh)
   private_nh.param("lslidar_point_cloud", topic_pointcloud_, std::string("/apollo/sensor/lslidar/PointCloud2"));
   private_nh.param("queue_size", queue_size_, 10);
   private_nh.param("tf_query_timeout", tf_timeout_, float(0.1));
+  private_nh.param("compensation_mode", compensation_mode_,
+                   std::string("linear"));
+  private_nh.param("spline_knot_interval", spline_knot_interval_, 0.01);
+  private_nh.param("spline_bucket_interval", spline_bucket_interval_, 0.0005);
+  if (compensation_mode_ != "linear" && compensation_mode_ != "spline") {
+    ROS_WARN_STREAM("Unknown compensation_mode " << compensation_mode_
+                    << ", using linear");
+    compensation_mode_ = "linear";
+  }
+  if (spline_knot_interval_ <= 0 || spline_bucket_interval_ <= 0) {
+    ROS_WARN("spline intervals must be positive, using linear compensation");
+    compensation_mode_ = "linear";
+  }
 
   // advertise output point cloud (before subscribing to input data)
   compensation_pub_ = node.advertise<sensor_msgs::PointCloud2>(
@@ -54,12 +138,32 @@ void Compensator::pointcloud_callback(
     return;
   }
 
+  switch (layout_) {
+    case LAYOUT_XYZIT:
+      compensate(msg, XYZITLayout<kXYZITPointStep>());
+      break;
+    case LAYOUT_FLOAT:
+      compensate(msg, GenericLayout<float>(point_step_, x_offset_, y_offset_,
+                                           z_offset_, timestamp_offset_,
+                                           timestamp_data_size_));
+      break;
+    default:
+      compensate(msg, GenericLayout<double>(point_step_, x_offset_, y_offset_,
+                                            z_offset_, timestamp_offset_,
+                                            timestamp_data_size_));
+      break;
+  }
+}
+
+template <typename Layout>
+void Compensator::compensate(const sensor_msgs::PointCloud2ConstPtr& msg,
+                             const Layout& layout) {
   Eigen::Affine3d pose_min_time;
   Eigen::Affine3d pose_max_time;
 
   double timestamp_min = 0;
   double timestamp_max = 0;
-  get_timestamp_interval(msg, timestamp_min, timestamp_max);
+  get_timestamp_interval(layout, msg, timestamp_min, timestamp_max);
 
   // compensate point cloud, remove nan point
   if (query_pose_affine_from_tf2(timestamp_min, pose_min_time) &&
@@ -67,75 +171,106 @@ void Compensator::pointcloud_callback(
     // we change message after motion compensation
     sensor_msgs::PointCloud2::Ptr q_msg(new sensor_msgs::PointCloud2());
     *q_msg = *msg;
-    motion_compensation<float>(q_msg, timestamp_min, timestamp_max,
-                               pose_min_time, pose_max_time);
+    // the spline needs the poses of the whole sweep, fall back to the
+    // linear motion if tf2 does not have them
+    if (compensation_mode_ != "spline" ||
+        !spline_motion_compensation(layout, q_msg, timestamp_min,
+                                    timestamp_max, pose_max_time)) {
+      motion_compensation(layout, q_msg, timestamp_min, timestamp_max,
+                          pose_min_time, pose_max_time);
+    }
     q_msg->header.stamp.fromSec(timestamp_max);
     compensation_pub_.publish(q_msg);
   }
 }
 
-inline void Compensator::get_timestamp_interval(
-    const sensor_msgs::PointCloud2ConstPtr& msg, double& timestamp_min,
-    double& timestamp_max) {
+template <typename Layout>
+void Compensator::get_timestamp_interval(
+    const Layout& layout, const sensor_msgs::PointCloud2ConstPtr& msg,
+    double& timestamp_min, double& timestamp_max) {
   timestamp_max = 0.0;
   timestamp_min = std::numeric_limits<double>::max();
   int total = msg->width * msg->height;
 
   // get min time and max time
-  for (int i = 0; i < total; ++i) {
-    double timestamp = 0.0;
-    memcpy(&timestamp, &msg->data[i * msg->point_step + timestamp_offset_],
-           timestamp_data_size_);
-
-    if (timestamp < timestamp_min) {
-      timestamp_min = timestamp;
-    }
-    if (timestamp > timestamp_max) {
-      timestamp_max = timestamp;
-    }
+  const uint8_t* point = &msg->data[0];
+  for (int i = 0; i < total; ++i, point += layout.step()) {
+    double timestamp = layout.timestamp(point);
+    timestamp_min = std::min(timestamp_min, timestamp);
+    timestamp_max = std::max(timestamp_max, timestamp);
   }
 }
 
-// TODO: if point type is always float, and timestamp is always double?
 inline bool Compensator::check_message(
     const sensor_msgs::PointCloud2ConstPtr& msg) {
   // check msg width and height
   if (msg->width == 0 || msg->height == 0) {
     return false;
   }
+  if (msg->data.size() < msg->width * msg->height * msg->point_step) {
+    return false;
+  }
 
+  // the fields of a topic rarely change, reuse the offsets of the previous
+  // message if they are the same
+  bool same_fields = layout_ != LAYOUT_INVALID &&
+                     msg->point_step == point_step_ &&
+                     msg->fields.size() == fields_.size();
+  for (size_t i = 0; same_fields && i < fields_.size(); ++i) {
+    const sensor_msgs::PointField& f = msg->fields[i];
+    same_fields = f.offset == fields_[i].offset &&
+                  f.datatype == fields_[i].datatype &&
+                  f.count == fields_[i].count && f.name == fields_[i].name;
+  }
+  if (same_fields) {
+    return true;
+  }
+
+  fields_ = msg->fields;
+  point_step_ = msg->point_step;
+  layout_ = LAYOUT_INVALID;
+  x_offset_ = y_offset_ = z_offset_ = timestamp_offset_ = -1;
+  if (!parse_fields(msg)) {
+    return false;
+  }
+  return layout_ != LAYOUT_INVALID;
+}
+
+bool Compensator::parse_fields(const sensor_msgs::PointCloud2ConstPtr& msg) {
   int x_data_type = 0;
   int y_data_type = 0;
   int z_data_type = 0;
+  int timestamp_data_type = 0;
 
-  // TODO: will use a new data structure with interface to get offset,
-  // datatype,datasize...
   for (size_t i = 0; i < msg->fields.size(); ++i) {
     const sensor_msgs::PointField& f = msg->fields[i];
 
     if (f.name == "x") {
       x_offset_ = f.offset;
       x_data_type = f.datatype;
-      if ((x_data_type != 7 && x_data_type != 8) || f.count != 1 ||
+      if (!is_coordinate_type(x_data_type) || f.count != 1 ||
           x_offset_ == -1) {
         return false;
       }
     } else if (f.name == "y") {
       y_offset_ = f.offset;
       y_data_type = f.datatype;
-      if (f.count != 1 || y_offset_ == -1) {
+      if (!is_coordinate_type(y_data_type) || f.count != 1 ||
+          y_offset_ == -1) {
         return false;
       }
     } else if (f.name == "z") {
       z_offset_ = f.offset;
       z_data_type = f.datatype;
-      if (f.count != 1 || z_offset_ == -1) {
+      if (!is_coordinate_type(z_data_type) || f.count != 1 ||
+          z_offset_ == -1) {
         return false;
       }
     } else if (f.name == "timestamp") {
       timestamp_offset_ = f.offset;
+      timestamp_data_type = f.datatype;
       timestamp_data_size_ = f.count * get_field_size(f.datatype);
-      if (timestamp_offset_ == -1 || timestamp_data_size_ == -1) {
+      if (timestamp_offset_ == -1 || timestamp_data_size_ == 0) {
         return false;
       }
     } else {
@@ -145,12 +280,26 @@ inline bool Compensator::check_message(
 
   // check offset if valid
   if (x_offset_ == -1 || y_offset_ == -1 || z_offset_ == -1 ||
-      timestamp_offset_ == -1 || timestamp_data_size_ == -1) {
+      timestamp_offset_ == -1 || timestamp_data_size_ == 0) {
     return false;
   }
   if (!(x_data_type == y_data_type && y_data_type == z_data_type)) {
     return false;
   }
+
+  if (x_data_type == sensor_msgs::PointField::FLOAT32 && x_offset_ == 0 &&
+      y_offset_ == 4 && z_offset_ == 8 && timestamp_offset_ == 24 &&
+      timestamp_data_type == sensor_msgs::PointField::FLOAT64 &&
+      timestamp_data_size_ == sizeof(double) &&
+      point_step_ == kXYZITPointStep) {
+    layout_ = LAYOUT_XYZIT;
+  } else if (x_data_type == sensor_msgs::PointField::FLOAT32) {
+    layout_ = LAYOUT_FLOAT;
+  } else if (x_data_type == sensor_msgs::PointField::FLOAT64) {
+    layout_ = LAYOUT_DOUBLE;
+  } else {
+    return false;
+  }
   return true;
 }
 
@@ -208,12 +357,14 @@ inline uint Compensator::get_field_size(const int datatype) {
   }
 }
 
-template <typename Scalar>
-void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
+template <typename Layout>
+void Compensator::motion_compensation(const Layout& layout,
+                                      sensor_msgs::PointCloud2::Ptr& msg,
                                       const double timestamp_min,
                                       const double timestamp_max,
                                       const Eigen::Affine3d& pose_min_time,
                                       const Eigen::Affine3d& pose_max_time) {
+  typedef typename Layout::Scalar Scalar;
   using std::abs;
   using std::sin;
   using std::acos;
@@ -228,6 +379,7 @@ void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
   translation = q_max.conjugate() * translation;
 
   int total = msg->width * msg->height;
+  uint8_t* point = &msg->data[0];
 
   double d = q0.dot(q1);
   double abs_d = abs(d);
@@ -243,24 +395,16 @@ void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
     double theta = acos(abs_d);
     double sin_theta = sin(theta);
     double c1_sign = (d > 0) ? 1 : -1;
-    for (int i = 0; i < total; ++i) {
-      size_t offset = i * msg->point_step;
-      Scalar* x_scalar =
-          reinterpret_cast<Scalar*>(&msg->data[offset + x_offset_]);
+    for (int i = 0; i < total; ++i, point += layout.step()) {
+      Scalar* x_scalar = layout.x(point);
       if (std::isnan(*x_scalar)) {
-        ROS_DEBUG_STREAM("nan point do not need motion compensation");
         continue;
       }
-      Scalar* y_scalar =
-          reinterpret_cast<Scalar*>(&msg->data[offset + y_offset_]);
-      Scalar* z_scalar =
-          reinterpret_cast<Scalar*>(&msg->data[offset + z_offset_]);
+      Scalar* y_scalar = layout.y(point);
+      Scalar* z_scalar = layout.z(point);
       Eigen::Vector3d p(*x_scalar, *y_scalar, *z_scalar);
 
-      double tp = 0.0;
-      memcpy(&tp, &msg->data[i * msg->point_step + timestamp_offset_],
-             timestamp_data_size_);
-      double t = (timestamp_max - tp) * f;
+      double t = (timestamp_max - layout.timestamp(point)) * f;
 
       Eigen::Translation3d ti(t * translation);
 
@@ -277,30 +421,131 @@ void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
     return;
   }
   // Not a "significant" rotation. Do translation only.
-  for (int i = 0; i < total; ++i) {
-    Scalar* x_scalar =
-        reinterpret_cast<Scalar*>(&msg->data[i * msg->point_step + x_offset_]);
+  for (int i = 0; i < total; ++i, point += layout.step()) {
+    Scalar* x_scalar = layout.x(point);
     if (std::isnan(*x_scalar)) {
-      ROS_DEBUG_STREAM("nan point do not need motion compensation");
       continue;
     }
-    Scalar* y_scalar =
-        reinterpret_cast<Scalar*>(&msg->data[i * msg->point_step + y_offset_]);
-    Scalar* z_scalar =
-        reinterpret_cast<Scalar*>(&msg->data[i * msg->point_step + z_offset_]);
-    Eigen::Vector3d p(*x_scalar, *y_scalar, *z_scalar);
-
-    double tp = 0.0;
-    memcpy(&tp, &msg->data[i * msg->point_step + timestamp_offset_],
-           timestamp_data_size_);
-    double t = (timestamp_max - tp) * f;
-    Eigen::Translation3d ti(t * translation);
-
-    p = ti * p;
+    Scalar* y_scalar = layout.y(point);
+    Scalar* z_scalar = layout.z(point);
+
+    double t = (timestamp_max - layout.timestamp(point)) * f;
+    *x_scalar += t * translation.x();
+    *y_scalar += t * translation.y();
+    *z_scalar += t * translation.z();
+  }
+}
+
+template <typename Layout>
+bool Compensator::spline_motion_compensation(
+    const Layout& layout, sensor_msgs::PointCloud2::Ptr& msg,
+    const double timestamp_min, const double timestamp_max,
+    const Eigen::Affine3d& pose_max_time) {
+  typedef typename Layout::Scalar Scalar;
+  // control poses every knot interval up to the max timestamp, one before
+  // the segment of the min timestamp and one after the max timestamp
+  const double h = spline_knot_interval_;
+  const int segments = std::max(
+      1, static_cast<int>(std::ceil((timestamp_max - timestamp_min) / h)));
+  const double start = timestamp_max - segments * h;
+  knot_positions_.resize(segments + 3);
+  knot_rotations_.resize(segments + 3);
+  for (int j = 0; j <= segments + 1; ++j) {
+    Eigen::Affine3d pose;
+    if (j == segments + 1) {
+      pose = pose_max_time;
+    } else if (!query_pose_affine_from_tf2(start + (j - 1) * h, pose)) {
+      return false;
+    }
+    knot_positions_[j] = pose.translation();
+    knot_rotations_[j] = Eigen::Quaterniond(pose.linear()).normalized();
+    // same hemisphere as the previous one, so that the relative rotations
+    // take the short way
+    if (j > 0 && knot_rotations_[j].dot(knot_rotations_[j - 1]) < 0) {
+      knot_rotations_[j].coeffs() *= -1;
+    }
+  }
+  // the pose after the max timestamp is in the future, continue the motion
+  // of the last interval so that the spline ends at the max pose
+  const int last = segments + 1;
+  knot_positions_[last + 1] =
+      2 * knot_positions_[last] - knot_positions_[last - 1];
+  knot_rotations_[last + 1] =
+      (knot_rotations_[last] * knot_rotations_[last - 1].conjugate() *
+       knot_rotations_[last]).normalized();
+
+  // points are moved into the frame of the max timestamp, with the spline
+  // pose at the center of their bucket
+  const Eigen::Affine3d inverse_max = spline_pose(segments - 1, 1.0).inverse();
+  const double bucket = spline_bucket_interval_;
+  const int buckets =
+      static_cast<int>((timestamp_max - timestamp_min) / bucket) + 1;
+  bucket_rotations_.resize(buckets);
+  bucket_translations_.resize(buckets);
+  for (int b = 0; b < buckets; ++b) {
+    const double t =
+        std::min(timestamp_min + (b + 0.5) * bucket, timestamp_max);
+    const double s = (t - start) / h;
+    const int segment = std::min(static_cast<int>(s), segments - 1);
+    const Eigen::Affine3d trans =
+        inverse_max * spline_pose(segment, s - segment);
+    bucket_rotations_[b] = trans.linear().cast<float>();
+    bucket_translations_[b] = trans.translation().cast<float>();
+  }
+
+  int total = msg->width * msg->height;
+  uint8_t* point = &msg->data[0];
+  for (int i = 0; i < total; ++i, point += layout.step()) {
+    Scalar* x_scalar = layout.x(point);
+    if (std::isnan(*x_scalar)) {
+      continue;
+    }
+    Scalar* y_scalar = layout.y(point);
+    Scalar* z_scalar = layout.z(point);
+
+    double tp = layout.timestamp(point);
+    const int b = std::min(
+        std::max(static_cast<int>((tp - timestamp_min) / bucket), 0),
+        buckets - 1);
+
+    const Eigen::Vector3f p =
+        bucket_rotations_[b] *
+            Eigen::Vector3f(*x_scalar, *y_scalar, *z_scalar) +
+        bucket_translations_[b];
     *x_scalar = p.x();
     *y_scalar = p.y();
     *z_scalar = p.z();
   }
+  return true;
+}
+
+Eigen::Affine3d Compensator::spline_pose(const int first,
+                                         const double u) const {
+  const double u2 = u * u;
+  const double u3 = u2 * u;
+  // uniform cubic B-spline basis for the position
+  const double b0 = (1 - u) * (1 - u) * (1 - u) / 6;
+  const double b1 = (3 * u3 - 6 * u2 + 4) / 6;
+  const double b2 = (-3 * u3 + 3 * u2 + 3 * u + 1) / 6;
+  const double b3 = u3 / 6;
+  const Eigen::Vector3d position = b0 * knot_positions_[first] +
+                                   b1 * knot_positions_[first + 1] +
+                                   b2 * knot_positions_[first + 2] +
+                                   b3 * knot_positions_[first + 3];
+
+  // cumulative basis for the rotation, applied to the relative rotations
+  // between neighbouring control poses
+  const double c[3] = {(5 + 3 * u - 3 * u2 + u3) / 6,
+                       (1 + 3 * u + 3 * u2 - 2 * u3) / 6, u3 / 6};
+  Eigen::Quaterniond rotation = knot_rotations_[first];
+  for (int k = 0; k < 3; ++k) {
+    const Eigen::AngleAxisd delta(knot_rotations_[first + k].conjugate() *
+                                  knot_rotations_[first + k + 1]);
+    rotation = rotation * Eigen::Quaterniond(
+                              Eigen::AngleAxisd(c[k] * delta.angle(),
+                                                delta.axis()));
+  }
+  return Eigen::Translation3d(position) * rotation.normalized();
 }
 
 }  // namespace lslidar
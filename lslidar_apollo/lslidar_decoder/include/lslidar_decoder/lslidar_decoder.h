@@ -35,15 +35,20 @@ limitations under the License.                                              /
 #include <pcl/point_types.h>
 
 #include <lslidar_msgs/LslidarPacket.h>
+#include <lslidar_msgs/LslidarPacketBatch.h>
 #include <lslidar_msgs/LslidarPoint.h>
 #include <lslidar_msgs/LslidarScan.h>
 #include <lslidar_msgs/LslidarSweep.h>
 #include <lslidar_msgs/LslidarLayer.h>
 
+#include <lidar_downsample/downsample.h>
+
 namespace apollo {
 namespace drivers {
 namespace lslidar_decoder {
 
+using lidar_downsample::Downsampler;
+
 // Raw lslidar packet constants and structures.
 static const int SIZE_BLOCK      = 100;
 static const int RAW_SCAN_SIZE   = 3;
@@ -77,8 +82,12 @@ static const int SCANS_PER_PACKET =
 static const int FIRINGS_PER_PACKET =
         FIRINGS_PER_BLOCK * BLOCKS_PER_PACKET;
 
+// Points stored per scan and revolution: 3600 for the 0.1 degree azimuth
+// resolution, rounded up with headroom for 0.09 degree at 5Hz.
+static const int SWEEP_SLOTS_PER_SCAN = 4096;
+
 // Pre-compute the sine and cosine for the altitude angles.
-static const double SCAN_ALTITUDE[16] = {
+static const float SCAN_ALTITUDE[16] = {
     -0.2617993877991494,   0.017453292519943295,
     -0.22689280275926285,  0.05235987755982989,
     -0.19198621771937624,  0.08726646259971647,
@@ -89,7 +98,7 @@ static const double SCAN_ALTITUDE[16] = {
     -0.017453292519943295, 0.2617993877991494
 };
 
-static const double COS_SCAN_ALTITUDE[16] = {
+static const float COS_SCAN_ALTITUDE[16] = {
     std::cos(SCAN_ALTITUDE[ 0]), std::cos(SCAN_ALTITUDE[ 1]),
     std::cos(SCAN_ALTITUDE[ 2]), std::cos(SCAN_ALTITUDE[ 3]),
     std::cos(SCAN_ALTITUDE[ 4]), std::cos(SCAN_ALTITUDE[ 5]),
@@ -100,7 +109,7 @@ static const double COS_SCAN_ALTITUDE[16] = {
     std::cos(SCAN_ALTITUDE[14]), std::cos(SCAN_ALTITUDE[15]),
 };
 
-static const double SIN_SCAN_ALTITUDE[16] = {
+static const float SIN_SCAN_ALTITUDE[16] = {
     std::sin(SCAN_ALTITUDE[ 0]), std::sin(SCAN_ALTITUDE[ 1]),
     std::sin(SCAN_ALTITUDE[ 2]), std::sin(SCAN_ALTITUDE[ 3]),
     std::sin(SCAN_ALTITUDE[ 4]), std::sin(SCAN_ALTITUDE[ 5]),
@@ -111,11 +120,6 @@ static const double SIN_SCAN_ALTITUDE[16] = {
     std::sin(SCAN_ALTITUDE[14]), std::sin(SCAN_ALTITUDE[15]),
 };
 
-struct point_struct{
-    double distance;
-    double intensity;
-};
-
 struct PointXYZIT {
   PCL_ADD_POINT4D
   uint8_t intensity;
@@ -161,9 +165,47 @@ private:
     struct Firing {
         // Azimuth associated with the first shot within this firing.
         double firing_azimuth;
-        double azimuth[SCANS_PER_FIRING];
-        double distance[SCANS_PER_FIRING];
-        double intensity[SCANS_PER_FIRING];
+        float azimuth[SCANS_PER_FIRING];
+        float distance[SCANS_PER_FIRING];
+        float intensity[SCANS_PER_FIRING];
+    };
+
+    // One revolution in structure-of-arrays layout. Scan i owns the slots
+    // [i*SWEEP_SLOTS_PER_SCAN, i*SWEEP_SLOTS_PER_SCAN + size[i]) of every
+    // point field array, so the buffer never reallocates.
+    //
+    // The LaserScan outputs are served from a range image of
+    // SCANS_PER_FIRING rows by point_num azimuth bins, filled in the same
+    // pass; row i is the ranges/intensities of the LaserScan of scan i.
+    struct SweepBuffer {
+        double start_time;
+        int outputs;        ///< Output flags sampled when the sweep began
+        int size[SCANS_PER_FIRING];
+        std::vector<float> time;  ///< [µs] since the first firing, start_time
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> azimuth;
+        std::vector<float> distance;
+        std::vector<float> intensity;
+
+        int bins;
+        int image_size[SCANS_PER_FIRING]; ///< points binned per row
+        std::vector<float> ranges;
+        std::vector<float> intensities;
+
+        void allocate(int azimuth_bins);
+        // Start a new revolution building the given outputs
+        void reset(int requested_outputs, double sweep_start);
+    };
+
+    // Outputs with at least one subscriber, sampled once per sweep.
+    enum Output {
+        OUTPUT_SWEEP        = 0x1,
+        OUTPUT_POINT_CLOUD  = 0x2,
+        OUTPUT_SCAN         = 0x4,
+        OUTPUT_CHANNEL_SCAN = 0x8,
+        OUTPUT_REDUCED_POINT_CLOUD = 0x10,
     };
 
     // Intialization sequence
@@ -176,11 +218,22 @@ private:
     void decodePacket(const RawPacket* packet);
     void layerCallback(const std_msgs::Int8Ptr& msg);
     void packetCallback(const lslidar_msgs::LslidarPacketConstPtr& msg);
+    void batchCallback(const lslidar_msgs::LslidarPacketBatchConstPtr& msg);
+    void processPacket(const lslidar_msgs::LslidarPacket& msg);
+    // Append the valid points of the given firings to the sweep storage
+    void fillSweep(size_t start_fir_idx, size_t end_fir_idx);
+    // Decide which outputs the next sweep has to be built for
+    int requestedOutputs() const;
     // Publish data
-    void publishPointCloud();
-    void publishChannelScan();
+    void publishSweep(const SweepBuffer& sweep);
+    // Publish the full and the reduced point cloud, whichever is requested
+    void publishPointCloud(const SweepBuffer& sweep);
+    void publishChannelScan(const SweepBuffer& sweep);
     // Publish scan Data
-    void publishScan();
+    void publishScan(const SweepBuffer& sweep);
+    // Rasterize one channel of the sweep into a LaserScan
+    void fillLaserScan(const SweepBuffer& sweep, int channel,
+                       sensor_msgs::LaserScan& scan);
 
     // Check if a point is in the required range.
     bool isPointInRange(const double& distance) {
@@ -193,12 +246,12 @@ private:
         return static_cast<double>(raw_azimuth) / 100.0 * DEG_TO_RAD;
     }
 
-    // calc the means_point
-    point_struct getMeans(std::vector<point_struct> clusters);
-
     // configuration degree base
     int point_num;
     double angle_base;
+    float inv_angle_base;
+    // Range image bins outside [angle_disable_min, angle_disable_max)
+    std::vector<uint8_t> bin_enabled;
 
     // Configuration parameters
     double min_range;
@@ -209,8 +262,10 @@ private:
     bool publish_point_cloud;
     bool publish_channels;
     bool apollo_interface;
-    double cos_azimuth_table[6300];
-    double sin_azimuth_table[6300];
+    // Picks the points of the reduced point cloud, see downsample.h
+    Downsampler downsampler;
+    float cos_azimuth_table[6300];
+    float sin_azimuth_table[6300];
 
     bool is_first_sweep;
     double last_azimuth;
@@ -227,14 +282,17 @@ private:
     std::string fixed_frame_id;
     std::string child_frame_id;
 
-    lslidar_msgs::LslidarSweepPtr sweep_data;
-    lslidar_msgs::LslidarLayerPtr multi_scan;
-    sensor_msgs::PointCloud2 point_cloud_data;
+    // Double buffered revolutions: sweep_buffers[fill_idx] is filled while
+    // the other one holds the last complete sweep being published.
+    SweepBuffer sweep_buffers[2];
+    int fill_idx;
 
     ros::Subscriber packet_sub;
+    ros::Subscriber batch_sub;
     ros::Subscriber layer_sub;
     ros::Publisher sweep_pub;
     ros::Publisher point_cloud_pub;
+    ros::Publisher reduced_point_cloud_pub;
     ros::Publisher scan_pub;
     ros::Publisher channel_scan_pub;
 
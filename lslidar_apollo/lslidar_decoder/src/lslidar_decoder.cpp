@@ -32,8 +32,7 @@ LslidarDecoder::LslidarDecoder(
     sweep_start_time(0.0),
     // layer_num(8),
     packet_start_time(0.0),
-    sweep_data(new lslidar_msgs::LslidarSweep()),
-    multi_scan(new lslidar_msgs::LslidarLayer())
+    fill_idx(0)
     {
     return;
 }
@@ -53,7 +52,20 @@ bool LslidarDecoder::loadParameters() {
     pnh.param<string>("fixed_frame_id", fixed_frame_id, "map");
     pnh.param<string>("child_frame_id", child_frame_id, "lslidar");
 
+    string reduction;
+    double reduction_leaf_size;
+    int reduction_ring_stride;
+    int reduction_azimuth_stride;
+    pnh.param<string>("reduction", reduction, "none");
+    pnh.param<double>("reduction_leaf_size", reduction_leaf_size, 0.2);
+    pnh.param<int>("reduction_ring_stride", reduction_ring_stride, 2);
+    pnh.param<int>("reduction_azimuth_stride", reduction_azimuth_stride, 4);
+    downsampler.configure(lidar_downsample::reduction_mode(reduction),
+                          reduction_leaf_size, reduction_ring_stride,
+                          reduction_azimuth_stride);
+
     angle_base = M_PI*2 / point_num;
+    inv_angle_base = 1.0 / angle_base;
 
     if (apollo_interface)
     {
@@ -66,12 +78,18 @@ bool LslidarDecoder::loadParameters() {
 bool LslidarDecoder::createRosIO() {
     packet_sub = nh.subscribe<lslidar_msgs::LslidarPacket>(
                 "lslidar_packet", 100, &LslidarDecoder::packetCallback, this);
+    batch_sub = nh.subscribe<lslidar_msgs::LslidarPacketBatch>(
+                "lslidar_packet_batch", 10, &LslidarDecoder::batchCallback, this);
     layer_sub = nh.subscribe(
                 "layer_num", 100, &LslidarDecoder::layerCallback, this);
     sweep_pub = nh.advertise<lslidar_msgs::LslidarSweep>(
                 "lslidar_sweep", 10);
     point_cloud_pub = nh.advertise<sensor_msgs::PointCloud2>(
                 "lslidar_point_cloud", 10);
+    if (downsampler.enabled()) {
+        reduced_point_cloud_pub = nh.advertise<sensor_msgs::PointCloud2>(
+                    "lslidar_point_cloud_reduced", 10);
+    }
     scan_pub = nh.advertise<sensor_msgs::LaserScan>(
                 "scan", 100);
     channel_scan_pub = nh.advertise<lslidar_msgs::LslidarLayer>(
@@ -90,17 +108,20 @@ bool LslidarDecoder::initialize() {
         return false;
     }
 
-    // Fill in the altitude for each scan.
-    for (size_t scan_idx = 0; scan_idx < 16; ++scan_idx) {
-        size_t remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
-        sweep_data->scans[remapped_scan_idx].altitude = SCAN_ALTITUDE[scan_idx];
+    sweep_buffers[0].allocate(point_num);
+    sweep_buffers[1].allocate(point_num);
+
+    bin_enabled.resize(point_num);
+    for (int i = 0; i < point_num; ++i) {
+        bin_enabled[i] = !((i >= angle_disable_min*point_num/360) &&
+                           (i < angle_disable_max*point_num/360));
     }
 
     // Create the sin and cos table for different azimuth values.
     for (size_t i = 0; i < 6300; ++i) {
         double angle = static_cast<double>(i) / 1000.0;
-        cos_azimuth_table[i] = cos(angle);
-        sin_azimuth_table[i] = sin(angle);
+        cos_azimuth_table[i] = static_cast<float>(cos(angle));
+        sin_azimuth_table[i] = static_cast<float>(sin(angle));
     }
 
     return true;
@@ -118,142 +139,200 @@ bool LslidarDecoder::checkPacketValidity(const RawPacket* packet) {
 }
 
 
-void LslidarDecoder::publishPointCloud() {
+int LslidarDecoder::requestedOutputs() const {
+    int requested = 0;
+    if (sweep_pub.getNumSubscribers() > 0) {
+        requested |= OUTPUT_SWEEP;
+    }
+    if (publish_point_cloud && point_cloud_pub.getNumSubscribers() > 0) {
+        requested |= OUTPUT_POINT_CLOUD;
+    }
+    if (publish_point_cloud && downsampler.enabled() &&
+            reduced_point_cloud_pub.getNumSubscribers() > 0) {
+        requested |= OUTPUT_REDUCED_POINT_CLOUD;
+    }
+    if (scan_pub.getNumSubscribers() > 0) {
+        requested |= OUTPUT_SCAN;
+    }
+    if (publish_channels && channel_scan_pub.getNumSubscribers() > 0) {
+        requested |= OUTPUT_CHANNEL_SCAN;
+    }
+    return requested;
+}
+
+void LslidarDecoder::SweepBuffer::allocate(int azimuth_bins) {
+    const size_t slots = SCANS_PER_FIRING * SWEEP_SLOTS_PER_SCAN;
+    time.resize(slots);
+    x.resize(slots);
+    y.resize(slots);
+    z.resize(slots);
+    azimuth.resize(slots);
+    distance.resize(slots);
+    intensity.resize(slots);
+
+    bins = azimuth_bins;
+    ranges.resize(SCANS_PER_FIRING * bins);
+    intensities.resize(SCANS_PER_FIRING * bins);
+    reset(0, 0.0);
+}
+
+void LslidarDecoder::SweepBuffer::reset(int requested_outputs,
+                                        double sweep_start) {
+    start_time = sweep_start;
+    outputs = requested_outputs;
+    std::fill(size, size + SCANS_PER_FIRING, 0);
+    std::fill(image_size, image_size + SCANS_PER_FIRING, 0);
+    if (outputs & (OUTPUT_SCAN | OUTPUT_CHANNEL_SCAN)) {
+        std::fill(ranges.begin(), ranges.end(),
+                  std::numeric_limits<float>::infinity());
+        std::fill(intensities.begin(), intensities.end(),
+                  std::numeric_limits<float>::infinity());
+    }
+}
+
+void LslidarDecoder::publishSweep(const SweepBuffer& sweep) {
+    lslidar_msgs::LslidarSweepPtr sweep_data(new lslidar_msgs::LslidarSweep());
+    sweep_data->header.frame_id = "sweep";
+    sweep_data->header.stamp = ros::Time(sweep.start_time);
+
+    for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx) {
+        size_t remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
+        lslidar_msgs::LslidarScan& scan = sweep_data->scans[remapped_scan_idx];
+        const size_t base = remapped_scan_idx * SWEEP_SLOTS_PER_SCAN;
+
+        scan.altitude = SCAN_ALTITUDE[scan_idx];
+        scan.points.resize(sweep.size[remapped_scan_idx]);
+        for (size_t i = 0; i < scan.points.size(); ++i) {
+            lslidar_msgs::LslidarPoint& new_point = scan.points[i];
+            new_point.time = sweep.time[base + i];
+            new_point.x = sweep.x[base + i];
+            new_point.y = sweep.y[base + i];
+            new_point.z = sweep.z[base + i];
+            new_point.azimuth = sweep.azimuth[base + i];
+            new_point.distance = sweep.distance[base + i];
+            new_point.intensity = sweep.intensity[base + i];
+        }
+    }
+    sweep_pub.publish(sweep_data);
+}
+
+void LslidarDecoder::publishPointCloud(const SweepBuffer& sweep) {
+    const bool full = (sweep.outputs & OUTPUT_POINT_CLOUD) != 0;
+    const bool reduce = (sweep.outputs & OUTPUT_REDUCED_POINT_CLOUD) != 0;
     VPointCloud::Ptr point_cloud(new VPointCloud());
+    VPointCloud::Ptr reduced_cloud;
 
-    // pcl_conversions::toPCL(sweep_data->header).stamp;
     point_cloud->header.frame_id = child_frame_id;
     point_cloud->height = 1;
 
-    for (size_t i = 0; i < 16; ++i) {
-        const lslidar_msgs::LslidarScan& scan = sweep_data->scans[i];
-        // The first and last point in each scan is ignored, which
-        // seems to be corrupted based on the received data.
-        // TODO: The two end points should be removed directly
-        //    in the scans.
-
-        // point_time unit is sec
-        double timestamp = point_time;
-        point_cloud->header.stamp = static_cast<uint64_t>(timestamp * 1e6);
-        if (scan.points.size() == 0) continue;
-        size_t j;
-        VPoint point;
-        for (j = 1; j < scan.points.size()-1; ++j) {
-            point.timestamp = timestamp - (scan.points.size()-1 - j)*0.05;  // time interval for each point is 50ms
-            point.x = scan.points[j].x;
-            point.y = scan.points[j].y;
-            point.z = scan.points[j].z;
-            point.intensity = scan.points[j].intensity;
-            point_cloud->points.push_back(point);
-            ++point_cloud->width;
+    // point_time unit is sec
+    const double timestamp = point_time;
+    point_cloud->header.stamp = static_cast<uint64_t>(timestamp * 1e6);
+
+    if (reduce) {
+        reduced_cloud.reset(new VPointCloud());
+        reduced_cloud->header = point_cloud->header;
+        downsampler.reset();
+    }
+
+    // The first and last point in each scan is ignored, which
+    // seems to be corrupted based on the received data.
+    // TODO: The two end points should be removed directly
+    //    in the scans.
+    size_t total = 0;
+    for (size_t i = 0; i < SCANS_PER_FIRING; ++i) {
+        if (sweep.size[i] > 2) total += sweep.size[i] - 2;
+    }
+    if (full) {
+        point_cloud->points.resize(total);
+        point_cloud->width = total;
+    }
+
+    VPoint point;
+    VPoint* out = full && total > 0 ? &point_cloud->points[0] : &point;
+    for (size_t i = 0; i < SCANS_PER_FIRING; ++i) {
+        const int n = sweep.size[i];
+        if (n <= 2) continue;
+        const size_t base = i * SWEEP_SLOTS_PER_SCAN;
+        const float* x = &sweep.x[base];
+        const float* y = &sweep.y[base];
+        const float* z = &sweep.z[base];
+        const float* intensity = &sweep.intensity[base];
+        for (int j = 1; j < n-1; ++j) {
+            out->timestamp = timestamp - (n-1 - j)*0.05;  // time interval for each point is 50ms
+            out->x = x[j];
+            out->y = y[j];
+            out->z = z[j];
+            out->intensity = static_cast<uint8_t>(intensity[j]);
+            if (reduce && downsampler.keep(x[j], y[j], z[j], i)) {
+                reduced_cloud->push_back(*out);
+            }
+            // Without the full cloud every point is staged in point
+            if (full) ++out;
         }
     }
-    point_cloud_pub.publish(point_cloud);
+    if (full) {
+        point_cloud_pub.publish(point_cloud);
+    }
+    if (reduce) {
+        reduced_point_cloud_pub.publish(reduced_cloud);
+    }
+}
+
+void LslidarDecoder::fillLaserScan(const SweepBuffer& sweep, int channel,
+                                   sensor_msgs::LaserScan& scan)
+{
+    const float* ranges = &sweep.ranges[channel * sweep.bins];
+    const float* intensities = &sweep.intensities[channel * sweep.bins];
+
+    scan.header.frame_id = child_frame_id;
+    scan.header.stamp = ros::Time(sweep.start_time);
+    scan.angle_min = 0.0;
+    scan.angle_max = 2.0*M_PI;
+    scan.angle_increment = (scan.angle_max - scan.angle_min)/point_num;
+    //	scan.time_increment = motor_speed_/1e8;
+    scan.range_min = min_range;
+    scan.range_max = max_range;
+    // The row of the range image is the scan, no rebinning needed.
+    scan.ranges.assign(ranges, ranges + sweep.bins);
+    scan.intensities.assign(intensities, intensities + sweep.bins);
 }
 
-void LslidarDecoder::publishChannelScan()
+void LslidarDecoder::publishChannelScan(const SweepBuffer& sweep)
 {
-    multi_scan = lslidar_msgs::LslidarLayerPtr(
-                    new lslidar_msgs::LslidarLayer());
-    // lslidar_msgs::LslidarLayer multi_scan(new lslidar_msgs::LslidarLayer);
-    sensor_msgs::LaserScan scan;
+    lslidar_msgs::LslidarLayerPtr multi_scan(new lslidar_msgs::LslidarLayer());
 
     int layer_num_local = layer_num;
     ROS_INFO_ONCE("default channel is %d", layer_num_local );
-    if(sweep_data->scans[layer_num_local].points.size() <= 1)
+    if(sweep.image_size[layer_num_local] <= 1)
     {
         return;
     }
 
     for (uint16_t j=0; j<16; j++)
     {
-        scan.header.frame_id = child_frame_id;
-        scan.header.stamp = sweep_data->header.stamp;
-        scan.angle_min = 0.0;
-        scan.angle_max = 2.0*M_PI;
-        scan.angle_increment = (scan.angle_max - scan.angle_min)/point_num;
-        //	scan.time_increment = motor_speed_/1e8;
-        scan.range_min = min_range;
-        scan.range_max = max_range;
-        scan.ranges.reserve(point_num);
-        scan.ranges.assign(point_num, std::numeric_limits<float>::infinity());
-        scan.intensities.reserve(point_num);
-        scan.intensities.assign(point_num, std::numeric_limits<float>::infinity());
-
-        for(uint16_t i = 0; i < sweep_data->scans[j].points.size(); i++)
-        {
-            int point_idx = sweep_data->scans[j].points[i].azimuth / angle_base;
-
-            if (point_idx >= point_num)
-                point_idx = 0;
-            if (point_idx < 0)
-                point_idx = point_num - 1;
-
-            scan.ranges[point_num - 1-point_idx] = sweep_data->scans[j].points[i].distance;
-            scan.intensities[point_num - 1-point_idx] = sweep_data->scans[j].points[i].intensity;
-        }
-
-        for (int i = point_num - 1; i >= 0; i--)
-        {
-            if((i >= angle_disable_min*point_num/360) && (i < angle_disable_max*point_num/360))
-            {
-                scan.ranges[i] = std::numeric_limits<float>::infinity();
-            }
-        }
+        fillLaserScan(sweep, j, multi_scan->scan_channel[j]);
+    }
 
-        multi_scan->scan_channel[j] = scan;
-        if (j == layer_num_local)
-        {
-            scan_pub.publish(scan);
-        }
+    if (sweep.outputs & OUTPUT_SCAN)
+    {
+        scan_pub.publish(multi_scan->scan_channel[layer_num_local]);
     }
     channel_scan_pub.publish(multi_scan);
 }
 
 
-void LslidarDecoder::publishScan()
+void LslidarDecoder::publishScan(const SweepBuffer& sweep)
 {
     sensor_msgs::LaserScan::Ptr scan(new sensor_msgs::LaserScan);
     int layer_num_local = layer_num;
     ROS_INFO_ONCE("default channel is %d", layer_num_local);
-    if(sweep_data->scans[layer_num_local].points.size() <= 1)
+    if(sweep.image_size[layer_num_local] <= 1)
     {
         return;
     }
-    scan->header.frame_id = child_frame_id;
-    scan->header.stamp = sweep_data->header.stamp;
-    scan->angle_min = 0.0;
-    scan->angle_max = 2.0*M_PI;
-    scan->angle_increment = (scan->angle_max - scan->angle_min)/point_num;
-    //	scan->time_increment = motor_speed_/1e8;
-    scan->range_min = min_range;
-    scan->range_max = max_range;
-    scan->ranges.reserve(point_num);
-    scan->ranges.assign(point_num, std::numeric_limits<float>::infinity());
-    scan->intensities.reserve(point_num);
-    scan->intensities.assign(point_num, std::numeric_limits<float>::infinity());
-
-    for(uint16_t i = 0; i < sweep_data->scans[layer_num_local].points.size(); i++)
-    {
-        int point_idx = sweep_data->scans[layer_num_local].points[i].azimuth / angle_base;
-
-        if (point_idx >= point_num)
-            point_idx = 0;
-        if (point_idx < 0)
-            point_idx = point_num - 1;
-
-        scan->ranges[point_num - 1-point_idx] = sweep_data->scans[layer_num_local].points[i].distance;
-        scan->intensities[point_num - 1-point_idx] = sweep_data->scans[layer_num_local].points[i].intensity;
-    }
-
-    for (int i = point_num - 1; i >= 0; i--)
-	{
-		if((i >= angle_disable_min*point_num/360) && (i < angle_disable_max*point_num/360))
-			scan->ranges[i] = std::numeric_limits<float>::infinity();
-	}
-
+    fillLaserScan(sweep, layer_num_local, *scan);
     scan_pub.publish(scan);
-
 }
 
 void LslidarDecoder::decodePacket(const RawPacket* packet) {
@@ -321,11 +400,11 @@ void LslidarDecoder::decodePacket(const RawPacket* packet) {
                 TwoBytes raw_distance;
                 raw_distance.bytes[0] = raw_block.data[byte_idx];
                 raw_distance.bytes[1] = raw_block.data[byte_idx+1];
-                firings[fir_idx].distance[scan_fir_idx] = static_cast<double>(
-                            raw_distance.distance) * DISTANCE_RESOLUTION;
+                firings[fir_idx].distance[scan_fir_idx] = static_cast<float>(
+                            raw_distance.distance) * static_cast<float>(DISTANCE_RESOLUTION);
 
                 // Intensity
-                firings[fir_idx].intensity[scan_fir_idx] = static_cast<double>(
+                firings[fir_idx].intensity[scan_fir_idx] = static_cast<float>(
                             raw_block.data[byte_idx+2]);
             }
         }
@@ -333,6 +412,87 @@ void LslidarDecoder::decodePacket(const RawPacket* packet) {
     return;
 }
 
+void LslidarDecoder::fillSweep(size_t start_fir_idx, size_t end_fir_idx) {
+    SweepBuffer& sweep = sweep_buffers[fill_idx];
+    // Nobody listens to this sweep, only the sweep boundaries are tracked.
+    if (sweep.outputs == 0)
+    {
+        return;
+    }
+    const bool need_points =
+            (sweep.outputs & (OUTPUT_SWEEP | OUTPUT_POINT_CLOUD |
+                              OUTPUT_REDUCED_POINT_CLOUD)) != 0;
+    const bool need_image =
+            (sweep.outputs & (OUTPUT_SCAN | OUTPUT_CHANNEL_SCAN)) != 0;
+
+    for (size_t fir_idx = start_fir_idx; fir_idx < end_fir_idx; ++fir_idx)
+    {
+        const Firing& firing = firings[fir_idx];
+        const float fir_time = packet_start_time +
+                FIRING_TOFFSET*(fir_idx-start_fir_idx);
+
+        for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx)
+        {
+            const float distance = firing.distance[scan_idx];
+            // Check if the point is valid.
+            if (!isPointInRange(distance))
+            {
+                continue;
+            }
+
+            // Remap the index of the scan
+            int remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
+            const float azimuth = firing.azimuth[scan_idx];
+
+            if (need_image)
+            {
+                // Bin into the range image, mirrored like the LaserScan.
+                int point_idx = azimuth * inv_angle_base;
+                if (point_idx >= point_num)
+                    point_idx = 0;
+                if (point_idx < 0)
+                    point_idx = point_num - 1;
+
+                const int bin = point_num - 1 - point_idx;
+                const size_t pixel = remapped_scan_idx * point_num + bin;
+                if (bin_enabled[bin])
+                    sweep.ranges[pixel] = distance;
+                sweep.intensities[pixel] = firing.intensity[scan_idx];
+                ++sweep.image_size[remapped_scan_idx];
+            }
+
+            if (!need_points)
+            {
+                continue;
+            }
+
+            if (sweep.size[remapped_scan_idx] >= SWEEP_SLOTS_PER_SCAN)
+            {
+                ROS_WARN_THROTTLE(1, "Sweep buffer of scan %d is full, "
+                                  "dropping points", remapped_scan_idx);
+                continue;
+            }
+            const size_t slot = remapped_scan_idx * SWEEP_SLOTS_PER_SCAN +
+                    sweep.size[remapped_scan_idx]++;
+
+            // Compute the time of the point
+            sweep.time[slot] = fir_time + DSR_TOFFSET*scan_idx;
+            sweep.azimuth[slot] = azimuth;
+            sweep.distance[slot] = distance;
+            sweep.intensity[slot] = firing.intensity[scan_idx];
+
+            // Convert the point to xyz coordinate, the sensor frame
+            // (x right, y forward) is rotated to x forward, y left.
+            size_t table_idx = static_cast<size_t>(azimuth*1000.0f + 0.5f);
+            const float xy_distance = distance * COS_SCAN_ALTITUDE[scan_idx];
+
+            sweep.x[slot] = xy_distance * cos_azimuth_table[table_idx];
+            sweep.y[slot] = -xy_distance * sin_azimuth_table[table_idx];
+            sweep.z[slot] = distance * SIN_SCAN_ALTITUDE[scan_idx];
+        }
+    }
+}
+
 void LslidarDecoder::layerCallback(const std_msgs::Int8Ptr& msg){
     int num = msg->data;
     if (num < 0)
@@ -352,9 +512,20 @@ void LslidarDecoder::layerCallback(const std_msgs::Int8Ptr& msg){
 
 void LslidarDecoder::packetCallback(
         const lslidar_msgs::LslidarPacketConstPtr& msg) {
+    processPacket(*msg);
+}
+
+void LslidarDecoder::batchCallback(
+        const lslidar_msgs::LslidarPacketBatchConstPtr& msg) {
+    for (size_t i = 0; i < msg->packets.size(); ++i) {
+        processPacket(msg->packets[i]);
+    }
+}
+
+void LslidarDecoder::processPacket(const lslidar_msgs::LslidarPacket& msg) {
     //  ROS_WARN("packetCallBack");
     // Convert the msg to the raw packet type.
-    const RawPacket* raw_packet = (const RawPacket*) (&(msg->data[0]));
+    const RawPacket* raw_packet = (const RawPacket*) (&(msg.data[0]));
 
     // Check if the packet is valid
     if (!checkPacketValidity(raw_packet))
@@ -364,7 +535,7 @@ void LslidarDecoder::packetCallback(
 
     // Decode the packet
     decodePacket(raw_packet);
-    point_time = msg->stamp.toSec();
+    point_time = msg.stamp.toSec();
 
     // Find the start of a new revolution
     //    If there is one, new_sweep_start will be the index of the start firing,
@@ -399,148 +570,60 @@ void LslidarDecoder::packetCallback(
             is_first_sweep = false;
             start_fir_idx = new_sweep_start;
             end_fir_idx = FIRINGS_PER_PACKET;
-            sweep_start_time = msg->stamp.toSec() +
+            sweep_start_time = msg.stamp.toSec() +
                     FIRING_TOFFSET * (end_fir_idx-start_fir_idx) * 1e-6;
+            sweep_buffers[fill_idx].reset(requestedOutputs(), sweep_start_time);
         }
     }
 
-    for (size_t fir_idx = start_fir_idx; fir_idx < end_fir_idx; ++fir_idx)
-    {
-        for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx)
-        {
-            // Check if the point is valid.
-            if (!isPointInRange(firings[fir_idx].distance[scan_idx])) continue;
-
-            // Convert the point to xyz coordinate
-            size_t table_idx = floor(firings[fir_idx].azimuth[scan_idx]*1000.0+0.5);
-            //cout << table_idx << endl;
-            double cos_azimuth = cos_azimuth_table[table_idx];
-            double sin_azimuth = sin_azimuth_table[table_idx];
-
-            double x = firings[fir_idx].distance[scan_idx] *
-                    COS_SCAN_ALTITUDE[scan_idx] * sin_azimuth;
-            double y = firings[fir_idx].distance[scan_idx] *
-                    COS_SCAN_ALTITUDE[scan_idx] * cos_azimuth;
-            double z = firings[fir_idx].distance[scan_idx] *
-                    SIN_SCAN_ALTITUDE[scan_idx];
-
-            double x_coord = y;
-            double y_coord = -x;
-            double z_coord = z;
-
-            // Compute the time of the point
-            double time = packet_start_time +
-                    FIRING_TOFFSET*fir_idx + DSR_TOFFSET*scan_idx;
-
-            // Remap the index of the scan
-            int remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
-            sweep_data->scans[remapped_scan_idx].points.push_back(
-                        lslidar_msgs::LslidarPoint());
-
-            lslidar_msgs::LslidarPoint& new_point =		// new_point refers to the last element of push_back
-                    sweep_data->scans[remapped_scan_idx].points[
-                    sweep_data->scans[remapped_scan_idx].points.size()-1];
-
-            // Pack the data into point msg
-            new_point.time = time;
-            new_point.x = x_coord;
-            new_point.y = y_coord;
-            new_point.z = z_coord;
-            new_point.azimuth = firings[fir_idx].azimuth[scan_idx];
-            new_point.distance = firings[fir_idx].distance[scan_idx];
-            new_point.intensity = firings[fir_idx].intensity[scan_idx];
-        }
-    }
-
+    fillSweep(start_fir_idx, end_fir_idx);
     packet_start_time += FIRING_TOFFSET * (end_fir_idx-start_fir_idx);
 
     // A new sweep begins
     if (end_fir_idx != FIRINGS_PER_PACKET)
     {
         //	ROS_WARN("A new sweep begins");
-        // Publish the last revolution
-        sweep_data->header.frame_id = "sweep";
-        sweep_data->header.stamp = ros::Time(sweep_start_time);
-
-        sweep_pub.publish(sweep_data);
-
-        if (publish_point_cloud)
-        {
-            publishPointCloud();
-        }
-
-        if (publish_channels)
-        {
-            publishChannelScan();
-        }
-        else
-        {
-            publishScan();
-        }
-
-        sweep_data = lslidar_msgs::LslidarSweepPtr(
-                    new lslidar_msgs::LslidarSweep());
+        // Swap buffers: the tail of this packet starts the next revolution
+        // while the finished one is published.
+        const SweepBuffer& finished = sweep_buffers[fill_idx];
+        fill_idx ^= 1;
 
         // Prepare the next revolution
-        sweep_start_time = msg->stamp.toSec() +
+        sweep_start_time = msg.stamp.toSec() +
                 FIRING_TOFFSET * (end_fir_idx-start_fir_idx) * 1e-6;
 
+        sweep_buffers[fill_idx].reset(requestedOutputs(), sweep_start_time);
+
         packet_start_time = 0.0;
         last_azimuth = firings[FIRINGS_PER_PACKET-1].firing_azimuth;
 
         start_fir_idx = end_fir_idx;
         end_fir_idx = FIRINGS_PER_PACKET;
 
-        for (size_t fir_idx = start_fir_idx; fir_idx < end_fir_idx; ++fir_idx)
+        fillSweep(start_fir_idx, end_fir_idx);
+        packet_start_time += FIRING_TOFFSET * (end_fir_idx-start_fir_idx);
+
+        // Publish the last revolution, building only the outputs
+        // somebody listens to.
+        if (finished.outputs & OUTPUT_SWEEP)
         {
-            for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx)
-            {
-                // Check if the point is valid.
-                if (!isPointInRange(firings[fir_idx].distance[scan_idx]))
-                {
-                    continue;
-                }
-
-                // Convert the point to xyz coordinate
-                size_t table_idx = floor(firings[fir_idx].azimuth[scan_idx]*1000.0+0.5);
-                double cos_azimuth = cos_azimuth_table[table_idx];
-                double sin_azimuth = sin_azimuth_table[table_idx];
-
-                double x = firings[fir_idx].distance[scan_idx] *
-                        COS_SCAN_ALTITUDE[scan_idx] * sin_azimuth;
-                double y = firings[fir_idx].distance[scan_idx] *
-                        COS_SCAN_ALTITUDE[scan_idx] * cos_azimuth;
-                double z = firings[fir_idx].distance[scan_idx] *
-                        SIN_SCAN_ALTITUDE[scan_idx];
-
-                double x_coord = y;
-                double y_coord = -x;
-                double z_coord = z;
-
-                // Compute the time of the point
-                double time = packet_start_time +
-                        FIRING_TOFFSET*(fir_idx-start_fir_idx) + DSR_TOFFSET*scan_idx;
-
-                // Remap the index of the scan
-                int remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
-                sweep_data->scans[remapped_scan_idx].points.push_back(
-                            lslidar_msgs::LslidarPoint());
-                lslidar_msgs::LslidarPoint& new_point =
-                        sweep_data->scans[remapped_scan_idx].points[
-                        sweep_data->scans[remapped_scan_idx].points.size()-1];
-
-                // Pack the data into point msg
-                new_point.time = time;
-                new_point.x = x_coord;
-                new_point.y = y_coord;
-                new_point.z = z_coord;
-                new_point.azimuth = firings[fir_idx].azimuth[scan_idx];
-                new_point.distance = firings[fir_idx].distance[scan_idx];
-                new_point.intensity = firings[fir_idx].intensity[scan_idx];
-            }
+            publishSweep(finished);
         }
 
-        packet_start_time += FIRING_TOFFSET * (end_fir_idx-start_fir_idx);
+        if (finished.outputs &
+                (OUTPUT_POINT_CLOUD | OUTPUT_REDUCED_POINT_CLOUD))
+        {
+            publishPointCloud(finished);
+        }
+
+        if (finished.outputs & OUTPUT_CHANNEL_SCAN)
+        {
+            publishChannelScan(finished);
+        }
+        else if (finished.outputs & OUTPUT_SCAN)
+        {
+            publishScan(finished);
+        }
     }
     //  ROS_WARN("pack end");
     return;
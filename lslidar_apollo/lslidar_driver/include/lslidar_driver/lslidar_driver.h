@@ -21,6 +21,7 @@ limitations under the License.                                              /
 #include <stdio.h>
 #include <netinet/in.h>
 #include <string>
+#include <vector>
 #include <time.h>
 
 #include <boost/shared_ptr.hpp>
@@ -29,6 +30,7 @@ limitations under the License.                                              /
 #include <std_msgs/UInt64.h>
 
 #include <lslidar_msgs/LslidarPacket.h>
+#include <lslidar_msgs/LslidarPacketBatch.h>
 
 namespace apollo {
 namespace drivers {
@@ -36,6 +38,13 @@ namespace lslidar_driver {
 
 //static uint16_t UDP_PORT_NUMBER = 8080;
 static uint16_t PACKET_SIZE = 1206;
+// Batches kept for reuse; a batch is refilled once no subscriber holds it.
+static const size_t BATCH_POOL_SIZE = 4;
+// Largest expected gap of the FPGA counter between two data packets,
+// about 18 packet periods.
+static const uint32_t FPGA_MAX_GAP_US = 10000;
+// Longest wait for a packet before the socket is reported as silent [ms].
+static const int POLL_TIMEOUT = 2000;
 
 class LslidarDriver {
 public:
@@ -47,7 +56,7 @@ public:
     bool polling();
 
     void initTimeStamp(void);
-    void getFPGA_GPSTimeStamp(lslidar_msgs::LslidarPacketPtr &packet);
+    void getFPGA_GPSTimeStamp(lslidar_msgs::LslidarPacket &packet);
 
     typedef boost::shared_ptr<LslidarDriver> LslidarDriverPtr;
     typedef boost::shared_ptr<const LslidarDriver> LslidarDriverConstPtr;
@@ -57,7 +66,10 @@ private:
     bool loadParameters();
     bool createRosIO();
     bool openUDPPort();
-    int getPacket(lslidar_msgs::LslidarPacketPtr& msg);
+    int getPacket(lslidar_msgs::LslidarPacket& msg,
+                  int timeout_ms = POLL_TIMEOUT);
+    bool pollBatch();
+    lslidar_msgs::LslidarPacketBatchPtr acquireBatch();
 
     // Ethernet related variables
     std::string device_ip_string;
@@ -71,13 +83,27 @@ private:
 
     std::string frame_id;
     ros::Publisher packet_pub;
+    ros::Publisher batch_pub;
 
+    // Packet batching, disabled if batch_size <= 1
+    int batch_size;
+    double batch_time_budget;   // [s]
+    std::vector<lslidar_msgs::LslidarPacketBatchPtr> batch_pool;
+
+    // GPS second of the last positioning packet, data packets only add
+    // their FPGA microsecond counter to it
     uint64_t pointcloudTimeStamp;
     unsigned char packetTimeStamp[10];
     struct tm cur_time;
     unsigned short int us;
     unsigned short int ms;
     ros::Time timeStamp;
+
+    // FPGA microsecond counter statistics
+    uint32_t last_fpga_us;
+    uint64_t fpga_wraps;          ///< counter restarted at a GPS second
+    uint64_t fpga_backward_jumps; ///< counter went back within a second
+    uint64_t fpga_forward_jumps;  ///< gap larger than FPGA_MAX_GAP_US
 };
 
 typedef LslidarDriver::LslidarDriverPtr LslidarDriverPtr;
@@ -15,6 +15,7 @@ limitations under the License.                                              /
 ****************************************************************************/
 
 #include <string>
+#include <algorithm>
 #include <cmath>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -48,13 +49,24 @@ bool LslidarDriver::loadParameters() {
     pnh.param("frame_id", frame_id, std::string("lslidar"));
     pnh.param("device_ip", device_ip_string, std::string("192.168.1.222"));
     pnh.param<int>("device_port", UDP_PORT_NUMBER, 2368);
+    pnh.param<int>("batch_size", batch_size, 1);
+    pnh.param<double>("batch_time_budget", batch_time_budget, 0.01);
     inet_aton(device_ip_string.c_str(), &device_ip);
     ROS_INFO_STREAM("Opening UDP socket: address " << device_ip_string);
     ROS_INFO_STREAM("Opening UDP socket: port " << UDP_PORT_NUMBER);
+    if (batch_size > 1)
+        ROS_INFO_STREAM("Batching " << batch_size << " packets, at most "
+                        << batch_time_budget << "s per batch");
     return true;
 }
 
 bool LslidarDriver::createRosIO() {
+    if (batch_size > 1) {
+        // Output batches of packets
+        batch_pub = nh.advertise<lslidar_msgs::LslidarPacketBatch>(
+                    "lslidar_packet_batch", 10);
+        return true;
+    }
     // Output lidar_packet publisher
     packet_pub = nh.advertise<lslidar_msgs::LslidarPacket>(
                 "lslidar_packet", 100);
@@ -111,14 +123,17 @@ bool LslidarDriver::initialize() {
 }
 
 int LslidarDriver::getPacket(
-        lslidar_msgs::LslidarPacketPtr& packet) {
+        lslidar_msgs::LslidarPacket& packet, int timeout_ms) {
 
     double time1 = ros::Time::now().toSec();
 
     struct pollfd fds[1];
     fds[0].fd = socket_id;
     fds[0].events = POLLIN;
-    static const int POLL_TIMEOUT = 2000; // one second (in msec)
+    // a shorter wait is a batch time budget running out, not a silent lidar
+    const bool warn_timeout = timeout_ms >= POLL_TIMEOUT;
+    const ros::WallTime poll_deadline =
+            ros::WallTime::now() + ros::WallDuration(timeout_ms / 1000.0);
 
     sockaddr_in sender_address;
     socklen_t sender_address_len = sizeof(sender_address);
@@ -127,7 +142,7 @@ int LslidarDriver::getPacket(
     {
         do {
             // poll() until input available
-            int retval = poll(fds, 1, POLL_TIMEOUT);
+            int retval = poll(fds, 1, timeout_ms);
             if (retval < 0)             // poll() error?
             {
                 if (errno != EINTR)
@@ -136,7 +151,8 @@ int LslidarDriver::getPacket(
             }
             if (retval == 0)            // poll() timeout?
             {
-                ROS_WARN("lslidar poll() timeout");
+                if (warn_timeout)
+                    ROS_WARN("lslidar poll() timeout");
                 return 1;
             }
             if ((fds[0].revents & POLLERR)
@@ -150,7 +166,7 @@ int LslidarDriver::getPacket(
 
         // Receive packets that should now be available from the
         // socket using a blocking read.
-        ssize_t nbytes = recvfrom(socket_id, &packet->data[0], PACKET_SIZE,  0,
+        ssize_t nbytes = recvfrom(socket_id, &packet.data[0], PACKET_SIZE,  0,
                 (sockaddr*) &sender_address, &sender_address_len);
 
         if (nbytes < 0)
@@ -168,7 +184,12 @@ int LslidarDriver::getPacket(
             // if packet is not from the lidar scanner we selected by IP,
             // continue otherwise we are done
             if( device_ip_string != "" && sender_address.sin_addr.s_addr != device_ip.s_addr )
+            {
+                // wait only for what is left of the timeout
+                timeout_ms = std::max(0, static_cast<int>(std::ceil(
+                        (poll_deadline - ros::WallTime::now()).toSec() * 1000)));
                 continue;
+            }
             else
                 break; //done
         }
@@ -176,13 +197,18 @@ int LslidarDriver::getPacket(
 
     // get GPS and FPGA timestamp from packet
     this->getFPGA_GPSTimeStamp(packet);
-    packet->stamp = this->timeStamp;
+    packet.stamp = this->timeStamp;
 
     return 0;
 }
 
 bool LslidarDriver::polling()
 {
+    if (batch_size > 1)
+    {
+        return pollBatch();
+    }
+
     // Allocate a new shared pointer for zero-copy sharing with other nodelets.
     lslidar_msgs::LslidarPacketPtr packet(
                 new lslidar_msgs::LslidarPacket());
@@ -190,7 +216,7 @@ bool LslidarDriver::polling()
     while (true)
     {
         // keep reading until full packet received
-        int rc = getPacket(packet);
+        int rc = getPacket(*packet);
         if (rc == 0) break;       // got a full packet?
         if (rc < 0) return false; // end of file reached?
     }
@@ -201,6 +227,64 @@ bool LslidarDriver::polling()
     return true;
 }
 
+lslidar_msgs::LslidarPacketBatchPtr LslidarDriver::acquireBatch()
+{
+    for (size_t i = 0; i < batch_pool.size(); ++i)
+    {
+        if (batch_pool[i].unique())
+        {
+            batch_pool[i]->packets.clear();
+            return batch_pool[i];
+        }
+    }
+
+    // All pooled batches are still held by subscribers.
+    lslidar_msgs::LslidarPacketBatchPtr batch(
+                new lslidar_msgs::LslidarPacketBatch());
+    batch->packets.reserve(batch_size);
+    if (batch_pool.size() < BATCH_POOL_SIZE)
+        batch_pool.push_back(batch);
+    return batch;
+}
+
+bool LslidarDriver::pollBatch()
+{
+    lslidar_msgs::LslidarPacketBatchPtr batch = acquireBatch();
+    const ros::WallTime deadline =
+            ros::WallTime::now() + ros::WallDuration(batch_time_budget);
+
+    while (static_cast<int>(batch->packets.size()) < batch_size)
+    {
+        // A partial batch waits no longer than the rest of the time budget
+        // and is flushed once it is used up, so the latency stays bounded
+        // when packets stop arriving. An empty batch waits for its first
+        // packet as long as a single packet would.
+        int timeout_ms = POLL_TIMEOUT;
+        if (!batch->packets.empty())
+        {
+            const double remaining =
+                    (deadline - ros::WallTime::now()).toSec();
+            if (remaining <= 0)
+                break;
+            timeout_ms = std::min(POLL_TIMEOUT,
+                    static_cast<int>(std::ceil(remaining * 1000)));
+        }
+
+        batch->packets.resize(batch->packets.size() + 1);
+        int rc = getPacket(batch->packets.back(), timeout_ms);
+        if (rc != 0)
+        {
+            batch->packets.pop_back();
+            if (rc < 0) return false; // end of file reached?
+        }
+    }
+
+    batch->header.frame_id = frame_id;
+    batch->header.stamp = batch->packets.back().stamp;
+    batch_pub.publish(batch);
+    return true;
+}
+
 void LslidarDriver::initTimeStamp(void)
 {
     int i;
@@ -212,48 +296,78 @@ void LslidarDriver::initTimeStamp(void)
     this->pointcloudTimeStamp = 0;
 
     this->timeStamp = ros::Time(0.0);
+
+    this->last_fpga_us = 0;
+    this->fpga_wraps = 0;
+    this->fpga_backward_jumps = 0;
+    this->fpga_forward_jumps = 0;
 }
 
-void LslidarDriver::getFPGA_GPSTimeStamp(lslidar_msgs::LslidarPacketPtr &packet)
+void LslidarDriver::getFPGA_GPSTimeStamp(lslidar_msgs::LslidarPacket &packet)
 {
-    unsigned char head2[] = {packet->data[0],packet->data[1],packet->data[2],packet->data[3]};
+    unsigned char head2[] = {packet.data[0],packet.data[1],packet.data[2],packet.data[3]};
 
     if(head2[0] == 0xA5 && head2[1] == 0xFF)
     {
         if(head2[2] == 0x00 && head2[3] == 0x5A)
         {
-            this->packetTimeStamp[4] = packet->data[41];
-            this->packetTimeStamp[5] = packet->data[40];
-            this->packetTimeStamp[6] = packet->data[39];
-            this->packetTimeStamp[7] = packet->data[38];
-            this->packetTimeStamp[8] = packet->data[37];
-            this->packetTimeStamp[9] = packet->data[36];
+            this->packetTimeStamp[4] = packet.data[41];
+            this->packetTimeStamp[5] = packet.data[40];
+            this->packetTimeStamp[6] = packet.data[39];
+            this->packetTimeStamp[7] = packet.data[38];
+            this->packetTimeStamp[8] = packet.data[37];
+            this->packetTimeStamp[9] = packet.data[36];
+
+            // The calendar part only changes with the positioning packet
+            // (once per second), so convert it here and not per data packet.
+            cur_time.tm_sec = this->packetTimeStamp[4];
+            cur_time.tm_min = this->packetTimeStamp[5];
+            cur_time.tm_hour = this->packetTimeStamp[6];
+            cur_time.tm_mday = this->packetTimeStamp[7];
+            cur_time.tm_mon = this->packetTimeStamp[8]-1;
+            cur_time.tm_year = this->packetTimeStamp[9]+2000-1900;
+            this->pointcloudTimeStamp = static_cast<uint64_t>(timegm(&cur_time));
         }
     }
     else if(head2[0] == 0xFF && head2[1] == 0xEE)
     {
-        uint64_t packet_timestamp;
-        packet_timestamp = (packet->data[1200]  +
-                        packet->data[1201] * pow(2, 8) +
-                        packet->data[1202] * pow(2, 16) +
-                        packet->data[1203] * pow(2, 24)) * 1e3;
-
-        cur_time.tm_sec = this->packetTimeStamp[4];
-        cur_time.tm_min = this->packetTimeStamp[5];
-        cur_time.tm_hour = this->packetTimeStamp[6];
-        cur_time.tm_mday = this->packetTimeStamp[7];
-        cur_time.tm_mon = this->packetTimeStamp[8]-1;
-        cur_time.tm_year = this->packetTimeStamp[9]+2000-1900;
-        this->pointcloudTimeStamp = static_cast<uint64_t>(timegm(&cur_time));
-
-	    // timeStamp = ros::Time(this->pointcloudTimeStamp+total_us/10e5);
-
-        timeStamp = ros::Time(this->pointcloudTimeStamp, packet_timestamp);
-        ROS_DEBUG("ROS TS: %f, GPS: y:%d m:%d d:%d h:%d m:%d s:%d; FPGA: us:%lu",
-        timeStamp.toSec(),
-        cur_time.tm_year,cur_time.tm_mon,cur_time.tm_mday,cur_time.tm_hour,cur_time.tm_min,cur_time.tm_sec,
-        packet_timestamp);
+        const uint32_t fpga_us =
+                static_cast<uint32_t>(packet.data[1200]) |
+                static_cast<uint32_t>(packet.data[1201]) << 8 |
+                static_cast<uint32_t>(packet.data[1202]) << 16 |
+                static_cast<uint32_t>(packet.data[1203]) << 24;
+
+        if (fpga_us < last_fpga_us)
+        {
+            // The counter restarts every GPS second, anything else going
+            // back in time is a jump.
+            if (last_fpga_us - fpga_us > 500000)
+            {
+                ++fpga_wraps;
+            }
+            else
+            {
+                ++fpga_backward_jumps;
+                ROS_WARN_THROTTLE(10, "FPGA timestamp went back from %u to %u us "
+                        "(%lu backward, %lu forward jumps, %lu wraps)",
+                        last_fpga_us, fpga_us, fpga_backward_jumps,
+                        fpga_forward_jumps, fpga_wraps);
+            }
+        }
+        else if (last_fpga_us != 0 && fpga_us - last_fpga_us > FPGA_MAX_GAP_US)
+        {
+            ++fpga_forward_jumps;
+            ROS_WARN_THROTTLE(10, "FPGA timestamp jumped from %u to %u us "
+                    "(%lu backward, %lu forward jumps, %lu wraps)",
+                    last_fpga_us, fpga_us, fpga_backward_jumps,
+                    fpga_forward_jumps, fpga_wraps);
+        }
+        last_fpga_us = fpga_us;
 
+        timeStamp = ros::Time(static_cast<uint32_t>(this->pointcloudTimeStamp),
+                              fpga_us * 1000);
+        ROS_DEBUG("ROS TS: %f, GPS: %lu s; FPGA: us:%u",
+                  timeStamp.toSec(), this->pointcloudTimeStamp, fpga_us);
     }
 }
 
@@ -47,6 +47,12 @@ class CameraCalibration {
   std::vector<double> cameraR;  //  x y z
 };
 
+struct CameraStats {
+  uint64_t frames;     ///< pictures received since Start()
+  uint64_t dropped;    ///< pictures skipped while the decoders were behind
+  uint64_t discarded;  ///< pictures with lost or bad fragments
+};
+
 class Pandora {
  public:
   /**
@@ -89,6 +95,92 @@ class Pandora {
    */
   void ResetLidarStartAngle(uint16_t start_angle);
 
+  /**
+   * @brief Configure the lidar packet queue, applied by the next Start().
+   * @param capacity Number of preallocated packet slots
+   *        policy   What to do with packets while the queue is full
+   */
+  void SetLidarPacketQueue(uint32_t capacity, PacketQueuePolicy policy);
+
+  /**
+   * @brief Select the lidar returns kept in dual return mode. Call it before
+   *        Start().
+   * @param policy The returns that become points
+   */
+  void SetLidarDualReturnPolicy(DualReturnPolicy policy);
+
+  /**
+   * @brief Also deliver a motion compensated copy of every lidar cloud,
+   *        written while the points are projected. Each copy is in the lidar
+   *        frame at its timestamp, clouds without poses get no copy. Call it
+   *        before Start().
+   * @param enable               Compensate the frames
+   *        compensated_callback The callback of the compensated clouds
+   */
+  void SetLidarCompensation(
+      bool enable,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          compensated_callback);
+
+  /**
+   * @brief Also deliver a downsampled copy of every lidar cloud, picked while
+   *        the points are projected. Call it before Start().
+   * @param mode             How the points are picked
+   *        leaf_size        Voxel edge in meters, REDUCTION_VOXEL
+   *        ring_stride      Keep every ring_stride-th laser, REDUCTION_STRIDE
+   *        azimuth_stride   and of it every azimuth_stride-th point
+   *        reduced_callback The callback of the reduced clouds
+   */
+  void SetLidarReduction(
+      ReductionMode mode, double leaf_size, int ring_stride,
+      int azimuth_stride,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          reduced_callback);
+
+  /**
+   * @brief Add a lidar pose for the motion compensation, in time order, e.g.
+   *        from the localization.
+   * @param pose The pose of the lidar in the world frame
+   */
+  void AddLidarPose(const Pose &pose);
+
+  /**
+   * @brief Get the lidar packet queue statistics.
+   */
+  PacketQueueStats GetLidarPacketQueueStats() const;
+
+  /**
+   * @brief Get the lidar point cloud frame statistics.
+   */
+  FrameStats GetLidarFrameStats() const;
+
+  /**
+   * @brief Get the camera picture statistics.
+   */
+  CameraStats GetCameraStats() const;
+
+  /**
+   * @brief Publish a crop and/or a downscaled copy of a camera's undistorted
+   *        picture instead of the full picture. Call it before Start().
+   * @param pic_id The camera, 0 - 4
+   *        roi    The crop of the 1280x720 undistorted picture
+   *        scale  Output size relative to roi, in (0, 1]
+   */
+  bool SetCameraUndistortedView(int pic_id, const cv::Rect &roi,
+                                double scale);
+
+  /**
+   * @brief Decode the camera pictures into images of the caller, e.g. the
+   *        data buffer of the message that will carry them, instead of
+   *        images of the SDK. Call it before Start().
+   * @param allocator Called from the decode thread of camera pic_id, returns
+   *                  a continuous width x height CV_8UC3 image or NULL
+   */
+  void SetCameraImageAllocator(
+      boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                                 int height)>
+          allocator);
+
   /**
    * @brief Upload the camera calibration contents to Pandora Device.
    * @param calibs calibration contents , include camera intrinsics and
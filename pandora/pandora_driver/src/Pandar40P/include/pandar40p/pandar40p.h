@@ -25,6 +25,7 @@
 
 #include <string>
 
+#include "lidar_downsample/downsample.h"
 #include "pandar40p/point_types.h"
 
 namespace apollo {
@@ -33,6 +34,79 @@ namespace hesai {
 
 class Pandar40P_Internal;
 
+/**
+ * @brief What the receive thread does with a lidar packet while the packet
+ *        queue to the decode thread is full.
+ */
+enum PacketQueuePolicy {
+  /** receive and discard the new packet, counted in dropped */
+  PACKET_QUEUE_DROP_NEWEST = 0,
+  /** stop receiving until a slot is free, the socket buffer absorbs the
+   *  backlog (and GPS packets wait as well) */
+  PACKET_QUEUE_BLOCK = 1,
+};
+
+/**
+ * @brief Which returns of a dual return packet become points. Single return
+ *        packets always give every return.
+ */
+enum DualReturnPolicy {
+  /** both returns, twice the points of single return */
+  DUAL_RETURN_BOTH = 0,
+  /** both returns, the second one only where its range differs */
+  DUAL_RETURN_DEDUPED = 1,
+  /** the return with the higher intensity */
+  DUAL_RETURN_STRONGEST = 2,
+  /** the return with the longer range */
+  DUAL_RETURN_LAST = 3,
+};
+
+/**
+ * @brief How the points of the reduced cloud, a downsampled copy of every
+ *        frame, are picked. The lasers are the rings of the stride mode.
+ */
+using lidar_downsample::ReductionMode;
+using lidar_downsample::REDUCTION_NONE;
+using lidar_downsample::REDUCTION_VOXEL;
+using lidar_downsample::REDUCTION_STRIDE;
+
+/**
+ * @brief Statistics of the lidar packet queue between the receive and the
+ *        decode thread.
+ */
+struct PacketQueueStats {
+  uint64_t received;         ///< lidar packets queued
+  uint64_t dropped;          ///< lidar packets discarded, queue full
+  uint32_t depth;            ///< packets currently queued
+  uint32_t high_water_mark;  ///< largest depth seen since Start()
+  uint32_t capacity;         ///< number of preallocated slots
+};
+
+/**
+ * @brief Completeness of the point cloud frames. A frame is one revolution,
+ *        cut where the blocks cross the start angle.
+ */
+struct FrameStats {
+  uint64_t frames;             ///< frames delivered since Start()
+  uint64_t incomplete_frames;  ///< frames with missing blocks
+  uint32_t blocks;             ///< blocks in the last frame
+  uint32_t missing_blocks;     ///< blocks missing from the last frame
+  uint32_t points;             ///< points in the last frame
+  double latency;              ///< seconds from receiving the packet that
+                               ///< closed the last frame to its callback
+  uint64_t uncompensated_frames;  ///< frames without a pose to compensate,
+                                  ///< delivered raw only
+};
+
+/**
+ * @brief A pose of the lidar in the world frame, for motion compensation.
+ */
+struct Pose {
+  double timestamp;       ///< seconds, the clock of the point timestamps
+  double x, y, z;         ///< position
+  double qw, qx, qy, qz;  ///< orientation
+};
+
 class Pandar40P {
  public:
   /**
@@ -52,6 +126,26 @@ class Pandar40P {
             boost::function<void(double)> gps_callback, uint16_t start_angle,
             int tz, std::string frame_id);
 
+  /**
+   * @brief Constructor replaying a pcap capture instead of the device
+   * @param pcap_file         The capture of the lidar and gps packets
+   *        replay_rate       1 for real time, N for N times faster, 0 for as
+   *                          fast as the packets are decoded, best with
+   *                          PACKET_QUEUE_BLOCK
+   *        lidar_port        The port number of lidar data in the capture
+   *        gps_port          The port number of gps data in the capture
+   *        pcl_callback      The callback of PCL data structure
+   *        gps_callback      The callback of GPS structure
+   *        start_angle       The start angle of every point cloud ,
+   *                          should be <real angle> * 100.
+   */
+  Pandar40P(const std::string &pcap_file, double replay_rate,
+            uint16_t lidar_port, uint16_t gps_port,
+            boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+                pcl_callback,
+            boost::function<void(double)> gps_callback, uint16_t start_angle,
+            int tz, std::string frame_id);
+
   /**
    * @brief destructor
    */
@@ -69,6 +163,73 @@ class Pandar40P {
    */
   void ResetStartAngle(uint16_t start_angle);
 
+  /**
+   * @brief Configure the lidar packet queue, applied by the next Start().
+   * @param capacity Number of preallocated packet slots
+   *        policy   What to do with packets while the queue is full
+   */
+  void SetPacketQueue(uint32_t capacity, PacketQueuePolicy policy);
+
+  /**
+   * @brief Select the returns kept in dual return mode. Call it before
+   *        Start().
+   * @param policy The returns that become points
+   */
+  void SetDualReturnPolicy(DualReturnPolicy policy);
+
+  /**
+   * @brief Also deliver a motion compensated copy of every frame, written
+   *        while the points are projected. Every point of the copy is moved
+   *        into the lidar frame at the first block of the frame, and the
+   *        compensated callback gets the time of that block. The raw frame
+   *        still goes to the pcl callback, a frame without poses only there.
+   *        Call it before Start().
+   * @param enable               Compensate the frames
+   *        compensated_callback The callback of the compensated clouds
+   */
+  void EnableCompensation(
+      bool enable,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          compensated_callback);
+
+  /**
+   * @brief Also deliver a downsampled copy of every frame, picked while the
+   *        points are projected. It is a copy of the raw frame and gets the
+   *        same timestamp. Call it before Start().
+   * @param mode             How the points are picked
+   *        leaf_size        Voxel edge in meters, REDUCTION_VOXEL
+   *        ring_stride      Keep every ring_stride-th laser, REDUCTION_STRIDE
+   *        azimuth_stride   and of it every azimuth_stride-th point
+   *        reduced_callback The callback of the reduced clouds
+   */
+  void SetReduction(ReductionMode mode, double leaf_size, int ring_stride,
+                    int azimuth_stride,
+                    boost::function<void(boost::shared_ptr<PPointCloud>,
+                                         double)>
+                        reduced_callback);
+
+  /**
+   * @brief Add a pose for the motion compensation, in time order.
+   * @param pose The pose of the lidar in the world frame
+   */
+  void AddPose(const Pose &pose);
+
+  /**
+   * @brief Get the lidar packet queue statistics.
+   */
+  PacketQueueStats GetPacketQueueStats() const;
+
+  /**
+   * @brief Get the point cloud frame statistics.
+   */
+  FrameStats GetFrameStats() const;
+
+  /**
+   * @brief Whether a pcap replay reached the end of the capture and every
+   *        packet of it was decoded.
+   */
+  bool ReplayDone() const;
+
   /**
    * @brief Run SDK.
    */
@@ -22,6 +22,7 @@
 #include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <iostream>
 #include <sstream>
 
@@ -31,9 +32,30 @@ namespace apollo {
 namespace drivers {
 namespace hesai {
 
-Input::Input(uint16_t port, uint16_t gpsPort) {
+static double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double monotonicTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+Input::Input(uint16_t port, uint16_t gpsPort)
+    : pcapHandle(NULL),
+      datalink(0),
+      pcapLidarPort(port),
+      pcapGpsPort(gpsPort),
+      replayRate(0),
+      replayStart(0),
+      captureStart(0),
+      pcapDone(false) {
   socketForGPS = -1;
   socketForLidar = -1;
+  socketNumber = 0;
 
   socketForLidar = socket(PF_INET, SOCK_DGRAM, 0);
   if (socketForLidar == -1) {
@@ -88,15 +110,47 @@ Input::Input(uint16_t port, uint16_t gpsPort) {
   socketNumber = 2;
 }
 
+Input::Input(const std::string &pcapFile, uint16_t port, uint16_t gpsPort,
+             double rate)
+    : pcapHandle(NULL),
+      datalink(0),
+      pcapLidarPort(port),
+      pcapGpsPort(gpsPort),
+      replayRate(rate),
+      replayStart(0),
+      captureStart(0),
+      pcapDone(false) {
+  socketForGPS = -1;
+  socketForLidar = -1;
+  socketNumber = 0;
+
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcapHandle = pcap_open_offline(pcapFile.c_str(), errbuf);
+  if (!pcapHandle) {
+    std::cout << "Open pcap file " << pcapFile << " failed, " << errbuf
+              << std::endl;
+    pcapDone = true;
+    return;
+  }
+  datalink = pcap_datalink(pcapHandle);
+}
+
 Input::~Input(void) {
   if (socketForGPS > 0) close(socketForGPS);
   if (socketForLidar > 0) (void)close(socketForLidar);
+  if (pcapHandle) pcap_close(pcapHandle);
 }
 
+bool Input::replayDone() const { return pcapDone; }
+
 // return : 0 - lidar
 //          1 - gps
 //          -1 - error
 int Input::getPacket(PandarPacket *pkt) {
+  if (pcapHandle || pcapDone) {
+    return getPacketFromPcap(pkt);
+  }
+
   struct pollfd fds[socketNumber];
   if (socketNumber == 2) {
     fds[0].fd = socketForGPS;
@@ -145,10 +199,97 @@ int Input::getPacket(PandarPacket *pkt) {
     }
   }
   pkt->size = nbytes;
+  pkt->stamp = wallTime();
 
   return 0;
 }
 
+// return : 0 - a lidar or gps packet of the capture
+//          -1 - end of the capture or error
+int Input::getPacketFromPcap(PandarPacket *pkt) {
+  if (pcapDone) {
+    // nothing more to replay, do not spin the receive thread
+    usleep(100000);
+    return -1;
+  }
+
+  struct pcap_pkthdr *header;
+  const u_char *data;
+  while (true) {
+    int ret = pcap_next_ex(pcapHandle, &header, &data);
+    if (ret == -2) {
+      std::cout << "Pcap replay finished" << std::endl;
+      pcapDone = true;
+      return -1;
+    }
+    if (ret != 1) {
+      std::cout << "Read pcap failed, " << pcap_geterr(pcapHandle)
+                << std::endl;
+      pcapDone = true;
+      return -1;
+    }
+
+    // link layer header, then an unfragmented IPv4 UDP datagram
+    uint32_t offset = 0;
+    uint16_t protocol = 0x0800;
+    if (datalink == DLT_EN10MB) {
+      offset = 14;
+      if (header->caplen < offset) continue;
+      protocol = (data[12] << 8) | data[13];
+      if (protocol == 0x8100 && header->caplen >= 18) {  // 802.1Q
+        protocol = (data[16] << 8) | data[17];
+        offset = 18;
+      }
+    } else if (datalink == DLT_LINUX_SLL) {
+      offset = 16;
+      if (header->caplen < offset) continue;
+      protocol = (data[14] << 8) | data[15];
+    } else if (datalink != DLT_RAW) {
+      std::cout << "Unsupported pcap link type " << datalink << std::endl;
+      pcapDone = true;
+      return -1;
+    }
+    if (protocol != 0x0800 || header->caplen < offset + 20) continue;
+
+    const u_char *ip = data + offset;
+    const uint32_t ipHeaderSize = (ip[0] & 0x0f) * 4;
+    const bool fragment = ((ip[6] & 0x3f) | ip[7]) != 0;
+    if ((ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP || fragment ||
+        header->caplen < offset + ipHeaderSize + 8) {
+      continue;
+    }
+
+    const u_char *udp = ip + ipHeaderSize;
+    const uint16_t dstPort = (udp[2] << 8) | udp[3];
+    if (dstPort != pcapLidarPort && dstPort != pcapGpsPort) continue;
+
+    uint32_t size = ((udp[4] << 8) | udp[5]) - 8;
+    const uint32_t captured = header->caplen - offset - ipHeaderSize - 8;
+    if (size > captured) size = captured;
+    if (size > ETHERNET_MTU) continue;
+
+    // pace the replay by the capture time stamps
+    const double captureTime =
+        header->ts.tv_sec + header->ts.tv_usec / 1000000.0;
+    if (replayStart == 0) {
+      replayStart = monotonicTime();
+      captureStart = captureTime;
+    } else if (replayRate > 0) {
+      const double wait = replayStart +
+                          (captureTime - captureStart) / replayRate -
+                          monotonicTime();
+      if (wait > 0) {
+        usleep(static_cast<useconds_t>(wait * 1000000));
+      }
+    }
+
+    memcpy(pkt->data, udp + 8, size);
+    pkt->size = size;
+    pkt->stamp = wallTime();
+    return 0;
+  }
+}
+
 }  // namespace hesai
 }  // namespace drivers
 }  // namespace apollo
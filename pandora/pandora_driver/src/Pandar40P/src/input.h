@@ -21,6 +21,7 @@
 #include <pcap.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <atomic>
 #include <string>
 
 namespace apollo {
@@ -30,7 +31,7 @@ namespace hesai {
 #define ETHERNET_MTU (1500)
 
 typedef struct PandarPacket_s {
-  double stamp;
+  double stamp;  // wall clock time the packet was received or replayed
   uint8_t data[ETHERNET_MTU];
   uint32_t size;
 } PandarPacket;
@@ -38,15 +39,33 @@ typedef struct PandarPacket_s {
 class Input {
  public:
   Input(uint16_t port, uint16_t gpsPort);
+  /**
+   * @brief replay the lidar and gps packets of a pcap capture
+   * @param rate 1 replays in real time, N N times faster and 0 as fast as
+   *             the packets are taken
+   */
+  Input(const std::string &pcapFile, uint16_t port, uint16_t gpsPort,
+        double rate);
   ~Input();
-  Input(std::string filePath, int type);  // not implemented
   int getPacket(PandarPacket *pkt);
-  int getPacketFromPcap(PandarPacket *pkt);  // not implemented
+  // true once a replay reached the end of its capture
+  bool replayDone() const;
 
  private:
+  int getPacketFromPcap(PandarPacket *pkt);
+
   int socketForLidar;
   int socketForGPS;
   int socketNumber;
+
+  pcap_t *pcapHandle;
+  int datalink;
+  uint16_t pcapLidarPort;
+  uint16_t pcapGpsPort;
+  double replayRate;
+  double replayStart;   // monotonic time the first packet was replayed
+  double captureStart;  // capture time of the first packet
+  std::atomic<bool> pcapDone;
 };
 
 }  // namespace hesai
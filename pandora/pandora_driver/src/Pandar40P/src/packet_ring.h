@@ -0,0 +1,124 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef SRC_PACKET_RING_H_
+#define SRC_PACKET_RING_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+namespace apollo {
+namespace drivers {
+namespace hesai {
+
+/**
+ * @brief Preallocated single-producer/single-consumer ring of packet slots.
+ *
+ * The receive thread fills the slot returned by WriteSlot() in place and
+ * makes it visible with Push(); the decode thread reads the slot returned by
+ * ReadSlot() in place and hands it back with Pop(). No locks, no copies and
+ * no allocation after construction. Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class PacketRing {
+ public:
+  explicit PacketRing(uint32_t capacity)
+      : head_(0), tail_(0), high_water_mark_(0) {
+    uint32_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_.resize(size);
+  }
+
+  uint32_t Capacity() const { return static_cast<uint32_t>(slots_.size()); }
+
+  /**
+   * @brief producer: the slot to fill next, NULL if the ring is full
+   */
+  T *WriteSlot() {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= slots_.size()) {
+      return NULL;
+    }
+    return &slots_[head & mask_];
+  }
+
+  /**
+   * @brief producer: publish the slot returned by WriteSlot()
+   */
+  void Push() {
+    const uint64_t head = head_.load(std::memory_order_relaxed) + 1;
+    head_.store(head, std::memory_order_release);
+
+    const uint32_t depth =
+        static_cast<uint32_t>(head - tail_.load(std::memory_order_relaxed));
+    if (depth > high_water_mark_.load(std::memory_order_relaxed)) {
+      high_water_mark_.store(depth, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief consumer: the oldest filled slot, NULL if the ring is empty
+   */
+  T *ReadSlot() {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &slots_[tail & mask_];
+  }
+
+  /**
+   * @brief consumer: release the slot returned by ReadSlot()
+   */
+  void Pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  uint32_t Size() const {
+    return static_cast<uint32_t>(head_.load(std::memory_order_acquire) -
+                                 tail_.load(std::memory_order_acquire));
+  }
+
+  /**
+   * @brief the largest number of queued packets seen so far
+   */
+  uint32_t HighWaterMark() const {
+    return high_water_mark_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::vector<T> slots_;
+  uint32_t mask_;
+  // keep the producer and the consumer index on separate cache lines
+  char pad0_[64];
+  std::atomic<uint64_t> head_;
+  char pad1_[64];
+  std::atomic<uint64_t> tail_;
+  char pad2_[64];
+  std::atomic<uint32_t> high_water_mark_;
+};
+
+}  // namespace hesai
+}  // namespace drivers
+}  // namespace apollo
+
+#endif  // SRC_PACKET_RING_H_
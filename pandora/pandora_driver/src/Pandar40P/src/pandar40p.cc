@@ -40,6 +40,28 @@ Pandar40P::Pandar40P(
                              gps_callback, start_angle, tz, frame_id);
 }
 
+/**
+ * @brief Constructor replaying a pcap capture instead of the device
+ * @param pcap_file         The capture of the lidar and gps packets
+ *        replay_rate       1 for real time, N for N times faster, 0 for as
+ *                          fast as the packets are decoded
+ *        lidar_port        The port number of lidar data in the capture
+ *        gps_port          The port number of gps data in the capture
+ *        pcl_callback      The callback of PCL data structure
+ *        gps_callback      The callback of GPS structure
+ *        start_angle       The start angle of every point cloud
+ */
+Pandar40P::Pandar40P(
+    const std::string &pcap_file, double replay_rate, uint16_t lidar_port,
+    uint16_t gps_port,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)> pcl_callback,
+    boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
+    std::string frame_id) {
+  internal_ = new Pandar40P_Internal(pcap_file, replay_rate, lidar_port,
+                                     gps_port, pcl_callback, gps_callback,
+                                     start_angle, tz, frame_id);
+}
+
 /**
  * @brief destructor
  */
@@ -61,6 +83,79 @@ void Pandar40P::ResetStartAngle(uint16_t start_angle) {
   internal_->ResetStartAngle(start_angle);
 }
 
+/**
+ * @brief Configure the lidar packet queue, applied by the next Start().
+ * @param capacity Number of preallocated packet slots
+ *        policy   What to do with packets while the queue is full
+ */
+void Pandar40P::SetPacketQueue(uint32_t capacity, PacketQueuePolicy policy) {
+  internal_->SetPacketQueue(capacity, policy);
+}
+
+/**
+ * @brief Select the returns kept in dual return mode. Call it before Start().
+ * @param policy The returns that become points
+ */
+void Pandar40P::SetDualReturnPolicy(DualReturnPolicy policy) {
+  internal_->SetDualReturnPolicy(policy);
+}
+
+/**
+ * @brief Also deliver a motion compensated copy of every frame. Call it
+ *        before Start().
+ * @param enable               Compensate the frames
+ *        compensated_callback The callback of the compensated clouds
+ */
+void Pandar40P::EnableCompensation(
+    bool enable,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        compensated_callback) {
+  internal_->EnableCompensation(enable, compensated_callback);
+}
+
+/**
+ * @brief Also deliver a downsampled copy of every frame. Call it before
+ *        Start().
+ * @param mode             How the points are picked
+ *        leaf_size        Voxel edge in meters
+ *        ring_stride      Keep every ring_stride-th laser
+ *        azimuth_stride   and of it every azimuth_stride-th point
+ *        reduced_callback The callback of the reduced clouds
+ */
+void Pandar40P::SetReduction(
+    ReductionMode mode, double leaf_size, int ring_stride, int azimuth_stride,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        reduced_callback) {
+  internal_->SetReduction(mode, leaf_size, ring_stride, azimuth_stride,
+                          reduced_callback);
+}
+
+/**
+ * @brief Add a pose for the motion compensation, in time order.
+ * @param pose The pose of the lidar in the world frame
+ */
+void Pandar40P::AddPose(const Pose &pose) { internal_->AddPose(pose); }
+
+/**
+ * @brief Get the lidar packet queue statistics.
+ */
+PacketQueueStats Pandar40P::GetPacketQueueStats() const {
+  return internal_->GetPacketQueueStats();
+}
+
+/**
+ * @brief Get the point cloud frame statistics.
+ */
+FrameStats Pandar40P::GetFrameStats() const {
+  return internal_->GetFrameStats();
+}
+
+/**
+ * @brief Whether a pcap replay reached the end of the capture and every
+ *        packet of it was decoded.
+ */
+bool Pandar40P::ReplayDone() const { return internal_->ReplayDone(); }
+
 /**
  * @brief Run SDK.
  */
@@ -14,7 +14,11 @@
  * limitations under the License.
  *****************************************************************************/
 
+#include <sys/time.h>
+
 #include <algorithm>
+#include <cmath>
+#include <ctime>
 #include <sstream>
 
 #include "src/input.h"
@@ -50,10 +54,42 @@ Pandar40P_Internal::Pandar40P_Internal(
     const std::string &device_ip, uint16_t lidar_port, uint16_t gps_port,
     boost::function<void(boost::shared_ptr<PPointCloud>, double)> pcl_callback,
     boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
-    std::string frame_id) {
-  pthread_mutex_init(&lidar_lock_, NULL);
-  sem_init(&lidar_sem_, 0, 0);
+    std::string frame_id)
+    : Pandar40P_Internal(
+          boost::shared_ptr<Input>(new Input(lidar_port, gps_port)),
+          pcl_callback, gps_callback, start_angle, tz, frame_id) {}
+
+Pandar40P_Internal::Pandar40P_Internal(
+    const std::string &pcap_file, double replay_rate, uint16_t lidar_port,
+    uint16_t gps_port,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)> pcl_callback,
+    boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
+    std::string frame_id)
+    : Pandar40P_Internal(boost::shared_ptr<Input>(new Input(
+                             pcap_file, lidar_port, gps_port, replay_rate)),
+                         pcl_callback, gps_callback, start_angle, tz,
+                         frame_id) {}
 
+Pandar40P_Internal::Pandar40P_Internal(
+    boost::shared_ptr<Input> input,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)> pcl_callback,
+    boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
+    std::string frame_id)
+    : input_(input),
+      packet_queue_capacity_(DEFAULT_PACKET_QUEUE_CAPACITY),
+      packet_queue_policy_(PACKET_QUEUE_DROP_NEWEST),
+      dual_return_policy_(DUAL_RETURN_BOTH),
+      packets_received_(0),
+      packets_dropped_(0),
+      day_key_(-1),
+      day_second_(0),
+      cloud_size_(0),
+      compensation_(false),
+      pose_buffer_(POSE_BUFFER_SIZE, MAX_POSE_EXTRAPOLATION),
+      frame_reference_valid_(false),
+      frame_compensated_(false),
+      frame_reference_time_(0),
+      frame_stats_() {
   lidar_recv_thr_ = NULL;
   lidar_process_thr_ = NULL;
 
@@ -68,8 +104,6 @@ Pandar40P_Internal::Pandar40P_Internal(
     sin_lookup_table_[rotIndex] = sinf(rotation);
   }
 
-  input_.reset(new Input(lidar_port, gps_port));
-
   pcl_callback_ = pcl_callback;
   gps_callback_ = gps_callback;
 
@@ -133,6 +167,7 @@ Pandar40P_Internal::Pandar40P_Internal(
     horizatal_azimuth_offset_map_[i] =
         pandar40p_horizatal_azimuth_offset_map[i];
   }
+  UpdateLaserTables();
 
   frame_id_ = frame_id;
   tz_second_ = tz * 3600;
@@ -140,8 +175,6 @@ Pandar40P_Internal::Pandar40P_Internal(
 
 Pandar40P_Internal::~Pandar40P_Internal() {
   Stop();
-  sem_destroy(&lidar_sem_);
-  pthread_mutex_destroy(&lidar_lock_);
 }
 
 /**
@@ -188,26 +221,137 @@ int Pandar40P_Internal::LoadCorrectionFile(const std::string &correction_content
     elev_angle_map_[i] = elev_angle[i];
     horizatal_azimuth_offset_map_[i] = azimuthOffset[i];
   }
+  UpdateLaserTables();
 
   return 0;
 }
 
+/**
+ * @brief precompute the per laser trigonometry used by CalcPointXYZIT
+ */
+void Pandar40P_Internal::UpdateLaserTables() {
+  for (int i = 0; i < LASER_COUNT; ++i) {
+    elev_sin_[i] = LASER_RETURN_TO_DISTANCE_RATE *
+                   sin(degreeToRadian(elev_angle_map_[i]));
+    elev_cos_[i] = LASER_RETURN_TO_DISTANCE_RATE *
+                   cos(degreeToRadian(elev_angle_map_[i]));
+    azimuth_offset_sin_[i] =
+        sin(degreeToRadian(horizatal_azimuth_offset_map_[i]));
+    azimuth_offset_cos_[i] =
+        cos(degreeToRadian(horizatal_azimuth_offset_map_[i]));
+  }
+}
+
 /**
  * @brief reset the start angle
  * @param angle The start angle
  */
 void Pandar40P_Internal::ResetStartAngle(uint16_t start_angle) {
-  start_angle_ = start_angle;
+  start_angle_ = start_angle > 36000 ? 0 : start_angle;
+}
+
+void Pandar40P_Internal::SetPacketQueue(uint32_t capacity,
+                                        PacketQueuePolicy policy) {
+  packet_queue_capacity_ = capacity > 0 ? capacity : 1;
+  packet_queue_policy_ = policy;
+}
+
+void Pandar40P_Internal::SetDualReturnPolicy(DualReturnPolicy policy) {
+  dual_return_policy_ = policy;
+}
+
+void Pandar40P_Internal::EnableCompensation(
+    bool enable,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        compensated_callback) {
+  compensation_ = enable;
+  compensated_callback_ = compensated_callback;
+}
+
+void Pandar40P_Internal::SetReduction(
+    ReductionMode mode, double leaf_size, int ring_stride, int azimuth_stride,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        reduced_callback) {
+  downsampler_.configure(mode, leaf_size, ring_stride, azimuth_stride);
+  reduced_callback_ = reduced_callback;
+}
+
+void Pandar40P_Internal::AddPose(const Pose &pose) { pose_buffer_.Add(pose); }
+
+PacketQueueStats Pandar40P_Internal::GetPacketQueueStats() const {
+  boost::mutex::scoped_lock lock(lidar_packets_lock_);
+  PacketQueueStats stats;
+  stats.received = packets_received_.load(std::memory_order_relaxed);
+  stats.dropped = packets_dropped_.load(std::memory_order_relaxed);
+  stats.depth = lidar_packets_ ? lidar_packets_->Size() : 0;
+  stats.high_water_mark = lidar_packets_ ? lidar_packets_->HighWaterMark() : 0;
+  stats.capacity =
+      lidar_packets_ ? lidar_packets_->Capacity() : packet_queue_capacity_;
+  return stats;
+}
+
+FrameStats Pandar40P_Internal::GetFrameStats() const {
+  boost::mutex::scoped_lock lock(frame_stats_lock_);
+  return frame_stats_;
+}
+
+bool Pandar40P_Internal::ReplayDone() const {
+  boost::mutex::scoped_lock lock(lidar_packets_lock_);
+  return input_->replayDone() &&
+         (!lidar_packets_ || lidar_packets_->Size() == 0);
 }
 
 int Pandar40P_Internal::Start() {
   Stop();
+  // both threads are stopped, only the stats readers need the lock
+  {
+    boost::mutex::scoped_lock lock(lidar_packets_lock_);
+    lidar_packets_.reset(
+        new PacketRing<PandarPacket>(packet_queue_capacity_));
+    packets_received_ = 0;
+    packets_dropped_ = 0;
+  }
+
+  cloud_pool_.clear();
+  for (int i = 0; i < CLOUD_POOL_SIZE; ++i) {
+    boost::shared_ptr<PPointCloud> cld(new PPointCloud());
+    cld->points.reserve(MAX_POINTS_PER_CLOUD);
+    cloud_pool_.push_back(cld);
+  }
+  compensated_pool_.clear();
+  compensated_cld_.reset();
+  if (compensation_ && compensated_callback_) {
+    for (int i = 0; i < CLOUD_POOL_SIZE; ++i) {
+      boost::shared_ptr<PPointCloud> cld(new PPointCloud());
+      cld->points.reserve(MAX_POINTS_PER_CLOUD);
+      compensated_pool_.push_back(cld);
+    }
+  }
+  reduced_pool_.clear();
+  reduced_cld_.reset();
+  if (downsampler_.enabled() && reduced_callback_) {
+    for (int i = 0; i < CLOUD_POOL_SIZE; ++i) {
+      reduced_pool_.push_back(
+          boost::shared_ptr<PPointCloud>(new PPointCloud()));
+    }
+  }
+  frame_blocks_ = 0;
+  frame_step_sum_ = frame_step_count_ = 0;
+  frame_gap_sum_ = frame_gap_count_ = 0;
+  frame_min_step_ = azimuth_step_ = 0;
+  blocks_per_azimuth_ = 1;
+  {
+    boost::mutex::scoped_lock lock(frame_stats_lock_);
+    frame_stats_ = FrameStats();
+  }
+
   enable_lidar_recv_thr_ = true;
   enable_lidar_process_thr_ = true;
   lidar_process_thr_ = new boost::thread(
       boost::bind(&Pandar40P_Internal::ProcessLiarPacket, this));
   lidar_recv_thr_ =
       new boost::thread(boost::bind(&Pandar40P_Internal::RecvTask, this));
+  return 0;
 }
 
 void Pandar40P_Internal::Stop() {
@@ -230,95 +374,279 @@ void Pandar40P_Internal::Stop() {
 
 void Pandar40P_Internal::RecvTask() {
   int ret = 0;
+  // receives the packets that do not fit into the queue
+  PandarPacket overflow;
   while (enable_lidar_recv_thr_) {
-    PandarPacket pkt;
-    int rc = input_->getPacket(&pkt);
+    PandarPacket *pkt = lidar_packets_->WriteSlot();
+    if (!pkt) {
+      if (packet_queue_policy_ == PACKET_QUEUE_BLOCK) {
+        usleep(100);
+        continue;
+      }
+      pkt = &overflow;
+    }
+
+    int rc = input_->getPacket(pkt);
     if (rc == -1) {
       continue;
     }
 
-    if (pkt.size == GPS_PACKET_SIZE) {
+    if (pkt->size == GPS_PACKET_SIZE) {
       PandarGPS gpsMsg;
-      ret = ParseGPS(&gpsMsg, pkt.data, pkt.size);
+      ret = ParseGPS(&gpsMsg, pkt->data, pkt->size);
       if (ret == 0) {
         ProcessGps(gpsMsg);
       }
       continue;
     }
 
-    PushLiDARData(pkt);
+    if (pkt->size != PACKET_SIZE) {
+      continue;
+    }
+
+    if (pkt == &overflow) {
+      packets_dropped_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    lidar_packets_->Push();
+    packets_received_.fetch_add(1, std::memory_order_relaxed);
   }
 }
 
 void Pandar40P_Internal::ProcessLiarPacket() {
-  struct timespec ts;
   int ret = 0;
-  static int packetIndex = 0;
-
-  boost::shared_ptr<PPointCloud> outMsg(new PPointCloud());
+  // no cloud until the first start angle crossing, the partial revolution
+  // before it is dropped
+  boost::shared_ptr<PPointCloud> outMsg;
+  int last_azimuth = -1;
+  timestamp_ = 0;
 
   while (enable_lidar_process_thr_) {
-    if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-      std::cout << "get time error" << std::endl;
+    PandarPacket *packet = lidar_packets_->ReadSlot();
+    if (!packet) {
+      // a packet arrives every ~550us, poll at a fraction of that
+      usleep(100);
+      continue;
     }
 
-    ts.tv_sec += 1;
-    if (sem_timedwait(&lidar_sem_, &ts) == -1) {
+    Pandar40PPacketInfo info;
+    ret = ParseRawData(&info, packet->data, packet->size);
+    if (ret != 0) {
+      lidar_packets_->Pop();
       continue;
     }
 
-    pthread_mutex_lock(&lidar_lock_);
-    PandarPacket packet = lidar_packets_.front();
-    lidar_packets_.pop_front();
-    pthread_mutex_unlock(&lidar_lock_);
+    const double packet_time =
+        PacketSecond(info.t) + static_cast<double>(info.usec) / 1000000.0;
+    blocks_per_azimuth_ = info.echo == 0x39 ? 2 : 1;
+    const int start_angle = start_angle_.load(std::memory_order_relaxed);
 
-    if (packet.size == PACKET_SIZE) {
-      Pandar40PPacket pkt;
-      ret = ParseRawData(&pkt, packet.data, packet.size);
-      if (ret != 0) {
+    for (int i = 0; i < BLOCKS_PER_PACKET; ++i) {
+      const uint8_t *block = packet->data + i * BLOCK_SIZE;
+      const int azimuth = block[2] | (block[3] << 8);
+      if (azimuth >= 36000) {
         continue;
       }
 
-      packetIndex++;
-
-      for (int i = 0; i < BLOCKS_PER_PACKET; ++i) {
-        /* ready a round ? */
-        uint16_t current_azimuth = pkt.blocks[i].azimuth;
-        int limit_degree = RATE_PER_PACKET * 100/2;
-        int gap = std::min(std::abs(current_azimuth - start_angle_),
-                36000 - std::abs(current_azimuth - start_angle_));
-
-        // at lease 150 packets, no more than 182
-        if ((packetIndex > PACKETS_PER_ROUND * 5/6 && gap <= limit_degree) ||
-                packetIndex > PACKETS_PER_ROUND + 1) {
-          // ok
-          if (pcl_callback_ && outMsg->points.size() > 0) {
-            // std::cout << std::fixed << std::setprecision(18)
-            //    << "Size: " << packetIndex << ", current: " << current_azimuth
-            //    << ", timestamp_: " << timestamp_ << std::endl;
-            pcl_callback_(outMsg, timestamp_);
-            outMsg.reset(new PPointCloud());
-            // reset
-            packetIndex = 0; timestamp_ = 0;
+      if (last_azimuth >= 0) {
+        const int step = (azimuth - last_azimuth + 36000) % 36000;
+        // a large step is the azimuth going backwards, not a rotation
+        if (step <= 18000) {
+          /* ready a round ? the block at start_angle opens the next one */
+          const int from_start = (last_azimuth - start_angle + 36000) % 36000;
+          if (from_start + step >= 36000) {
+            if (outMsg) {
+              PublishFrame(outMsg, packet->stamp);
+            }
+            outMsg = NewCloud();
           }
+          AddAzimuthStep(step);
         }
+      }
+      last_azimuth = azimuth;
 
-        CalcPointXYZIT(&pkt, i, outMsg);
+      if (outMsg) {
+        ++frame_blocks_;
+        CalcPointXYZIT(info, packet->data, i, packet_time, outMsg.get());
       }
-    } else {
-      continue;
     }
+    // the blocks were decoded in place, release the slot only now
+    lidar_packets_->Pop();
+  }
+}
 
-    outMsg->header.frame_id = frame_id_;
-    outMsg->height = 1;
+/**
+ * @brief account the azimuth step from the previous block to the current one
+ */
+void Pandar40P_Internal::AddAzimuthStep(int step) {
+  if (step <= 0) {
+    // both returns of a dual return block share the azimuth
+    return;
+  }
+  if (azimuth_step_ > 0 && 2 * step > 3 * azimuth_step_) {
+    frame_gap_sum_ += step;
+    ++frame_gap_count_;
+  } else {
+    frame_step_sum_ += step;
+    ++frame_step_count_;
+  }
+  if (frame_min_step_ == 0 || step < frame_min_step_) {
+    frame_min_step_ = step;
   }
 }
 
-void Pandar40P_Internal::PushLiDARData(PandarPacket packet) {
-  pthread_mutex_lock(&lidar_lock_);
-  lidar_packets_.push_back(packet);
-  sem_post(&lidar_sem_);
-  pthread_mutex_unlock(&lidar_lock_);
+/**
+ * @brief hand a finished revolution to the callback and update the stats,
+ *        recv_stamp is when the packet that closed it was received
+ */
+void Pandar40P_Internal::PublishFrame(
+    const boost::shared_ptr<PPointCloud> &cld, double recv_stamp) {
+  uint32_t missing_blocks = 0;
+  if (frame_gap_count_ > 0 && frame_step_count_ > 0) {
+    // the azimuth positions in the gaps, less the blocks ending them
+    const double step =
+        static_cast<double>(frame_step_sum_) / frame_step_count_;
+    const long missing = lround(frame_gap_sum_ / step) - frame_gap_count_;
+    if (missing > 0) {
+      missing_blocks = static_cast<uint32_t>(missing) * blocks_per_azimuth_;
+    }
+  }
+
+  // the compensated copy of a frame the poses did not cover is incomplete
+  const bool compensated = compensated_cld_ && frame_compensated_;
+
+  {
+    boost::mutex::scoped_lock lock(frame_stats_lock_);
+    ++frame_stats_.frames;
+    if (compensated_cld_ && !compensated) {
+      ++frame_stats_.uncompensated_frames;
+    }
+    if (missing_blocks > 0) {
+      ++frame_stats_.incomplete_frames;
+    }
+    frame_stats_.blocks = frame_blocks_;
+    frame_stats_.missing_blocks = missing_blocks;
+    frame_stats_.points = cloud_size_;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    frame_stats_.latency = now.tv_sec + now.tv_usec / 1000000.0 - recv_stamp;
+  }
+
+  cld->points.resize(cloud_size_);
+  cld->width = cloud_size_;
+  if (pcl_callback_ && cloud_size_ > 0) {
+    pcl_callback_(cld, timestamp_);
+  }
+  if (compensated_cld_) {
+    // a compensated cloud is stamped with the time of its lidar frame
+    compensated_cld_->points.resize(cloud_size_);
+    compensated_cld_->width = cloud_size_;
+    if (cloud_size_ > 0 && compensated) {
+      compensated_callback_(compensated_cld_, frame_reference_time_);
+    }
+    compensated_cld_.reset();
+  }
+  if (reduced_cld_) {
+    reduced_cld_->width = reduced_cld_->points.size();
+    if (reduced_cld_->width > 0) {
+      reduced_callback_(reduced_cld_, timestamp_);
+    }
+    reduced_cld_.reset();
+  }
+  timestamp_ = 0;
+}
+
+/**
+ * @brief a released cloud from the pool with room for a whole frame, filled
+ *        up to cloud_size_, and fresh per frame bookkeeping. A recycled cloud
+ *        keeps the points of its last frame, they are overwritten in place
+ *        and only grown past that size, so no frame zero fills the cloud
+ */
+boost::shared_ptr<PPointCloud> Pandar40P_Internal::NewCloud() {
+  boost::shared_ptr<PPointCloud> cld = PooledCloud(cloud_pool_);
+  cloud_size_ = 0;
+  if (!compensated_pool_.empty()) {
+    compensated_cld_ = PooledCloud(compensated_pool_);
+  }
+  if (!reduced_pool_.empty()) {
+    reduced_cld_ = NewReducedCloud();
+    downsampler_.reset();
+  }
+
+  if (frame_min_step_ > 0) {
+    azimuth_step_ = frame_min_step_;
+  }
+  frame_blocks_ = 0;
+  frame_step_sum_ = frame_step_count_ = 0;
+  frame_gap_sum_ = frame_gap_count_ = 0;
+  frame_min_step_ = 0;
+  // the first block with a pose becomes the reference of the frame
+  frame_reference_valid_ = false;
+  frame_compensated_ = true;
+  return cld;
+}
+
+/**
+ * @brief a released cloud from pool, or a new one while the callbacks hold
+ *        every pooled cloud
+ */
+boost::shared_ptr<PPointCloud> Pandar40P_Internal::PooledCloud(
+    const std::vector<boost::shared_ptr<PPointCloud> > &pool) {
+  boost::shared_ptr<PPointCloud> cld;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    if (pool[i].unique()) {
+      cld = pool[i];
+      break;
+    }
+  }
+  if (!cld) {
+    cld.reset(new PPointCloud());
+    cld->points.reserve(MAX_POINTS_PER_CLOUD);
+  }
+  cld->header.frame_id = frame_id_;
+  cld->height = 1;
+  return cld;
+}
+
+/**
+ * @brief an empty released cloud from the reduced pool, its points keep the
+ *        capacity of earlier frames
+ */
+boost::shared_ptr<PPointCloud> Pandar40P_Internal::NewReducedCloud() {
+  boost::shared_ptr<PPointCloud> cld;
+  for (size_t i = 0; i < reduced_pool_.size(); ++i) {
+    if (reduced_pool_[i].unique()) {
+      cld = reduced_pool_[i];
+      break;
+    }
+  }
+  if (!cld) {
+    // the callback still holds every pooled cloud
+    cld.reset(new PPointCloud());
+  }
+  cld->points.clear();
+  cld->header.frame_id = frame_id_;
+  cld->height = 1;
+  cld->width = 0;
+  return cld;
+}
+
+/**
+ * @brief same as mktime(&t), with mktime called once per day
+ */
+double Pandar40P_Internal::PacketSecond(const struct tm &t) {
+  const int day_key = (t.tm_year * 16 + t.tm_mon + 1) * 32 + t.tm_mday;
+  if (day_key != day_key_) {
+    struct tm midnight = t;
+    midnight.tm_hour = 0;
+    midnight.tm_min = 0;
+    midnight.tm_sec = 0;
+    midnight.tm_isdst = 0;
+    day_second_ = static_cast<double>(mktime(&midnight));
+    day_key_ = day_key;
+  }
+  return day_second_ + t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec;
 }
 
 void Pandar40P_Internal::ProcessGps(const PandarGPS &gpsMsg) {
@@ -341,7 +669,10 @@ void Pandar40P_Internal::ProcessGps(const PandarGPS &gpsMsg) {
   }
 }
 
-int Pandar40P_Internal::ParseRawData(Pandar40PPacket *packet,
+/**
+ * @brief parse the packet tail, the blocks are decoded by CalcPointXYZIT
+ */
+int Pandar40P_Internal::ParseRawData(Pandar40PPacketInfo *info,
                                      const uint8_t *buf, const int len) {
   if (len != PACKET_SIZE) {
     std::cout << "packet size mismatch Pandar40P_Internal " << len << ","
@@ -349,44 +680,19 @@ int Pandar40P_Internal::ParseRawData(Pandar40PPacket *packet,
     return -1;
   }
 
-  int index = 0;
-  // 10 BLOCKs
-  for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
-    Pandar40PBlock &block = packet->blocks[i];
-
-    block.sob = (buf[index] & 0xff) | ((buf[index + 1] & 0xff) << 8);
-    block.azimuth = (buf[index + 2] & 0xff) | ((buf[index + 3] & 0xff) << 8);
-    index += SOB_ANGLE_SIZE;
-    // 40x units
-    for (int j = 0; j < LASER_COUNT; j++) {
-      Pandar40PUnit &unit = block.units[j];
-      uint32_t range = (buf[index] & 0xff) | ((buf[index + 1] & 0xff) << 8);
-
-      // distance is M.
-      unit.distance =
-          (static_cast<double>(range)) * LASER_RETURN_TO_DISTANCE_RATE;
-      unit.intensity = (buf[index + 2] & 0xff);
-
-      // TODO(Philip.Pi): Filtering wrong data for LiDAR.
-      if ((unit.distance == 0x010101 && unit.intensity == 0x0101) ||
-          unit.distance > (200 * 1000 / 2 /* 200m -> 2mm */)) {
-        unit.distance = 0;
-        unit.intensity = 0;
-      }
-      index += RAW_MEASURE_SIZE;
-    }
-  }
+  // skip 10 BLOCKs
+  int index = BLOCK_SIZE * BLOCKS_PER_PACKET;
   index += RESERVE_SIZE;  // skip reserved bytes
 
   index += REVOLUTION_SIZE;
 
-  packet->usec = (buf[index] & 0xff) | (buf[index + 1] & 0xff) << 8 |
-                 ((buf[index + 2] & 0xff) << 16) |
-                 ((buf[index + 3] & 0xff) << 24);
-  packet->usec %= 1000000;
+  info->usec = (buf[index] & 0xff) | (buf[index + 1] & 0xff) << 8 |
+               ((buf[index + 2] & 0xff) << 16) |
+               ((buf[index + 3] & 0xff) << 24);
+  info->usec %= 1000000;
 
   index += TIMESTAMP_SIZE;
-  packet->echo = buf[index] & 0xff;
+  info->echo = buf[index] & 0xff;
 
   index += FACTORY_INFO_SIZE + ECHO_SIZE;
 
@@ -394,14 +700,14 @@ int Pandar40P_Internal::ParseRawData(Pandar40PPacket *packet,
 
   // UTC's year only include 0 - 99 year , which indicate 2000 to 2099.
   // and mktime's year start from 1900 which is 0, so we need to add 100 years.
-  packet->t.tm_year = (buf[index + 0] & 0xff) + 100;
+  info->t.tm_year = (buf[index + 0] & 0xff) + 100;
   // UTC's month start from 1, but mktime only accept month from 0.
-  packet->t.tm_mon = (buf[index + 1] & 0xff) - 1;
-  packet->t.tm_mday = buf[index + 2] & 0xff;
-  packet->t.tm_hour = buf[index + 3] & 0xff;
-  packet->t.tm_min = buf[index + 4] & 0xff;
-  packet->t.tm_sec = buf[index + 5] & 0xff;
-  packet->t.tm_isdst = 0;
+  info->t.tm_mon = (buf[index + 1] & 0xff) - 1;
+  info->t.tm_mday = buf[index + 2] & 0xff;
+  info->t.tm_hour = buf[index + 3] & 0xff;
+  info->t.tm_min = buf[index + 4] & 0xff;
+  info->t.tm_sec = buf[index + 5] & 0xff;
+  info->t.tm_isdst = 0;
 
   return 0;
 }
@@ -453,69 +759,164 @@ int Pandar40P_Internal::ParseGPS(PandarGPS *packet, const uint8_t *recvbuf,
   return 0;
 }
 
-void Pandar40P_Internal::CalcPointXYZIT(Pandar40PPacket *pkt, int blockid,
-                                        boost::shared_ptr<PPointCloud> cld) {
-  Pandar40PBlock *block = &pkt->blocks[blockid];
+void Pandar40P_Internal::CalcPointXYZIT(const Pandar40PPacketInfo &info,
+                                        const uint8_t *buf, int blockid,
+                                        double packet_time,
+                                        PPointCloud *cld) {
+  const bool dual_return = info.echo == 0x39;
+  // the returns of a dual return block pair are selected together, when the
+  // first block of the pair is decoded
+  const bool select_return =
+      dual_return && dual_return_policy_ != DUAL_RETURN_BOTH;
+  if (select_return && (blockid & 1)) {
+    return;
+  }
 
-  double unix_second =
-      static_cast<double>(mktime(&pkt->t) + 1 + tz_second_);  // 1 second offset
+  // sob (2 bytes), azimuth (2 bytes), then 40x distance (2) + intensity (1)
+  const uint8_t *block = buf + blockid * BLOCK_SIZE;
+  const int block_azimuth = block[2] | (block[3] << 8);
+  if (block_azimuth >= 36000) {
+    return;
+  }
+  const uint8_t *unit = block + SOB_ANGLE_SIZE;
+  const uint8_t *pair_unit = select_return ? unit + BLOCK_SIZE : NULL;
 
-  for (int i = 0; i < LASER_COUNT; ++i) {
-    /* for all the units in a block */
-    Pandar40PUnit &unit = block->units[i];
-    PPoint point;
+  if (cloud_size_ + 2 * LASER_COUNT > cld->points.size()) {
+    cld->points.resize(cld->points.size() + BLOCKS_PER_PACKET * LASER_COUNT);
+  }
+  if (compensated_cld_ &&
+      compensated_cld_->points.size() < cld->points.size()) {
+    compensated_cld_->points.resize(cld->points.size());
+  }
+
+  // 1 second offset
+  const double unix_second = packet_time + 1 + tz_second_;
+  // dual return, block 0&1 (2&3 , 4*5 ...)'s timestamp is the same.
+  const double block_time =
+      unix_second -
+      static_cast<double>(blockOffset_[dual_return ? blockid / 2 : blockid]) /
+          1000000.0;
+  if (compensated_cld_) {
+    UpdateBlockTransform(block_time);
+  }
 
+  for (int i = 0; i < LASER_COUNT; ++i, unit += RAW_MEASURE_SIZE) {
+    /* for all the units in a block */
+    int range = unit[0] | (unit[1] << 8);
+    uint8_t intensity = unit[2];
     /* skip wrong points */
-    if (unit.distance <= 0.5 || unit.distance > 200.0) {
-      continue;
+    bool valid = range > MIN_VALID_RANGE && range <= MAX_VALID_RANGE;
+    const double point_time =
+        block_time -
+        static_cast<double>(laserOffset_[dual_return ? i / 2 : i]) /
+            1000000.0;
+
+    // the other return of the pair, added as a point of its own
+    const uint8_t *pair = NULL;
+    if (pair_unit) {
+      pair = pair_unit + i * RAW_MEASURE_SIZE;
+      const int pair_range = pair[0] | (pair[1] << 8);
+      const bool pair_valid =
+          pair_range > MIN_VALID_RANGE && pair_range <= MAX_VALID_RANGE;
+      bool take_pair = false;
+      bool add_pair = false;
+      switch (dual_return_policy_) {
+        case DUAL_RETURN_DEDUPED:
+          add_pair = pair_valid && (!valid || pair_range != range);
+          break;
+        case DUAL_RETURN_STRONGEST:
+          take_pair = pair_valid && (!valid || pair[2] > intensity);
+          break;
+        case DUAL_RETURN_LAST:
+          take_pair = pair_valid && (!valid || pair_range > range);
+          break;
+        default:
+          break;
+      }
+      if (take_pair) {
+        range = pair_range;
+        intensity = pair[2];
+        valid = true;
+      }
+      if (!add_pair) {
+        pair = NULL;
+      }
     }
 
-    double xyDistance =
-        unit.distance * cosf(degreeToRadian(elev_angle_map_[i]));
-    point.x = static_cast<float>(
-        xyDistance *
-        sinf(degreeToRadian(horizatal_azimuth_offset_map_[i] +
-                            (static_cast<double>(block->azimuth)) / 100.0)));
-    point.y = static_cast<float>(
-        xyDistance *
-        cosf(degreeToRadian(horizatal_azimuth_offset_map_[i] +
-                            (static_cast<double>(block->azimuth)) / 100.0)));
-    point.z = static_cast<float>(unit.distance *
-                                 sinf(degreeToRadian(elev_angle_map_[i])));
-
-    // point.x = static_cast<float>(xyDistance *
-    // sin_lookup_table_[xylookup_id]);
-    // point.y = static_cast<float>(xyDistance *
-    // cos_lookup_table_[xylookup_id]);
-    // point.z = static_cast<float>(unit.distance *
-    // sin_lookup_table_[zlookup_id]);
-
-    point.intensity = unit.intensity;
-
-    point.timestamp =
-        unix_second + (static_cast<double>(pkt->usec)) / 1000000.0;
-
-    if (pkt->echo == 0x39) {
-      // dual return, block 0&1 (2&3 , 4*5 ...)'s timestamp is the same.
-      point.timestamp =
-          point.timestamp - (static_cast<double>(blockOffset_[blockid / 2] +
-                                                 laserOffset_[i / 2]) /
-                             1000000.0f);
-    } else {
-      point.timestamp =
-          point.timestamp -
-          (static_cast<double>(blockOffset_[blockid] + laserOffset_[i]) /
-           1000000.0f);
+    if (valid) {
+      AddPoint(cld, range, intensity, i, block_azimuth, point_time);
     }
-
-    point.ring = i;
-    // get smallest timestamp
-    if ((timestamp_ > 0 && timestamp_ < point.timestamp)
-            || timestamp_ <= 0) {
-      timestamp_ = point.timestamp;
+    if (pair) {
+      AddPoint(cld, pair[0] | (pair[1] << 8), pair[2], i, block_azimuth,
+               point_time);
     }
+  }
+}
+
+/**
+ * @brief the transform of the points of a block into the lidar frame at the
+ *        start of the frame. Within a block the points are a few
+ *        microseconds apart, they share the pose at the block time.
+ */
+void Pandar40P_Internal::UpdateBlockTransform(double block_time) {
+  Eigen::Affine3d pose;
+  if (!frame_compensated_ || !pose_buffer_.Lookup(block_time, &pose)) {
+    frame_compensated_ = false;
+    return;
+  }
+  if (!frame_reference_valid_) {
+    frame_reference_inverse_ = pose.inverse(Eigen::Isometry);
+    frame_reference_time_ = block_time;
+    frame_reference_valid_ = true;
+  }
+  const Eigen::Affine3d block = frame_reference_inverse_ * pose;
+  block_rotation_ = block.linear().cast<float>();
+  block_translation_ = block.translation().cast<float>();
+}
+
+/**
+ * @brief project one return into the next point of the cloud
+ */
+inline void Pandar40P_Internal::AddPoint(PPointCloud *cld, int range,
+                                         uint8_t intensity, int laser,
+                                         int block_azimuth, double time) {
+  // sin and cos of block azimuth + laser offset
+  const float block_sin = sin_lookup_table_[block_azimuth];
+  const float block_cos = cos_lookup_table_[block_azimuth];
+  const float sin_azimuth = block_sin * azimuth_offset_cos_[laser] +
+                            block_cos * azimuth_offset_sin_[laser];
+  const float cos_azimuth = block_cos * azimuth_offset_cos_[laser] -
+                            block_sin * azimuth_offset_sin_[laser];
+
+  PPoint &point = cld->points[cloud_size_];
+  const float xyDistance = range * elev_cos_[laser];
+  point.x = xyDistance * sin_azimuth;
+  point.y = xyDistance * cos_azimuth;
+  point.z = range * elev_sin_[laser];
+  point.intensity = intensity;
+  point.timestamp = time;
+  point.ring = laser;
+  if (compensated_cld_ && frame_compensated_) {
+    PPoint &moved = compensated_cld_->points[cloud_size_];
+    const Eigen::Vector3f p =
+        block_rotation_ * Eigen::Vector3f(point.x, point.y, point.z) +
+        block_translation_;
+    moved.x = p.x();
+    moved.y = p.y();
+    moved.z = p.z();
+    moved.intensity = intensity;
+    moved.timestamp = time;
+    moved.ring = laser;
+  }
+  ++cloud_size_;
+  if (reduced_cld_ && downsampler_.keep(point.x, point.y, point.z, laser)) {
+    reduced_cld_->points.push_back(point);
+  }
 
-    cld->push_back(point);
+  // get smallest timestamp
+  if ((timestamp_ > 0 && timestamp_ < point.timestamp)
+          || timestamp_ <= 0) {
+    timestamp_ = point.timestamp;
   }
 }
 
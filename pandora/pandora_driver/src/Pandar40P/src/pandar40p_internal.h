@@ -18,16 +18,21 @@
 #define SRC_PANDAR40P_INTERNAL_H_
 
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <Eigen/Geometry>
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
-#include <pthread.h>
-#include <semaphore.h>
 
-#include <list>
+#include <atomic>
 #include <string>
+#include <vector>
 
+#include "pandar40p/pandar40p.h"
 #include "pandar40p/point_types.h"
 #include "src/input.h"
+#include "src/packet_ring.h"
+#include "src/pose_buffer.h"
 
 #define RATE_PER_PACKET (2)
 #define PACKETS_PER_ROUND (360 / RATE_PER_PACKET)
@@ -47,6 +52,9 @@
 #define UTC_TIME (6)
 #define PACKET_SIZE (BLOCK_SIZE * BLOCKS_PER_PACKET + INFO_SIZE + UTC_TIME)
 #define LASER_RETURN_TO_DISTANCE_RATE (0.004)
+// valid raw ranges, 0.5m to 200m in units of LASER_RETURN_TO_DISTANCE_RATE
+#define MIN_VALID_RANGE (125)
+#define MAX_VALID_RANGE (50000)
 
 #define GPS_PACKET_SIZE (512)
 #define GPS_PACKET_FLAG_SIZE (2)
@@ -60,27 +68,25 @@
 
 #define HesaiLidarSDK_DEFAULT_LIDAR_RECV_PORT 8080
 #define HesaiLidarSDK_DEFAULT_GPS_RECV_PORT 10110
+// about half a second of packets
+#define DEFAULT_PACKET_QUEUE_CAPACITY (1024)
+// one single return revolution, the clouds grow on demand for dual return
+#define MAX_POINTS_PER_CLOUD \
+  ((PACKETS_PER_ROUND + 1) * BLOCKS_PER_PACKET * LASER_COUNT)
+// clouds recycled once the callback released them
+#define CLOUD_POOL_SIZE (3)
+// two seconds of 100Hz poses
+#define POSE_BUFFER_SIZE (200)
+// seconds a pose may be extrapolated past the newest one
+#define MAX_POSE_EXTRAPOLATION (0.1)
 
-struct Pandar40PUnit_s {
-  uint8_t intensity;
-  double distance;
-};
-typedef struct Pandar40PUnit_s Pandar40PUnit;
-
-struct Pandar40PBlock_s {
-  uint16_t azimuth;
-  uint16_t sob;
-  Pandar40PUnit units[LASER_COUNT];
-};
-typedef struct Pandar40PBlock_s Pandar40PBlock;
-
-struct Pandar40PPacket_s {
-  Pandar40PBlock blocks[BLOCKS_PER_PACKET];
+// the packet tail, blocks are decoded straight from the raw packet
+struct Pandar40PPacketInfo_s {
   struct tm t;
   uint32_t usec;
   int echo;
 };
-typedef struct Pandar40PPacket_s Pandar40PPacket;
+typedef struct Pandar40PPacketInfo_s Pandar40PPacketInfo;
 
 struct PandarGPS_s {
   uint16_t flag;
@@ -102,6 +108,8 @@ namespace hesai {
 
 class Pandar40P_Internal {
  public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
   /**
    * @brief Constructor
    * @param device_ip  				The ip of the device
@@ -118,6 +126,20 @@ class Pandar40P_Internal {
       boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
       std::string frame_id);
 
+  /**
+   * @brief Constructor replaying a pcap capture instead of the device
+   * @param pcap_file   The capture of the lidar and gps packets
+   *        replay_rate 1 for real time, N for N times faster, 0 for as fast
+   *                    as the packets are decoded
+   */
+  Pandar40P_Internal(
+      const std::string &pcap_file, double replay_rate, uint16_t lidar_port,
+      uint16_t gps_port,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          pcl_callback,
+      boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
+      std::string frame_id);
+
   /**
    * @brief load the correction file
    * @param correction The path of correction file
@@ -132,31 +154,78 @@ class Pandar40P_Internal {
 
   ~Pandar40P_Internal();
 
+  /**
+   * @brief configure the lidar packet queue, applied by the next Start().
+   * @param capacity Number of preallocated packet slots
+   *        policy   What to do with packets while the queue is full
+   */
+  void SetPacketQueue(uint32_t capacity, PacketQueuePolicy policy);
+  void SetDualReturnPolicy(DualReturnPolicy policy);
+  void EnableCompensation(
+      bool enable,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          compensated_callback);
+  void SetReduction(ReductionMode mode, double leaf_size, int ring_stride,
+                    int azimuth_stride,
+                    boost::function<void(boost::shared_ptr<PPointCloud>,
+                                         double)>
+                        reduced_callback);
+  void AddPose(const Pose &pose);
+  PacketQueueStats GetPacketQueueStats() const;
+  FrameStats GetFrameStats() const;
+  bool ReplayDone() const;
+
   int Start();
   void Stop();
 
  private:
+  Pandar40P_Internal(
+      boost::shared_ptr<Input> input,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          pcl_callback,
+      boost::function<void(double)> gps_callback, uint16_t start_angle, int tz,
+      std::string frame_id);
+
   void RecvTask();
   void ProcessGps(const PandarGPS &gpsMsg);
   void ProcessLiarPacket();
-  void PushLiDARData(PandarPacket packet);
-  int ParseRawData(Pandar40PPacket *packet, const uint8_t *buf, const int len);
+  int ParseRawData(Pandar40PPacketInfo *info, const uint8_t *buf,
+                   const int len);
   int ParseGPS(PandarGPS *packet, const uint8_t *recvbuf, const int size);
-  void CalcPointXYZIT(Pandar40PPacket *pkt, int blockid,
-                      boost::shared_ptr<PPointCloud> cld);
+  void CalcPointXYZIT(const Pandar40PPacketInfo &info, const uint8_t *buf,
+                      int blockid, double packet_time, PPointCloud *cld);
+  void AddPoint(PPointCloud *cld, int range, uint8_t intensity, int laser,
+                int block_azimuth, double time);
+  void UpdateBlockTransform(double block_time);
+  void UpdateLaserTables();
+  double PacketSecond(const struct tm &t);
+  boost::shared_ptr<PPointCloud> NewCloud();
+  boost::shared_ptr<PPointCloud> PooledCloud(
+      const std::vector<boost::shared_ptr<PPointCloud> > &pool);
+  boost::shared_ptr<PPointCloud> NewReducedCloud();
+  void AddAzimuthStep(int step);
+  void PublishFrame(const boost::shared_ptr<PPointCloud> &cld,
+                    double recv_stamp);
 
-  pthread_mutex_t lidar_lock_;
-  sem_t lidar_sem_;
   boost::thread *lidar_recv_thr_;
   boost::thread *lidar_process_thr_;
   bool enable_lidar_recv_thr_;
   bool enable_lidar_process_thr_;
-  int start_angle_ = 0;
+  // written by ResetStartAngle() while the process thread runs
+  std::atomic<uint16_t> start_angle_;
   double timestamp_ = 0;
 
-  std::list<struct PandarPacket_s> lidar_packets_;
-
   boost::shared_ptr<Input> input_;
+  // replaced by Start() under lidar_packets_lock_, the threads using it
+  // without the lock are stopped then
+  boost::shared_ptr<PacketRing<PandarPacket> > lidar_packets_;
+  mutable boost::mutex lidar_packets_lock_;
+  uint32_t packet_queue_capacity_;
+  PacketQueuePolicy packet_queue_policy_;
+  DualReturnPolicy dual_return_policy_;
+  std::atomic<uint64_t> packets_received_;
+  std::atomic<uint64_t> packets_dropped_;
+
   boost::function<void(boost::shared_ptr<PPointCloud> cld, double timestamp)>
       pcl_callback_;
   boost::function<void(double timestamp)> gps_callback_;
@@ -170,6 +239,61 @@ class Pandar40P_Internal {
   float blockOffset_[BLOCKS_PER_PACKET];
   float laserOffset_[LASER_COUNT];
 
+  // derived from elev_angle_map_ and horizatal_azimuth_offset_map_,
+  // elev_sin_/elev_cos_ include LASER_RETURN_TO_DISTANCE_RATE so they
+  // apply to the raw range. The azimuth offsets keep their full precision,
+  // they are added to the block azimuth with the angle sum identities
+  float elev_sin_[LASER_COUNT];
+  float elev_cos_[LASER_COUNT];
+  float azimuth_offset_sin_[LASER_COUNT];
+  float azimuth_offset_cos_[LASER_COUNT];
+
+  // date of the last packet and mktime() of its midnight
+  int day_key_;
+  double day_second_;
+
+  // number of points written into the current cloud
+  uint32_t cloud_size_;
+  std::vector<boost::shared_ptr<PPointCloud> > cloud_pool_;
+
+  // the downsampled copy of the current frame, NULL without a reduction
+  lidar_downsample::Downsampler downsampler_;
+  boost::function<void(boost::shared_ptr<PPointCloud> cld, double timestamp)>
+      reduced_callback_;
+  boost::shared_ptr<PPointCloud> reduced_cld_;
+  std::vector<boost::shared_ptr<PPointCloud> > reduced_pool_;
+
+  // azimuth steps of the current frame, steps over 1.5x azimuth_step_ are
+  // gaps left by lost packets
+  uint32_t frame_blocks_;
+  int frame_step_sum_;
+  int frame_step_count_;
+  int frame_gap_sum_;
+  int frame_gap_count_;
+  int frame_min_step_;
+  int azimuth_step_;  // smallest step of the previous frame
+  int blocks_per_azimuth_;  // 2 in dual return mode
+
+  // motion compensation, block_rotation_ and block_translation_ move the
+  // points of the current block into the lidar frame at the first block.
+  // compensated_cld_ holds them at the indices of the raw points, NULL
+  // without compensation
+  bool compensation_;
+  boost::function<void(boost::shared_ptr<PPointCloud> cld, double timestamp)>
+      compensated_callback_;
+  boost::shared_ptr<PPointCloud> compensated_cld_;
+  std::vector<boost::shared_ptr<PPointCloud> > compensated_pool_;
+  PoseBuffer pose_buffer_;
+  bool frame_reference_valid_;
+  bool frame_compensated_;
+  double frame_reference_time_;
+  Eigen::Affine3d frame_reference_inverse_;
+  Eigen::Matrix3f block_rotation_;
+  Eigen::Vector3f block_translation_;
+
+  mutable boost::mutex frame_stats_lock_;
+  FrameStats frame_stats_;
+
   int tz_second_;
   std::string frame_id_;
 };
@@ -0,0 +1,115 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef SRC_POSE_BUFFER_H_
+#define SRC_POSE_BUFFER_H_
+
+#include <boost/thread.hpp>
+#include <Eigen/Geometry>
+
+#include <vector>
+
+#include "pandar40p/pandar40p.h"
+
+namespace apollo {
+namespace drivers {
+namespace hesai {
+
+/**
+ * @brief The latest lidar poses, filled by the localization and looked up
+ *        by the decode thread at the time of each block.
+ *
+ * Lookup() interpolates between the poses around the time, linearly for the
+ * position and with slerp for the orientation. The localization usually lags
+ * the lidar by a few milliseconds, so a time after the newest pose is
+ * extrapolated from the last two poses, up to max_extrapolation seconds.
+ */
+class PoseBuffer {
+ public:
+  PoseBuffer(uint32_t capacity, double max_extrapolation)
+      : poses_(capacity), head_(0), size_(0),
+        max_extrapolation_(max_extrapolation) {}
+
+  void Add(const Pose &pose) {
+    boost::mutex::scoped_lock lock(lock_);
+    if (size_ > 0 && pose.timestamp <= Newest().timestamp) {
+      // out of order or repeated
+      return;
+    }
+    poses_[head_] = pose;
+    head_ = (head_ + 1) % poses_.size();
+    if (size_ < poses_.size()) {
+      ++size_;
+    }
+  }
+
+  void Clear() {
+    boost::mutex::scoped_lock lock(lock_);
+    size_ = 0;
+  }
+
+  bool Lookup(double timestamp, Eigen::Affine3d *pose) const {
+    boost::mutex::scoped_lock lock(lock_);
+    if (size_ < 2 || timestamp < At(0).timestamp ||
+        timestamp > Newest().timestamp + max_extrapolation_) {
+      return false;
+    }
+
+    // the pair of poses around the time, or the last pair to extrapolate
+    uint32_t i = size_ - 1;
+    while (i > 1 && At(i - 1).timestamp > timestamp) {
+      --i;
+    }
+    const Pose &p0 = At(i - 1);
+    const Pose &p1 = At(i);
+    const double t =
+        (timestamp - p0.timestamp) / (p1.timestamp - p0.timestamp);
+
+    const Eigen::Vector3d v0(p0.x, p0.y, p0.z);
+    const Eigen::Vector3d v1(p1.x, p1.y, p1.z);
+    const Eigen::Quaterniond q0(p0.qw, p0.qx, p0.qy, p0.qz);
+    const Eigen::Quaterniond q1(p1.qw, p1.qx, p1.qy, p1.qz);
+    Eigen::Quaterniond q;
+    if (t <= 1) {
+      q = q0.slerp(t, q1);
+    } else {
+      // keep turning at the rate between the last two poses
+      const Eigen::AngleAxisd step(q0.conjugate() * q1);
+      q = q1 * Eigen::AngleAxisd(step.angle() * (t - 1), step.axis());
+    }
+    *pose = Eigen::Translation3d(v0 + t * (v1 - v0)) * q.normalized();
+    return true;
+  }
+
+ private:
+  // i-th oldest pose
+  const Pose &At(uint32_t i) const {
+    return poses_[(head_ + poses_.size() - size_ + i) % poses_.size()];
+  }
+  const Pose &Newest() const { return At(size_ - 1); }
+
+  std::vector<Pose> poses_;
+  uint32_t head_;
+  uint32_t size_;
+  double max_extrapolation_;
+  mutable boost::mutex lock_;
+};
+
+}  // namespace hesai
+}  // namespace drivers
+}  // namespace apollo
+
+#endif  // SRC_POSE_BUFFER_H_
@@ -0,0 +1,121 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+// Replays a pcap capture through the Pandar40P decoder and reports its
+// throughput, no device or network needed.
+//   pandar40p_benchmark <capture.pcap> [rate] [lidar port] [gps port]
+//                       [dual return]
+// rate 1 replays in real time, N N times faster, 0 (default) at full speed.
+// dual return is both (default), deduped, strongest or last.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "pandar40p/pandar40p.h"
+
+using apollo::drivers::hesai::Pandar40P;
+using apollo::drivers::hesai::PacketQueueStats;
+using apollo::drivers::hesai::FrameStats;
+
+Pandar40P *pandar40p = NULL;
+std::vector<double> frameLatencies;
+uint64_t totalPoints = 0;
+int gpsPackets = 0;
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+void gpsCallback(double timestamp) { ++gpsPackets; }
+
+// called on the decode thread, right after the frame stats were updated
+void lidarCallback(boost::shared_ptr<PPointCloud> cld, double timestamp) {
+  FrameStats stats = pandar40p->GetFrameStats();
+  frameLatencies.push_back(stats.latency);
+  totalPoints += cld->points.size();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: %s <capture.pcap> [rate] [lidar port] [gps port] "
+           "[dual return]\n",
+           argv[0]);
+    return 1;
+  }
+  double rate = argc > 2 ? atof(argv[2]) : 0;
+  uint16_t lidarPort = argc > 3 ? atoi(argv[3]) : 8080;
+  uint16_t gpsPort = argc > 4 ? atoi(argv[4]) : 10110;
+  const char *dualReturn = argc > 5 ? argv[5] : "both";
+
+  pandar40p = new Pandar40P(std::string(argv[1]), rate, lidarPort, gpsPort,
+                            lidarCallback, gpsCallback, 0, 0,
+                            std::string("hesai40"));
+  // a full speed replay must not lose packets to the queue
+  pandar40p->SetPacketQueue(1024,
+                            apollo::drivers::hesai::PACKET_QUEUE_BLOCK);
+  if (!strcmp(dualReturn, "deduped")) {
+    pandar40p->SetDualReturnPolicy(apollo::drivers::hesai::DUAL_RETURN_DEDUPED);
+  } else if (!strcmp(dualReturn, "strongest")) {
+    pandar40p->SetDualReturnPolicy(
+        apollo::drivers::hesai::DUAL_RETURN_STRONGEST);
+  } else if (!strcmp(dualReturn, "last")) {
+    pandar40p->SetDualReturnPolicy(apollo::drivers::hesai::DUAL_RETURN_LAST);
+  }
+
+  double start = now();
+  pandar40p->Start();
+  while (!pandar40p->ReplayDone()) {
+    usleep(10000);
+  }
+  double elapsed = now() - start;
+  pandar40p->Stop();
+
+  PacketQueueStats queue = pandar40p->GetPacketQueueStats();
+  FrameStats frames = pandar40p->GetFrameStats();
+  printf("replay rate %g, dual return %s, %.3f s\n", rate, dualReturn,
+         elapsed);
+  printf("packets: %lu lidar, %d gps, %.0f lidar packets/s, queue high "
+         "water mark %u of %u\n",
+         queue.received, gpsPackets, queue.received / elapsed,
+         queue.high_water_mark, queue.capacity);
+  printf("frames: %lu, %lu incomplete, %.1f frames/s\n", frames.frames,
+         frames.incomplete_frames, frames.frames / elapsed);
+  printf("points: %lu, %.0f points/s\n", totalPoints, totalPoints / elapsed);
+  if (!frameLatencies.empty()) {
+    std::sort(frameLatencies.begin(), frameLatencies.end());
+    double sum = 0;
+    for (size_t i = 0; i < frameLatencies.size(); ++i) {
+      sum += frameLatencies[i];
+    }
+    printf("frame latency: min %.3f ms, mean %.3f ms, p99 %.3f ms, "
+           "max %.3f ms\n",
+           frameLatencies.front() * 1000,
+           sum / frameLatencies.size() * 1000,
+           frameLatencies[frameLatencies.size() * 99 / 100] * 1000,
+           frameLatencies.back() * 1000);
+  }
+
+  delete pandar40p;
+  return 0;
+}
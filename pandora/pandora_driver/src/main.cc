@@ -18,15 +18,35 @@
 #include <arpa/inet.h>
 #include <image_transport/image_transport.h>
 #include <cv_bridge/cv_bridge.h>
-#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/image_encodings.h>
+#include <pcl_ros/point_cloud.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <nav_msgs/Odometry.h>
+#include <tf2_ros/transform_listener.h>
+#include <eigen_conversions/eigen_msg.h>
 #include "pandora/pandora.h"
 
 using apollo::drivers::hesai::Pandora;
+using apollo::drivers::hesai::PacketQueueStats;
+using apollo::drivers::hesai::FrameStats;
+using apollo::drivers::hesai::CameraStats;
+using apollo::drivers::hesai::DualReturnPolicy;
+using apollo::drivers::hesai::Pose;
+using apollo::drivers::hesai::ReductionMode;
+
+// image messages per camera recycled once every subscriber released them
+#define IMAGE_MESSAGE_POOL_SIZE 3
+
+// keeps the image message alive as long as the SDK writes into its data
+struct ImageMessageHolder {
+  sensor_msgs::ImagePtr msg;
+  void operator()(cv::Mat *image) { delete image; }
+};
 
 class PandoraHesaiClient {
  public:
-  PandoraHesaiClient(ros::NodeHandle node, ros::NodeHandle nh) {
+  PandoraHesaiClient(ros::NodeHandle node, ros::NodeHandle nh)
+      : tf2TransformListener(tf2Buffer, node) {
     // default configure
     std::string pandoraIP = std::string("192.168.20.51");
     int lidarRecvPort = 2368;
@@ -43,18 +63,39 @@ class PandoraHesaiClient {
     bool enableCamera = true;
     int timezone = 8;
     std::string frameId = std::string("hesai40");
+    int packetQueueSize = 1024;
+    bool packetQueueBlock = false;
+    std::string dualReturn = std::string("both");
+    bool enableCompensation = false;
+    std::string localizationTopic = std::string("/odom");
+    std::string compensatedTopic =
+        "/apollo/sensor/pandora/hesai40/compensator/PointCloud2";
+    psdk = NULL;
+    droppedPackets = 0;
+    incompleteFrames = 0;
+    droppedPictures = 0;
+    uncompensatedFrames = 0;
+    extrinsicValid = false;
 
     // parse nodehandle param
     bool ret = parseParameter(nh, &pandoraIP, &lidarRecvPort,
             &gpsRecvPort, &startAngle, &pandoraCameraPort,
-            &lidarTopic, cameraTopics, &enableCamera, &timezone, &frameId);
+            &lidarTopic, cameraTopics, &enableCamera, &timezone, &frameId,
+            &packetQueueSize, &packetQueueBlock, &dualReturn,
+            &enableCompensation, &localizationTopic, &compensatedTopic);
     if (!ret) {
         ROS_INFO("Parse parameters failed, please check parameters above.");
         return;
     }
 
     // advertise
-    lidarPublisher = node.advertise<sensor_msgs::PointCloud2>(lidarTopic, 10);
+    // pcl_ros serializes the cloud in its own point layout, no PointCloud2
+    // copy, and nodelets in the same process get the pointer
+    lidarPublisher = node.advertise<PPointCloud>(lidarTopic, 10);
+    if (enableCompensation) {
+      compensatedLidarPublisher =
+          node.advertise<PPointCloud>(compensatedTopic, 10);
+    }
 
     if (enableCamera) {
       image_transport::ImageTransport it(nh);
@@ -69,14 +110,104 @@ class PandoraHesaiClient {
             boost::bind(&PandoraHesaiClient::cameraCallback,
                         this, _1, _2, _3, _4),
             enableCamera, timezone, frameId);
+    if (enableCamera) {
+      psdk->SetCameraImageAllocator(boost::bind(
+          &PandoraHesaiClient::allocateImage, this, _1, _2, _3));
+    }
+    psdk->SetLidarPacketQueue(packetQueueSize,
+        packetQueueBlock ? apollo::drivers::hesai::PACKET_QUEUE_BLOCK
+                         : apollo::drivers::hesai::PACKET_QUEUE_DROP_NEWEST);
+    psdk->SetLidarDualReturnPolicy(dualReturnPolicy(dualReturn));
+    if (enableCompensation) {
+      lidarFrameId = frameId;
+      psdk->SetLidarCompensation(true, boost::bind(
+          &PandoraHesaiClient::compensatedLidarCallback, this, _1, _2));
+      localizationSubscriber = node.subscribe(localizationTopic, 100,
+          &PandoraHesaiClient::localizationCallback, this);
+      // frames without a compensated copy never reach
+      // compensatedLidarCallback
+      compensationTimer = node.createWallTimer(ros::WallDuration(1.0),
+          &PandoraHesaiClient::compensationCheck, this);
+    }
+    if (enableCamera) {
+      setUndistortedViews(nh);
+    }
+    setLidarReduction(node, nh);
     psdk->Start();
   }
 
+  // lidar_reduction: none, voxel or stride, a downsampled copy of every
+  // cloud published on reduced_lidar_topic
+  void setLidarReduction(ros::NodeHandle node, ros::NodeHandle nh) {
+    std::string reduction = std::string("none");
+    double leafSize = 0.2;
+    int ringStride = 2;
+    int azimuthStride = 4;
+    std::string reducedTopic =
+        "/apollo/sensor/pandora/hesai40/PointCloud2/reduced";
+    nh.getParam("lidar_reduction", reduction);
+    nh.getParam("lidar_reduction_leaf_size", leafSize);
+    nh.getParam("lidar_reduction_ring_stride", ringStride);
+    nh.getParam("lidar_reduction_azimuth_stride", azimuthStride);
+    nh.getParam("reduced_lidar_topic", reducedTopic);
+
+    ReductionMode mode =
+        apollo::drivers::lidar_downsample::reduction_mode(reduction);
+    if (mode == apollo::drivers::hesai::REDUCTION_NONE) {
+      if (reduction != "none") {
+        ROS_WARN("Unknown lidar_reduction %s, use none, voxel or stride",
+                 reduction.c_str());
+      }
+      return;
+    }
+    std::cout << "lidarReduction: " << reduction << ", leafSize: " << leafSize
+              << ", ringStride: " << ringStride << ", azimuthStride: "
+              << azimuthStride << ", reducedLidarTopic: " << reducedTopic
+              << std::endl;
+    reducedLidarPublisher = node.advertise<PPointCloud>(reducedTopic, 10);
+    psdk->SetLidarReduction(mode, leafSize, ringStride, azimuthStride,
+        boost::bind(&PandoraHesaiClient::reducedLidarCallback, this, _1, _2));
+  }
+
+  // camera<N>_roi: [x, y, width, height] of the undistorted picture and
+  // camera<N>_scale: output size relative to the roi
+  void setUndistortedViews(ros::NodeHandle nh) {
+    for (int i = 0; i < 5; i++) {
+      std::string prefix = "camera" + std::to_string(i);
+      if (!nh.hasParam(prefix + "_roi") && !nh.hasParam(prefix + "_scale")) {
+        continue;
+      }
+      std::vector<int> roi;
+      double scale = 1.0;
+      nh.getParam(prefix + "_roi", roi);
+      nh.getParam(prefix + "_scale", scale);
+      cv::Rect rect(0, 0, 1280, 720);
+      if (roi.size() == 4) {
+        rect = cv::Rect(roi[0], roi[1], roi[2], roi[3]);
+      } else if (!roi.empty()) {
+        ROS_WARN("%s_roi needs 4 values, x y width height", prefix.c_str());
+        continue;
+      }
+      if (!psdk->SetCameraUndistortedView(i, rect, scale)) {
+        ROS_WARN("Invalid %s_roi or %s_scale, publishing the full picture",
+                 prefix.c_str(), prefix.c_str());
+      } else {
+        std::cout << prefix << " view: " << rect.x << ", " << rect.y << ", "
+                  << rect.width << "x" << rect.height << ", scale " << scale
+                  << std::endl;
+      }
+    }
+  }
+
   bool parseParameter(ros::NodeHandle nh, std::string* pandoraIP,
                       int* lidarRecvPort, int* gpsRecvPort, int* startAngle,
                       int* pandoraCameraPort, std::string* lidarTopic,
                       std::string cameraTopics[], bool* enableCamera,
-                      int* timezone, std::string* frameId) {
+                      int* timezone, std::string* frameId,
+                      int* packetQueueSize, bool* packetQueueBlock,
+                      std::string* dualReturn, bool* enableCompensation,
+                      std::string* localizationTopic,
+                      std::string* compensatedTopic) {
     if (nh.hasParam("pandora_ip")) {
       nh.getParam("pandora_ip", *pandoraIP);
     }
@@ -119,13 +250,36 @@ class PandoraHesaiClient {
     if (nh.hasParam("frame_id")) {
       nh.getParam("frame_id", *frameId);
     }
+    if (nh.hasParam("lidar_packet_queue_size")) {
+      nh.getParam("lidar_packet_queue_size", *packetQueueSize);
+    }
+    if (nh.hasParam("lidar_packet_queue_block")) {
+      nh.getParam("lidar_packet_queue_block", *packetQueueBlock);
+    }
+    if (nh.hasParam("lidar_dual_return")) {
+      nh.getParam("lidar_dual_return", *dualReturn);
+    }
+    if (nh.hasParam("enable_compensation")) {
+      nh.getParam("enable_compensation", *enableCompensation);
+    }
+    if (nh.hasParam("localization_topic")) {
+      nh.getParam("localization_topic", *localizationTopic);
+    }
+    if (nh.hasParam("compensated_lidar_topic")) {
+      nh.getParam("compensated_lidar_topic", *compensatedTopic);
+    }
 
     std::cout << "Configs: pandoraIP: " << *pandoraIP << ", lidarRecvPort: "
         << *lidarRecvPort << ", gpsRecvPort: " << *gpsRecvPort
         << ", startAngle: " << *startAngle << ", pandoraCameraPort: "
         << *pandoraCameraPort << ", lidarTopic: " << *lidarTopic
         << ", enableCamera: " << *enableCamera << ", frameId: "
-        << *frameId << std::endl;
+        << *frameId << ", lidarPacketQueueSize: " << *packetQueueSize
+        << ", lidarPacketQueueBlock: " << *packetQueueBlock
+        << ", lidarDualReturn: " << *dualReturn
+        << ", enableCompensation: " << *enableCompensation
+        << ", localizationTopic: " << *localizationTopic
+        << ", compensatedLidarTopic: " << *compensatedTopic << std::endl;
     for (int i = 0; i < 5; i++) {
       std::cout << "cameraTopic" << i << ": " << cameraTopics[i] << std::endl;
     }
@@ -134,14 +288,107 @@ class PandoraHesaiClient {
     struct sockaddr_in sa;
     return checkPort(*lidarRecvPort) && checkPort(*gpsRecvPort)
         && checkPort(*pandoraCameraPort) && (*startAngle >= 0)
-        && (*startAngle < 360)
+        && (*startAngle < 360) && (*packetQueueSize > 0)
+        && (*dualReturn == "both" || *dualReturn == "deduped"
+            || *dualReturn == "strongest" || *dualReturn == "last")
         && (1 == inet_pton(AF_INET, pandoraIP->c_str(), &(sa.sin_addr)));
   }
 
+  DualReturnPolicy dualReturnPolicy(const std::string &name) {
+    if (name == "deduped") {
+      return apollo::drivers::hesai::DUAL_RETURN_DEDUPED;
+    } else if (name == "strongest") {
+      return apollo::drivers::hesai::DUAL_RETURN_STRONGEST;
+    } else if (name == "last") {
+      return apollo::drivers::hesai::DUAL_RETURN_LAST;
+    }
+    return apollo::drivers::hesai::DUAL_RETURN_BOTH;
+  }
+
   bool checkPort(int port) {
     return (port > 0) && (port < 65535);
   }
 
+  // the odometry is the pose of its child frame, the static extrinsic from
+  // that frame to the lidar makes it the pose of the lidar
+  void localizationCallback(const nav_msgs::OdometryConstPtr &msg) {
+    if (!extrinsicValid) {
+      if (msg->child_frame_id.empty() || msg->child_frame_id == lidarFrameId) {
+        extrinsic.setIdentity();
+      } else {
+        try {
+          geometry_msgs::TransformStamped stamped =
+              tf2Buffer.lookupTransform(msg->child_frame_id, lidarFrameId,
+                                        ros::Time(0));
+          tf::transformMsgToEigen(stamped.transform, extrinsic);
+        } catch (tf2::TransformException &ex) {
+          ROS_WARN_THROTTLE(5, "No lidar extrinsic, %s", ex.what());
+          return;
+        }
+      }
+      extrinsicValid = true;
+    }
+
+    Eigen::Affine3d pose;
+    tf::poseMsgToEigen(msg->pose.pose, pose);
+    pose = pose * extrinsic;
+    const Eigen::Quaterniond q(pose.linear());
+    Pose lidarPose;
+    lidarPose.timestamp = msg->header.stamp.toSec();
+    lidarPose.x = pose.translation().x();
+    lidarPose.y = pose.translation().y();
+    lidarPose.z = pose.translation().z();
+    lidarPose.qw = q.w();
+    lidarPose.qx = q.x();
+    lidarPose.qy = q.y();
+    lidarPose.qz = q.z();
+    psdk->AddLidarPose(lidarPose);
+  }
+
+  void compensationCheck(const ros::WallTimerEvent &event) {
+    FrameStats frameStats = psdk->GetLidarFrameStats();
+    if (frameStats.uncompensated_frames > uncompensatedFrames) {
+      ROS_WARN_THROTTLE(10, "No lidar pose for %lu of %lu frames, published "
+                        "uncompensated only",
+                        frameStats.uncompensated_frames, frameStats.frames);
+      uncompensatedFrames = frameStats.uncompensated_frames;
+    }
+  }
+
+  // called from the decode thread of camera pic_id only, so each pool is
+  // used by a single thread
+  boost::shared_ptr<cv::Mat> allocateImage(int pic_id, int width,
+                                           int height) {
+    if (pic_id > 4 || pic_id < 0) {
+      return boost::shared_ptr<cv::Mat>();
+    }
+    std::vector<sensor_msgs::ImagePtr> &pool = imagePools[pic_id];
+    sensor_msgs::ImagePtr msg;
+    for (size_t i = 0; i < pool.size(); ++i) {
+      if (pool[i].unique()) {
+        msg = pool[i];
+        break;
+      }
+    }
+    if (!msg) {
+      msg.reset(new sensor_msgs::Image());
+      if (pool.size() < IMAGE_MESSAGE_POOL_SIZE) {
+        pool.push_back(msg);
+      }
+    }
+    msg->height = height;
+    msg->width = width;
+    msg->encoding = sensor_msgs::image_encodings::RGB8;
+    msg->is_bigendian = 0;
+    msg->step = width * 3;
+    msg->data.resize(msg->step * height);
+
+    ImageMessageHolder holder;
+    holder.msg = msg;
+    return boost::shared_ptr<cv::Mat>(
+        new cv::Mat(height, width, CV_8UC3, &msg->data[0]), holder);
+  }
+
   void cameraCallback(boost::shared_ptr<cv::Mat> matp, double timestamp,
                       int pic_id, bool distortion) {
     sensor_msgs::ImagePtr imgMsg;
@@ -150,16 +397,64 @@ class PandoraHesaiClient {
       ROS_INFO("picid wrong in getImageToPub");
       return;
     }
-    imgMsg = cv_bridge::CvImage(std_msgs::Header(), "rgb8", *matp).toImageMsg();
+    // the picture was decoded into the data of its message unless a decoder
+    // had to reallocate it
+    ImageMessageHolder *holder =
+        boost::get_deleter<ImageMessageHolder>(matp);
+    if (holder && matp->data == &holder->msg->data[0]) {
+      imgMsg = holder->msg;
+    } else {
+      imgMsg =
+          cv_bridge::CvImage(std_msgs::Header(), "rgb8", *matp).toImageMsg();
+    }
     imgMsg->header.stamp = ros::Time(timestamp);
     imgPublishers[pic_id].publish(imgMsg);
   }
 
   void lidarCallback(boost::shared_ptr<PPointCloud> cld, double timestamp) {
+    PacketQueueStats stats = psdk->GetLidarPacketQueueStats();
+    if (stats.dropped > droppedPackets) {
+      ROS_WARN("Lidar packet queue full, dropped %lu packets, "
+               "high water mark %u of %u",
+               stats.dropped - droppedPackets, stats.high_water_mark,
+               stats.capacity);
+      droppedPackets = stats.dropped;
+    }
+
+    FrameStats frameStats = psdk->GetLidarFrameStats();
+    if (frameStats.incomplete_frames > incompleteFrames) {
+      ROS_WARN("Incomplete lidar frame, %u of %u blocks, %lu of %lu frames "
+               "incomplete",
+               frameStats.blocks,
+               frameStats.blocks + frameStats.missing_blocks,
+               frameStats.incomplete_frames, frameStats.frames);
+      incompleteFrames = frameStats.incomplete_frames;
+    }
+
+    // checked here rather than from the five camera threads
+    CameraStats cameraStats = psdk->GetCameraStats();
+    if (cameraStats.dropped > droppedPictures) {
+      ROS_WARN("Camera decoding is behind, dropped %lu pictures, "
+               "%lu of %lu dropped so far",
+               cameraStats.dropped - droppedPictures, cameraStats.dropped,
+               cameraStats.frames + cameraStats.dropped);
+      droppedPictures = cameraStats.dropped;
+    }
+
+    pcl_conversions::toPCL(ros::Time(timestamp), cld->header.stamp);
+    lidarPublisher.publish(cld);
+  }
+
+  void compensatedLidarCallback(boost::shared_ptr<PPointCloud> cld,
+                                double timestamp) {
+    pcl_conversions::toPCL(ros::Time(timestamp), cld->header.stamp);
+    compensatedLidarPublisher.publish(cld);
+  }
+
+  void reducedLidarCallback(boost::shared_ptr<PPointCloud> cld,
+                            double timestamp) {
     pcl_conversions::toPCL(ros::Time(timestamp), cld->header.stamp);
-    sensor_msgs::PointCloud2 output;
-    pcl::toROSMsg(*cld, output);
-    lidarPublisher.publish(output);
+    reducedLidarPublisher.publish(cld);
   }
 
   ~PandoraHesaiClient() {
@@ -170,8 +465,22 @@ class PandoraHesaiClient {
 
  private:
   ros::Publisher lidarPublisher;
+  ros::Publisher compensatedLidarPublisher;
+  ros::Publisher reducedLidarPublisher;
   image_transport::Publisher imgPublishers[5];
+  std::vector<sensor_msgs::ImagePtr> imagePools[5];
   Pandora *psdk;
+  uint64_t droppedPackets;
+  uint64_t incompleteFrames;
+  uint64_t droppedPictures;
+  uint64_t uncompensatedFrames;
+  ros::Subscriber localizationSubscriber;
+  ros::WallTimer compensationTimer;
+  tf2_ros::Buffer tf2Buffer;
+  tf2_ros::TransformListener tf2TransformListener;
+  std::string lidarFrameId;
+  bool extrinsicValid;
+  Eigen::Affine3d extrinsic;
 };
 
 int main(int argc, char **argv) {
@@ -42,6 +42,27 @@ class Pandora_Internal {
   ~Pandora_Internal();
   int LoadLidarCorrectionFile(const std::string &correction_content);
   void ResetLidarStartAngle(uint16_t start_angle);
+  void SetLidarPacketQueue(uint32_t capacity, PacketQueuePolicy policy);
+  void SetLidarDualReturnPolicy(DualReturnPolicy policy);
+  void SetLidarCompensation(
+      bool enable,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          compensated_callback);
+  void SetLidarReduction(
+      ReductionMode mode, double leaf_size, int ring_stride,
+      int azimuth_stride,
+      boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+          reduced_callback);
+  void AddLidarPose(const Pose &pose);
+  PacketQueueStats GetLidarPacketQueueStats() const;
+  FrameStats GetLidarFrameStats() const;
+  CameraStats GetCameraStats() const;
+  bool SetCameraUndistortedView(int pic_id, const cv::Rect &roi,
+                                double scale);
+  void SetCameraImageAllocator(
+      boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                                 int height)>
+          allocator);
   int UploadCameraCalibrationFile(const CameraCalibration calibs[5]);
   int GetCameraCalibration(CameraCalibration calibs[5]);
   int ResetCameraClibration();
@@ -130,6 +151,72 @@ void Pandora_Internal::ResetLidarStartAngle(uint16_t start_angle) {
   pandar40p_->ResetStartAngle(start_angle);
 }
 
+void Pandora_Internal::SetLidarPacketQueue(uint32_t capacity,
+                                           PacketQueuePolicy policy) {
+  if (!pandar40p_) return;
+  pandar40p_->SetPacketQueue(capacity, policy);
+}
+
+void Pandora_Internal::SetLidarDualReturnPolicy(DualReturnPolicy policy) {
+  if (!pandar40p_) return;
+  pandar40p_->SetDualReturnPolicy(policy);
+}
+
+void Pandora_Internal::SetLidarCompensation(
+    bool enable,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        compensated_callback) {
+  if (!pandar40p_) return;
+  pandar40p_->EnableCompensation(enable, compensated_callback);
+}
+
+void Pandora_Internal::SetLidarReduction(
+    ReductionMode mode, double leaf_size, int ring_stride, int azimuth_stride,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        reduced_callback) {
+  if (!pandar40p_) return;
+  pandar40p_->SetReduction(mode, leaf_size, ring_stride, azimuth_stride,
+                           reduced_callback);
+}
+
+void Pandora_Internal::AddLidarPose(const Pose &pose) {
+  if (!pandar40p_) return;
+  pandar40p_->AddPose(pose);
+}
+
+PacketQueueStats Pandora_Internal::GetLidarPacketQueueStats() const {
+  return pandar40p_->GetPacketQueueStats();
+}
+
+FrameStats Pandora_Internal::GetLidarFrameStats() const {
+  return pandar40p_->GetFrameStats();
+}
+
+CameraStats Pandora_Internal::GetCameraStats() const {
+  CameraStats stats = {0, 0, 0};
+  if (!pandora_camera_) return stats;
+  PandoraClientStats client_stats = pandora_camera_->getStats();
+  stats.frames = client_stats.frames;
+  stats.dropped = client_stats.dropped;
+  stats.discarded = client_stats.discarded;
+  return stats;
+}
+
+bool Pandora_Internal::SetCameraUndistortedView(int pic_id,
+                                                const cv::Rect &roi,
+                                                double scale) {
+  if (!pandora_camera_) return false;
+  return pandora_camera_->setUndistortedView(pic_id, roi, scale);
+}
+
+void Pandora_Internal::SetCameraImageAllocator(
+    boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                               int height)>
+        allocator) {
+  if (!pandora_camera_) return;
+  pandora_camera_->setImageAllocator(allocator);
+}
+
 int Pandora_Internal::Start() {
   Stop();
   if (pandora_camera_) {
@@ -427,6 +514,108 @@ void Pandora::ResetLidarStartAngle(uint16_t start_angle) {
   internal_->ResetLidarStartAngle(start_angle);
 }
 
+/**
+ * @brief Configure the lidar packet queue, applied by the next Start().
+ * @param capacity Number of preallocated packet slots
+ *        policy   What to do with packets while the queue is full
+ */
+void Pandora::SetLidarPacketQueue(uint32_t capacity,
+                                  PacketQueuePolicy policy) {
+  internal_->SetLidarPacketQueue(capacity, policy);
+}
+
+/**
+ * @brief Select the lidar returns kept in dual return mode. Call it before
+ *        Start().
+ * @param policy The returns that become points
+ */
+void Pandora::SetLidarDualReturnPolicy(DualReturnPolicy policy) {
+  internal_->SetLidarDualReturnPolicy(policy);
+}
+
+/**
+ * @brief Also deliver a motion compensated copy of every lidar cloud. Call it
+ *        before Start().
+ * @param enable               Compensate the frames
+ *        compensated_callback The callback of the compensated clouds
+ */
+void Pandora::SetLidarCompensation(
+    bool enable,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        compensated_callback) {
+  internal_->SetLidarCompensation(enable, compensated_callback);
+}
+
+/**
+ * @brief Also deliver a downsampled copy of every lidar cloud. Call it before
+ *        Start().
+ * @param mode             How the points are picked
+ *        leaf_size        Voxel edge in meters
+ *        ring_stride      Keep every ring_stride-th laser
+ *        azimuth_stride   and of it every azimuth_stride-th point
+ *        reduced_callback The callback of the reduced clouds
+ */
+void Pandora::SetLidarReduction(
+    ReductionMode mode, double leaf_size, int ring_stride, int azimuth_stride,
+    boost::function<void(boost::shared_ptr<PPointCloud>, double)>
+        reduced_callback) {
+  internal_->SetLidarReduction(mode, leaf_size, ring_stride, azimuth_stride,
+                               reduced_callback);
+}
+
+/**
+ * @brief Add a lidar pose for the motion compensation, in time order.
+ * @param pose The pose of the lidar in the world frame
+ */
+void Pandora::AddLidarPose(const Pose &pose) { internal_->AddLidarPose(pose); }
+
+/**
+ * @brief Get the lidar packet queue statistics.
+ */
+PacketQueueStats Pandora::GetLidarPacketQueueStats() const {
+  return internal_->GetLidarPacketQueueStats();
+}
+
+/**
+ * @brief Get the lidar point cloud frame statistics.
+ */
+FrameStats Pandora::GetLidarFrameStats() const {
+  return internal_->GetLidarFrameStats();
+}
+
+/**
+ * @brief Get the camera picture statistics.
+ */
+CameraStats Pandora::GetCameraStats() const {
+  return internal_->GetCameraStats();
+}
+
+/**
+ * @brief Publish a crop and/or a downscaled copy of a camera's undistorted
+ *        picture instead of the full picture. Call it before Start().
+ * @param pic_id The camera, 0 - 4
+ *        roi    The crop of the 1280x720 undistorted picture
+ *        scale  Output size relative to roi, in (0, 1]
+ */
+bool Pandora::SetCameraUndistortedView(int pic_id, const cv::Rect &roi,
+                                       double scale) {
+  return internal_->SetCameraUndistortedView(pic_id, roi, scale);
+}
+
+/**
+ * @brief Decode the camera pictures into images of the caller, e.g. the
+ *        data buffer of the message that will carry them, instead of
+ *        images of the SDK. Call it before Start().
+ * @param allocator Called from the decode thread of camera pic_id, returns
+ *                  a continuous width x height CV_8UC3 image or NULL
+ */
+void Pandora::SetCameraImageAllocator(
+    boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                               int height)>
+        allocator) {
+  internal_->SetCameraImageAllocator(allocator);
+}
+
 /**
  * @brief Upload the camera calibration contents to Pandora Device.
  * @param calibs calibration contents , include camera intrinsics and
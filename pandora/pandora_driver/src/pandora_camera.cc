@@ -17,11 +17,11 @@
 #include <stdio.h>
 #include <unistd.h>
 
-#include <jpeglib.h>
 #include <vector>
 
 #include "src/pandora_camera.h"
 #include "src/pandora_client.h"
+#include "src/yuv422_rgb.h"
 
 namespace apollo {
 namespace drivers {
@@ -33,7 +33,9 @@ static int CameraClientCallback(void *handle, int cmd, void *param,
                                 void *userp) {
   PandoraPic *pic = static_cast<PandoraPic *>(param);
   PandoraCamera *pSDK = static_cast<PandoraCamera *>(userp);
-  pSDK->pushPicture(pic);
+  if (!pSDK->pushPicture(pic)) {
+    PandoraClientReleasePic(handle, pic);
+  }
   return 0;
 }
 
@@ -44,11 +46,17 @@ PandoraCamera::PandoraCamera(
         camera_callback,
     boost::function<void(bool connected)> connectionChanged, int tz) {
   ip_ = device_ip;
-  sem_init(&pic_sem_, 0, 0);
-  pthread_mutex_init(&pic_lock_, NULL);
-  process_pic_thread_ = NULL;
+  for (int i = 0; i < CAMERA_NUM; ++i) {
+    CameraStream &stream = streams_[i];
+    sem_init(&stream.pic_sem, 0, 0);
+    pthread_mutex_init(&stream.pic_lock, NULL);
+    stream.thread = NULL;
+    stream.decompressor = tjInitDecompress();
+    stream.view_roi = cv::Rect(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT);
+    stream.view_scale = 1.0;
+  }
   continue_process_pic_ = false;
-  need_remap_ = false;
+  fused_yuv_remap_ = false;
   camera_port_ = pandoraCameraPort;
   pandora_client_ = NULL;
   camera_callback_ = camera_callback;
@@ -58,8 +66,14 @@ PandoraCamera::PandoraCamera(
 
 PandoraCamera::~PandoraCamera() {
   Stop();
-  sem_destroy(&pic_sem_);
-  pthread_mutex_destroy(&pic_lock_);
+  for (int i = 0; i < CAMERA_NUM; ++i) {
+    CameraStream &stream = streams_[i];
+    sem_destroy(&stream.pic_sem);
+    pthread_mutex_destroy(&stream.pic_lock);
+    if (stream.decompressor) {
+      tjDestroy(stream.decompressor);
+    }
+  }
 }
 
 int PandoraCamera::Start() {
@@ -71,38 +85,125 @@ int PandoraCamera::Start() {
     continue_process_pic_ = false;
     return -1;
   }
-  process_pic_thread_ =
-      new boost::thread(boost::bind(&PandoraCamera::processPic, this));
-  if (!process_pic_thread_) {
-    continue_process_pic_ = false;
-    PandoraClientDestroy(pandora_client_);
-    return -1;
+  // one thread per camera keeps the pictures of a camera in order while the
+  // cameras are decoded in parallel
+  for (int i = 0; i < CAMERA_NUM; ++i) {
+    streams_[i].thread =
+        new boost::thread(boost::bind(&PandoraCamera::processPic, this, i));
   }
   return 0;
 }
 
 void PandoraCamera::Stop() {
+  for (int i = 0; i < CAMERA_NUM; ++i) {
+    pthread_mutex_lock(&streams_[i].pic_lock);
+  }
   continue_process_pic_ = false;
+  for (int i = 0; i < CAMERA_NUM; ++i) {
+    pthread_mutex_unlock(&streams_[i].pic_lock);
+  }
+
+  // the pictures belong to the pool of the client, hand them all back
+  // before it goes away
+  for (int i = 0; i < CAMERA_NUM; ++i) {
+    CameraStream &stream = streams_[i];
+    if (stream.thread) {
+      stream.thread->join();
+      delete stream.thread;
+    }
+    stream.thread = NULL;
+    clearPictures(&stream);
+  }
+
   if (pandora_client_) {
     PandoraClientDestroy(pandora_client_);
   }
   pandora_client_ = NULL;
+}
+
+PandoraClientStats PandoraCamera::getStats() const {
+  PandoraClientStats stats;
+  memset(&stats, 0, sizeof(stats));
+  if (pandora_client_) {
+    PandoraClientGetStats(pandora_client_, &stats);
+  }
+  return stats;
+}
+
+void PandoraCamera::setFusedYuvRemap(bool fused) {
+  fused_yuv_remap_ = fused;
+}
 
-  if (process_pic_thread_) {
-    process_pic_thread_->join();
-    delete process_pic_thread_;
+bool PandoraCamera::pushPicture(PandoraPic *pic) {
+  if (pic->header.pic_id >= CAMERA_NUM) {
+    printf("wrong pic id\n");
+    return false;
+  }
+  CameraStream &stream = streams_[pic->header.pic_id];
+  pthread_mutex_lock(&stream.pic_lock);
+  if (!continue_process_pic_) {
+    // stopping, nobody would give the picture back
+    pthread_mutex_unlock(&stream.pic_lock);
+    return false;
   }
-  process_pic_thread_ = NULL;
+  stream.pic_list.push_back(pic);
+  pthread_mutex_unlock(&stream.pic_lock);
+  sem_post(&stream.pic_sem);
+  return true;
 }
 
-void PandoraCamera::pushPicture(PandoraPic *pic) {
-  pthread_mutex_lock(&pic_lock_);
-  pic_list_.push_back(pic);
-  pthread_mutex_unlock(&pic_lock_);
-  sem_post(&pic_sem_);
+void PandoraCamera::clearPictures(CameraStream *stream) {
+  pthread_mutex_lock(&stream->pic_lock);
+  while (!stream->pic_list.empty()) {
+    PandoraPic *pic = stream->pic_list.front();
+    stream->pic_list.pop_front();
+    PandoraClientReleasePic(pandora_client_, pic);
+  }
+  pthread_mutex_unlock(&stream->pic_lock);
 }
 
-void PandoraCamera::processPic() {
+void PandoraCamera::setImageAllocator(
+    boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                               int height)>
+        allocator) {
+  image_allocator_ = allocator;
+}
+
+/**
+ * @brief an output image of the camera that nobody holds any more, from the
+ *        image allocator if there is one
+ */
+boost::shared_ptr<cv::Mat> PandoraCamera::acquireImage(int pic_id,
+                                                       const cv::Size &size) {
+  if (image_allocator_) {
+    boost::shared_ptr<cv::Mat> image =
+        image_allocator_(pic_id, size.width, size.height);
+    if (image && image->size() == size && image->type() == CV_8UC3 &&
+        image->isContinuous()) {
+      return image;
+    }
+  }
+
+  CameraStream *stream = &streams_[pic_id];
+  boost::shared_ptr<cv::Mat> image;
+  for (size_t i = 0; i < stream->image_pool.size(); ++i) {
+    if (stream->image_pool[i].unique()) {
+      image = stream->image_pool[i];
+      break;
+    }
+  }
+  if (!image) {
+    image.reset(new cv::Mat());
+    if (stream->image_pool.size() < CAMERA_IMAGE_POOL_SIZE) {
+      stream->image_pool.push_back(image);
+    }
+  }
+  image->create(size, CV_8UC3);
+  return image;
+}
+
+void PandoraCamera::processPic(int pic_id) {
+  CameraStream &stream = streams_[pic_id];
   while (continue_process_pic_) {
     struct timespec ts;
     if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
@@ -110,14 +211,21 @@ void PandoraCamera::processPic() {
     }
 
     ts.tv_sec += 1;
-    if (sem_timedwait(&pic_sem_, &ts) == -1) {
+    if (sem_timedwait(&stream.pic_sem, &ts) == -1) {
       continue;
     }
 
-    pthread_mutex_lock(&pic_lock_);
-    PandoraPic *pic = pic_list_.front();
-    pic_list_.pop_front();
-    pthread_mutex_unlock(&pic_lock_);
+    pthread_mutex_lock(&stream.pic_lock);
+    if (stream.pic_list.empty()) {
+      // cleared by Stop()
+      pthread_mutex_unlock(&stream.pic_lock);
+      continue;
+    }
+    PandoraPic *pic = stream.pic_list.front();
+    stream.pic_list.pop_front();
+    boost::shared_ptr<const UndistortMap> undistort = stream.undistort;
+    pthread_mutex_unlock(&stream.pic_lock);
+    const bool need_remap = undistort != NULL;
 
     if (pic == NULL) {
       printf("pic is NULL\n");
@@ -133,122 +241,118 @@ void PandoraCamera::processPic() {
     t.tm_year = pic->header.UTC_Time.UTC_Year + 2000 - 1900;
     t.tm_isdst = 0;
     double timestamp = mktime(&t) + pic->header.timestamp / 1000000.0;
-    boost::shared_ptr<cv::Mat> cvMatPic(new cv::Mat());
-    switch (pic->header.pic_id) {
-      case 0:
-        yuv422ToCvmat(cvMatPic, pic->yuv, pic->header.width, pic->header.height,
-                      8);
-        if (need_remap_)
-          remap(cvMatPic->clone(), *cvMatPic, mapx_[pic->header.pic_id],
-                mapy_[pic->header.pic_id], CV_INTER_LINEAR);
-        break;
-      case 1:
-      case 2:
-      case 3:
-      case 4:
-        uint8_t *bmp;
-        uint32_t bmpSize;
-        decompressJpeg(static_cast<uint8_t *>(pic->yuv), pic->header.len, &bmp,
-                       &bmpSize);
-
-        *cvMatPic = cv::Mat(IMAGE_HEIGHT, IMAGE_WIDTH, CV_8UC3, bmp).clone();
-        if (need_remap_)
-          remap(cvMatPic->clone(), *cvMatPic, mapx_[pic->header.pic_id],
-                mapy_[pic->header.pic_id], CV_INTER_LINEAR);
-
-        free(bmp);
-        break;
-
-      default:
-        free(pic->yuv);
-        free(pic);
-        printf("wrong pic id\n");
-        return;
+
+    // the size the decoders create, so that they keep the acquired buffer
+    const cv::Size size = need_remap ? undistort->map1.size()
+                                     : cv::Size(pic->header.width,
+                                                pic->header.height);
+    boost::shared_ptr<cv::Mat> cvMatPic = acquireImage(pic_id, size);
+    // decode straight into the output image unless it is undistorted after
+    cv::Mat *decoded = need_remap ? &stream.decoded : cvMatPic.get();
+    int ret = 0;
+    if (pic_id == 0 && need_remap && fused_yuv_remap_) {
+      Yuv422ToRgb24Remap(static_cast<const uint8_t *>(pic->yuv),
+                         pic->header.width, pic->header.height,
+                         undistort->map1, undistort->map2, cvMatPic.get());
+      decoded = NULL;
+    } else if (pic_id == 0) {
+      yuv422ToCvmat(decoded, pic->yuv, pic->header.width, pic->header.height,
+                    8);
+    } else {
+      ret = decompressJpeg(stream.decompressor,
+                           static_cast<uint8_t *>(pic->yuv), pic->header.len,
+                           decoded);
+    }
+    if (ret == 0 && need_remap && decoded) {
+      // the fixed point maps need no per pixel float math, and only the
+      // pixels of the view are computed
+      remap(*decoded, *cvMatPic, undistort->map1, undistort->map2,
+            CV_INTER_LINEAR);
     }
-    if (camera_callback_) {
+
+    if (ret == 0 && camera_callback_) {
       // Add 2 seconds to correct the timestamp, Reason? No reason.
       // liuxingwei@hesaitech.com
-      camera_callback_(cvMatPic, timestamp + 2 + tz_second_, pic->header.pic_id,
-                       need_remap_);
+      camera_callback_(cvMatPic, timestamp + 2 + tz_second_, pic_id,
+                       need_remap);
     }
-    free(pic->yuv);
-    pic->yuv = NULL;
-    free(pic);
+    PandoraClientReleasePic(pandora_client_, pic);
     pic = NULL;
   }
 }
 
 bool PandoraCamera::loadIntrinsics(const std::vector<cv::Mat> &cameras_k,
                                    const std::vector<cv::Mat> &cameras_d) {
+  if (cameras_k.size() < CAMERA_NUM || cameras_d.size() < CAMERA_NUM) {
+    return false;
+  }
+  cameras_k_ = cameras_k;
+  cameras_d_ = cameras_d;
   for (int i = 0; i < CAMERA_NUM; i++) {
-    cv::Mat mapx = cv::Mat(HesaiLidarSDK_IMAGE_SIZE, CV_32FC1);
-    cv::Mat mapy = cv::Mat(HesaiLidarSDK_IMAGE_SIZE, CV_32FC1);
-    cv::Mat R = cv::Mat::eye(3, 3, CV_32F);
-    initUndistortRectifyMap(cameras_k[i], cameras_d[i], R, cameras_k[i],
-                            HesaiLidarSDK_IMAGE_SIZE, CV_32FC1, mapx, mapy);
-    mapx_.push_back(mapx);
-    mapy_.push_back(mapy);
+    buildUndistortMap(i);
   }
-  need_remap_ = true;
   return true;
 }
 
-void PandoraCamera::yuvToRgb(const int iY, const int iU, const int iV, int *iR,
-                             int *iG, int *iB) {
-  assert(&iR != NULL && &iG != NULL && &iB != NULL);
-
-  *iR = iY + 1.13983 * (iV - 128);
-  *iG = iY - 0.39465 * (iU - 128) - 0.58060 * (iV - 128);
-  *iB = iY + 2.03211 * (iU - 128);
-
-  *iR = *iR > 255 ? 255 : *iR;
-  *iR = *iR < 0 ? 0 : *iR;
-
-  *iG = *iG > 255 ? 255 : *iG;
-  *iG = *iG < 0 ? 0 : *iG;
-
-  *iB = *iB > 255 ? 255 : *iB;
-  *iB = *iB < 0 ? 0 : *iB;
+bool PandoraCamera::setUndistortedView(int pic_id, const cv::Rect &roi,
+                                       double scale) {
+  if (pic_id < 0 || pic_id >= CAMERA_NUM || scale <= 0.0 || scale > 1.0 ||
+      roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+      roi.x + roi.width > IMAGE_WIDTH || roi.y + roi.height > IMAGE_HEIGHT) {
+    return false;
+  }
+  streams_[pic_id].view_roi = roi;
+  streams_[pic_id].view_scale = scale;
+  if (!cameras_k_.empty()) {
+    buildUndistortMap(pic_id);
+  }
+  return true;
 }
 
-void PandoraCamera::yuv422ToRgb24(const unsigned char *uyvy422,
-                                  unsigned char *rgb24, const int width,
-                                  const int height) {
-  int iR, iG, iB;
-  int iY0, iY1, iU, iV;
-  int i = 0;
-  int j = 0;
-  for (i = 0; i < width * height * 2; i += 4) {
-    iU = uyvy422[i + 0];
-    iY0 = uyvy422[i + 1];
-    iV = uyvy422[i + 2];
-    iY1 = uyvy422[i + 3];
-
-    yuvToRgb(iY0, iU, iV, &iR, &iG, &iB);
-    rgb24[j++] = iB;
-    rgb24[j++] = iG;
-    rgb24[j++] = iR;
-    yuvToRgb(iY1, iU, iV, &iR, &iG, &iB);
-    rgb24[j++] = iB;
-    rgb24[j++] = iG;
-    rgb24[j++] = iR;
-  }
+/**
+ * @brief maps from the distorted picture to the view of a camera, the view
+ *        is the undistorted picture cropped to view_roi and scaled by
+ *        view_scale
+ */
+void PandoraCamera::buildUndistortMap(int pic_id) {
+  CameraStream &stream = streams_[pic_id];
+  const cv::Rect &roi = stream.view_roi;
+  const double scale = stream.view_scale;
+
+  // move the principal point into the view, keeping pixel centres aligned
+  cv::Mat view_k;
+  cameras_k_[pic_id].convertTo(view_k, CV_64F);
+  const double cx = view_k.at<double>(0, 2);
+  const double cy = view_k.at<double>(1, 2);
+  view_k.at<double>(0, 0) *= scale;
+  view_k.at<double>(1, 1) *= scale;
+  view_k.at<double>(0, 2) = (cx - roi.x + 0.5) * scale - 0.5;
+  view_k.at<double>(1, 2) = (cy - roi.y + 0.5) * scale - 0.5;
+  const cv::Size view_size(cvRound(roi.width * scale),
+                           cvRound(roi.height * scale));
+
+  boost::shared_ptr<UndistortMap> undistort(new UndistortMap());
+  cv::Mat R = cv::Mat::eye(3, 3, CV_32F);
+  initUndistortRectifyMap(cameras_k_[pic_id], cameras_d_[pic_id], R, view_k,
+                          view_size, CV_16SC2, undistort->map1,
+                          undistort->map2);
+
+  pthread_mutex_lock(&stream.pic_lock);
+  stream.undistort = undistort;
+  pthread_mutex_unlock(&stream.pic_lock);
 }
 
-void PandoraCamera::yuv422ToCvmat(boost::shared_ptr<cv::Mat> dst,
-                                  const void *pYUV422, const int nWidth,
-                                  const int nHeight, const int bitDepth) {
+void PandoraCamera::yuv422ToCvmat(cv::Mat *dst, const void *pYUV422,
+                                  const int nWidth, const int nHeight,
+                                  const int bitDepth) {
   if (!pYUV422) {
     return;
   }
-  unsigned char *rgb24_buffer = new unsigned char[nWidth * nHeight * 3];
-  yuv422ToRgb24((unsigned char *)pYUV422, rgb24_buffer, nWidth, nHeight);
-  *dst = cv::Mat(nHeight, nWidth, CV_8UC3, rgb24_buffer).clone();
-  delete[] rgb24_buffer;
+  dst->create(nHeight, nWidth, CV_8UC3);
+  Yuv422ToRgb24(static_cast<const uint8_t *>(pYUV422), dst->data,
+                nWidth * nHeight);
 }
 
-static void my_output_message(j_common_ptr ptr) { return; }
-
 static void print_mem(unsigned char *mem, unsigned int size) {
   int i = 0;
   for (i = 0; i < size; i++) {
@@ -257,43 +361,24 @@ static void print_mem(unsigned char *mem, unsigned int size) {
   printf("\n");
 }
 
-int PandoraCamera::decompressJpeg(uint8_t *jpgBuffer, const uint32_t jpgSize,
-                                  uint8_t **bmp, uint32_t *bmpSize) {
-  struct jpeg_decompress_struct cinfo;
-  struct jpeg_error_mgr jerr;
-  uint8_t *bmpBuffer;
-  int rowStride, width, height, pixelSize;
-
-  cinfo.err = jpeg_std_error(&jerr);
-  cinfo.err->output_message = my_output_message;
-  cinfo.err->error_exit = my_output_message;
-
-  jpeg_create_decompress(&cinfo);
-  jpeg_mem_src(&cinfo, jpgBuffer, jpgSize);
-
-  int rc = jpeg_read_header(&cinfo, TRUE);
-  if (rc != 1) {
+int PandoraCamera::decompressJpeg(tjhandle decompressor, uint8_t *jpgBuffer,
+                                  const uint32_t jpgSize, cv::Mat *dst) {
+  int width, height, subsamp, colorspace;
+  if (!decompressor) {
+    return -1;
+  }
+  if (tjDecompressHeader3(decompressor, jpgBuffer, jpgSize, &width, &height,
+                          &subsamp, &colorspace) != 0) {
+    printf("decompressJpeg, %s\n", tjGetErrorStr());
     return -1;
   }
 
-  jpeg_start_decompress(&cinfo);
-
-  width = cinfo.output_width;
-  height = cinfo.output_height;
-  pixelSize = cinfo.output_components;
-  *bmpSize = width * height * pixelSize;
-  bmpBuffer = (unsigned char *)malloc(*bmpSize);
-  rowStride = width * pixelSize;
-
-  while (cinfo.output_scanline < cinfo.output_height) {
-    unsigned char *buffer_array[1];
-    buffer_array[0] = bmpBuffer + (cinfo.output_scanline) * rowStride;
-
-    jpeg_read_scanlines(&cinfo, buffer_array, 1);
+  dst->create(height, width, CV_8UC3);
+  if (tjDecompress2(decompressor, jpgBuffer, jpgSize, dst->data, width,
+                    static_cast<int>(dst->step), height, TJPF_RGB, 0) != 0) {
+    printf("decompressJpeg, %s\n", tjGetErrorStr());
+    return -1;
   }
-  *bmp = bmpBuffer;
-  jpeg_finish_decompress(&cinfo);
-  jpeg_destroy_decompress(&cinfo);
   return 0;
 }
 
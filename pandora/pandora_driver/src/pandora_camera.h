@@ -18,11 +18,13 @@
 #define SRC_PANDORA_CAMERA_H_
 
 #include <boost/function.hpp>
+#include <boost/thread.hpp>
 #include <opencv2/opencv.hpp>
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <turbojpeg.h>
 
 #include <list>
 #include <string>
@@ -37,6 +39,8 @@ namespace hesai {
 #define CAMERA_NUM 5
 #define IMAGE_WIDTH 1280
 #define IMAGE_HEIGHT 720
+// output images per camera recycled once the callback released them
+#define CAMERA_IMAGE_POOL_SIZE 3
 
 class PandoraCamera {
  public:
@@ -65,36 +69,101 @@ class PandoraCamera {
   bool loadIntrinsics(const std::vector<cv::Mat> &cameras_k,
                       const std::vector<cv::Mat> &cameras_d);
 
+  /**
+   * @brief publish only part of the undistorted picture of a camera
+   * @param pic_id The camera
+   *        roi    The crop of the full size undistorted picture
+   *        scale  Output size relative to roi, in (0, 1]
+   */
+  bool setUndistortedView(int pic_id, const cv::Rect &roi, double scale);
+
+  /**
+   * @brief start one decode thread per camera, camera_callback is called
+   *        from these threads, in order for each camera. The image is
+   *        reused once the callback released it, clone() it to keep the
+   *        pixels.
+   */
   int Start();
   void Stop();
-  void pushPicture(PandoraPic *pic);
+  /**
+   * @brief queue a picture of the client for its decode thread
+   * @return false if the caller has to release the picture itself
+   */
+  bool pushPicture(PandoraPic *pic);
+
+  /**
+   * @brief received, dropped and discarded pictures of all cameras
+   */
+  PandoraClientStats getStats() const;
+
+  /**
+   * @brief undistort camera 0 while converting it from UYVY, instead of
+   *        converting it first and remapping the result with OpenCV
+   */
+  void setFusedYuvRemap(bool fused);
+
+  /**
+   * @brief let the caller provide the output images, e.g. the data buffer of
+   *        the message that will carry it, instead of the pooled ones. It is
+   *        called from the decode thread of the camera and has to return a
+   *        continuous width x height CV_8UC3 image.
+   */
+  void setImageAllocator(
+      boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                                 int height)>
+          allocator);
 
  private:
-  void processPic();
-
-  int decompressJpeg(uint8_t *jpgBuffer, const uint32_t jpgSize, uint8_t **bmp,
-                     uint32_t *bmpSize);
-  void yuv422ToCvmat(boost::shared_ptr<cv::Mat> dst, const void *pYUV422,
-                     const int nWidth, const int nHeight, const int bitDepth);
-  void yuv422ToRgb24(const uint8_t *uyvy422, uint8_t *rgb24, const int width,
-                     const int height);
-  void yuvToRgb(const int iY, const int iU, const int iV, int *iR, int *iG,
-                int *iB);
-
-  pthread_mutex_t pic_lock_;
-  sem_t pic_sem_;
-  boost::thread *process_pic_thread_;
+  /**
+   * @brief fixed point undistortion maps, as made by cv::convertMaps
+   */
+  struct UndistortMap {
+    cv::Mat map1;  // CV_16SC2, integer source position
+    cv::Mat map2;  // CV_16UC1, index into the interpolation table
+  };
+
+  /**
+   * @brief the pictures of one camera, decoded by a thread of its own
+   */
+  struct CameraStream {
+    pthread_mutex_t pic_lock;
+    sem_t pic_sem;
+    std::list<PandoraPic *> pic_list;
+    boost::thread *thread;
+    tjhandle decompressor;
+    // decoded picture when it still has to be undistorted
+    cv::Mat decoded;
+    std::vector<boost::shared_ptr<cv::Mat> > image_pool;
+    // NULL until the intrinsics are loaded, swapped under pic_lock
+    boost::shared_ptr<const UndistortMap> undistort;
+    cv::Rect view_roi;
+    double view_scale;
+  };
+
+  void processPic(int pic_id);
+  boost::shared_ptr<cv::Mat> acquireImage(int pic_id, const cv::Size &size);
+  void clearPictures(CameraStream *stream);
+  void buildUndistortMap(int pic_id);
+
+  int decompressJpeg(tjhandle decompressor, uint8_t *jpgBuffer,
+                     const uint32_t jpgSize, cv::Mat *dst);
+  void yuv422ToCvmat(cv::Mat *dst, const void *pYUV422, const int nWidth,
+                     const int nHeight, const int bitDepth);
+
+  CameraStream streams_[CAMERA_NUM];
   bool continue_process_pic_;
-  bool need_remap_;
+  bool fused_yuv_remap_;
   std::string ip_;
   uint16_t camera_port_;
   void *pandora_client_;
-  std::list<PandoraPic *> pic_list_;
-  std::vector<cv::Mat> mapx_;
-  std::vector<cv::Mat> mapy_;
+  std::vector<cv::Mat> cameras_k_;
+  std::vector<cv::Mat> cameras_d_;
   boost::function<void(boost::shared_ptr<cv::Mat> matp, double timestamp,
                        int pic_id, bool distortion)>
       camera_callback_;
+  boost::function<boost::shared_ptr<cv::Mat>(int pic_id, int width,
+                                             int height)>
+      image_allocator_;
   boost::function<void(bool connected)> connection_changed_;
 
   int tz_second_;
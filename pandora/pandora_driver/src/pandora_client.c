@@ -26,16 +26,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/epoll.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <syslog.h>
 #include <unistd.h>
 
 #include "src/pandora_client.h"
 #include "src/util.h"
 
+/* seconds without any data before reconnecting */
+#define PANDORA_CLIENT_IDLE_TIMEOUT (5)
+#define PANDORA_CLIENT_RCVBUF_SIZE (4 * 1024 * 1024)
+
 typedef struct _PandoraClient_s {
   pthread_mutex_t cliSocketLock;
   int cliSocket;
@@ -53,6 +59,22 @@ typedef struct _PandoraClient_s {
   unsigned int position[PANDORA_CAMERA_UNIT];
   unsigned int startTimestamp[PANDORA_CAMERA_UNIT];
   PandoraPic* pics[PANDORA_CAMERA_UNIT];
+
+  /* fixed picture pool, a free list per camera */
+  pthread_mutex_t poolLock;
+  char* poolMemory;
+  PandoraPic pool[PANDORA_CAMERA_UNIT][PANDORA_CLIENT_PICS_PER_CAMERA];
+  PandoraPic* freePics[PANDORA_CAMERA_UNIT][PANDORA_CLIENT_PICS_PER_CAMERA];
+  int freeCount[PANDORA_CAMERA_UNIT];
+  PandoraClientStats stats;
+
+  /* receive state of the fragment on the wire */
+  char header[PANDORA_CLIENT_HEADER_SIZE];
+  int headerRead;
+  PandoraPicHeader fragment;
+  char* payload; /* where the fragment goes, NULL to skip it */
+  unsigned int payloadRead;
+  char scratch[64 * 1024];
 } PandoraClient;
 
 void PandoraClientTask(void* handle);
@@ -106,6 +128,213 @@ void parseHeader(char* header, int len, PandoraPicHeader* picHeader) {
   picHeader->UTC_Time.UTC_Second = header[index];
 #endif
 }
+
+static PandoraPic* PandoraClientAcquirePic(PandoraClient* client, int picId) {
+  PandoraPic* pic = NULL;
+  pthread_mutex_lock(&client->poolLock);
+  if (client->freeCount[picId] > 0) {
+    pic = client->freePics[picId][--client->freeCount[picId]];
+  } else {
+    client->stats.dropped++;
+  }
+  pthread_mutex_unlock(&client->poolLock);
+  return pic;
+}
+
+static void PandoraClientDiscardPic(PandoraClient* client, int picId) {
+  PandoraClientReleasePic(client, client->pics[picId]);
+  client->pics[picId] = NULL;
+  client->position[picId] = 0;
+  pthread_mutex_lock(&client->poolLock);
+  client->stats.discarded++;
+  pthread_mutex_unlock(&client->poolLock);
+}
+
+/*
+ * A fragment header is complete, find out where its payload goes.
+ * Returns -1 if the stream is out of sync.
+ */
+static int PandoraClientBeginFragment(PandoraClient* client) {
+  PandoraPicHeader* fragment = &client->fragment;
+  parseHeader(client->header, PANDORA_CLIENT_HEADER_SIZE, fragment);
+  client->payload = NULL;
+  client->payloadRead = 0;
+
+  if (fragment->SOP[0] != 0x47 || fragment->SOP[1] != 0x74) {
+    printf("InValid Header SOP\n");
+    printf("%02x %02x \n", fragment->SOP[0], fragment->SOP[1]);
+    return -1;
+  }
+
+  // check frame id
+  int picId = fragment->pic_id;
+  if (picId >= PANDORA_CAMERA_UNIT) {
+    return 0;
+  }
+
+  if (fragment->position == 0) {
+    // a new frame, the slot of an unfinished one is reused
+    if (client->pics[picId]) {
+      pthread_mutex_lock(&client->poolLock);
+      client->stats.discarded++;
+      pthread_mutex_unlock(&client->poolLock);
+    } else {
+      client->pics[picId] = PandoraClientAcquirePic(client, picId);
+      if (!client->pics[picId]) {
+        // the consumer is behind, skip the whole frame
+        return 0;
+      }
+    }
+    if (fragment->totalLen > PANDORA_CLIENT_MAX_PIC_SIZE) {
+      printf("picLength wrong\n");
+      PandoraClientDiscardPic(client, picId);
+      return 0;
+    }
+    void* yuv = client->pics[picId]->yuv;
+    memcpy(&client->pics[picId]->header, fragment, sizeof(PandoraPicHeader));
+    client->pics[picId]->yuv = yuv;
+    client->position[picId] = 0;
+    client->startTimestamp[picId] = fragment->timestamp;
+  } else if (!client->pics[picId]) {
+    // the rest of a skipped frame
+    return 0;
+  } else if (fragment->position != client->position[picId]) {
+    // check the desired frame position packet.
+    PandoraClientDiscardPic(client, picId);
+    return 0;
+  }
+
+  if (fragment->position + fragment->len >
+      client->pics[picId]->header.totalLen) {
+    printf("picLength wrong\n");
+    PandoraClientDiscardPic(client, picId);
+    return 0;
+  }
+  client->payload = (char*)client->pics[picId]->yuv + fragment->position;
+  return 0;
+}
+
+static void PandoraClientEndFragment(PandoraClient* client) {
+  PandoraPicHeader* fragment = &client->fragment;
+  if (!client->payload) {
+    return;
+  }
+  int picId = fragment->pic_id;
+  PandoraPic* pic = client->pics[picId];
+  client->position[picId] += fragment->len;
+  if (client->position[picId] != pic->header.totalLen) {
+    return;
+  }
+
+  // a whole frame
+  pic->header.len = pic->header.totalLen;
+  pic->header.timestamp = fragment->timestamp;
+  pic->header.UTC_Time = fragment->UTC_Time;
+  client->pics[picId] = NULL;
+  client->position[picId] = 0;
+  pthread_mutex_lock(&client->poolLock);
+  client->stats.frames++;
+  pthread_mutex_unlock(&client->poolLock);
+  if (client->callback) {
+    client->callback(client, 0, pic, client->userp);
+  } else {
+    PandoraClientReleasePic(client, pic);
+  }
+}
+
+static int PandoraClientHeaderDone(PandoraClient* client) {
+  if (PandoraClientBeginFragment(client) != 0) {
+    return -1;
+  }
+  if (client->fragment.len == 0) {
+    PandoraClientEndFragment(client);
+    client->headerRead = 0;
+  }
+  return 0;
+}
+
+/*
+ * Read whatever the socket has. The payload goes straight into its pool
+ * picture and the header of the next fragment comes with the same readv().
+ * Returns -1 when the connection has to be reopened.
+ */
+static int PandoraClientReceive(PandoraClient* client, int fd) {
+  while (!client->exit) {
+    struct iovec iov[2];
+    int iovcnt = 1;
+    unsigned int left = 0;
+    if (client->headerRead < PANDORA_CLIENT_HEADER_SIZE) {
+      iov[0].iov_base = client->header + client->headerRead;
+      iov[0].iov_len = PANDORA_CLIENT_HEADER_SIZE - client->headerRead;
+    } else {
+      left = client->fragment.len - client->payloadRead;
+      if (client->payload) {
+        iov[0].iov_base = client->payload + client->payloadRead;
+        iov[0].iov_len = left;
+      } else {
+        iov[0].iov_base = client->scratch;
+        iov[0].iov_len =
+            left < sizeof(client->scratch) ? left : sizeof(client->scratch);
+      }
+      if (iov[0].iov_len == left) {
+        iov[1].iov_base = client->header;
+        iov[1].iov_len = PANDORA_CLIENT_HEADER_SIZE;
+        iovcnt = 2;
+      }
+    }
+
+    ssize_t n = readv(fd, iov, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      printf("Read Error\n");
+      return -1;
+    }
+    if (n == 0) {
+      printf("Camera: connection closed\n");
+      return -1;
+    }
+
+    if (client->headerRead < PANDORA_CLIENT_HEADER_SIZE) {
+      client->headerRead += n;
+      if (client->headerRead == PANDORA_CLIENT_HEADER_SIZE &&
+          PandoraClientHeaderDone(client) != 0) {
+        return -1;
+      }
+      continue;
+    }
+
+    unsigned int payload = (size_t)n < iov[0].iov_len ? n : iov[0].iov_len;
+    client->payloadRead += payload;
+    if (payload == left) {
+      PandoraClientEndFragment(client);
+      client->headerRead = n - payload;
+      if (client->headerRead == PANDORA_CLIENT_HEADER_SIZE &&
+          PandoraClientHeaderDone(client) != 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void PandoraClientDisconnect(PandoraClient* client, int epfd) {
+  int i;
+  epoll_ctl(epfd, EPOLL_CTL_DEL, client->cliSocket, NULL);
+  pthread_mutex_lock(&client->cliSocketLock);
+  close(client->cliSocket);
+  client->cliSocket = -1;
+  pthread_mutex_unlock(&client->cliSocketLock);
+
+  client->headerRead = 0;
+  client->payload = NULL;
+  for (i = 0; i < PANDORA_CAMERA_UNIT; ++i) {
+    if (client->pics[i]) {
+      PandoraClientDiscardPic(client, i);
+    }
+  }
+}
+
 void* PandoraClientNew(const char* ip, int port, CallBack callback,
                        void* userp) {
   if (!ip || !callback || !userp) {
@@ -114,6 +343,7 @@ void* PandoraClientNew(const char* ip, int port, CallBack callback,
   }
 
   int ret = 0;
+  int i, j;
 
   PandoraClient* client = (PandoraClient*)malloc(sizeof(PandoraClient));
   if (!client) {
@@ -125,15 +355,38 @@ void* PandoraClientNew(const char* ip, int port, CallBack callback,
   client->callback = callback;
   client->userp = userp;
   client->cliSocket = -1;
-  client->ip = strdup(ip);
   client->port = port;
 
+  // every picture buffer is allocated once, for the largest picture
+  client->poolMemory = (char*)malloc((size_t)PANDORA_CAMERA_UNIT *
+                                     PANDORA_CLIENT_PICS_PER_CAMERA *
+                                     PANDORA_CLIENT_MAX_PIC_SIZE);
+  if (!client->poolMemory) {
+    printf("No Memory\n");
+    free(client);
+    return NULL;
+  }
+  for (i = 0; i < PANDORA_CAMERA_UNIT; ++i) {
+    for (j = 0; j < PANDORA_CLIENT_PICS_PER_CAMERA; ++j) {
+      client->pool[i][j].yuv =
+          client->poolMemory +
+          ((size_t)i * PANDORA_CLIENT_PICS_PER_CAMERA + j) *
+              PANDORA_CLIENT_MAX_PIC_SIZE;
+      client->freePics[i][j] = &client->pool[i][j];
+    }
+    client->freeCount[i] = PANDORA_CLIENT_PICS_PER_CAMERA;
+  }
+  client->ip = strdup(ip);
+
   pthread_mutex_init(&client->cliSocketLock, NULL);
+  pthread_mutex_init(&client->poolLock, NULL);
 
   ret = pthread_create(&client->receiveTask, NULL, (void*)PandoraClientTask,
                        (void*)client);
   if (ret != 0) {
     printf("Create Task Failed\n");
+    free(client->poolMemory);
+    free(client->ip);
     free(client);
     return NULL;
   }
@@ -144,6 +397,8 @@ void* PandoraClientNew(const char* ip, int port, CallBack callback,
     printf("Create heart beat Task Failed\n");
     client->exit = 1;
     pthread_join(client->receiveTask, NULL);
+    free(client->poolMemory);
+    free(client->ip);
     free(client);
     return NULL;
   }
@@ -160,10 +415,42 @@ void PandoraClientDestroy(void* handle) {
   client->exit = 1;
   pthread_join(client->heartBeatTask, NULL);
   pthread_join(client->receiveTask, NULL);
-  close(client->cliSocket);
+  if (client->cliSocket != -1) {
+    close(client->cliSocket);
+  }
+  pthread_mutex_destroy(&client->cliSocketLock);
+  pthread_mutex_destroy(&client->poolLock);
+  free(client->poolMemory);
+  free(client->ip);
   free(client);
 }
 
+void PandoraClientReleasePic(void* handle, PandoraPic* pic) {
+  PandoraClient* client = (PandoraClient*)handle;
+  if (!client || !pic) {
+    printf("Bad Parameter\n");
+    return;
+  }
+
+  // the camera of a pool picture is given by its row, not by its header
+  int picId = (pic - &client->pool[0][0]) / PANDORA_CLIENT_PICS_PER_CAMERA;
+  pthread_mutex_lock(&client->poolLock);
+  client->freePics[picId][client->freeCount[picId]++] = pic;
+  pthread_mutex_unlock(&client->poolLock);
+}
+
+void PandoraClientGetStats(void* handle, PandoraClientStats* stats) {
+  PandoraClient* client = (PandoraClient*)handle;
+  if (!client || !stats) {
+    printf("Bad Parameter\n");
+    return;
+  }
+
+  pthread_mutex_lock(&client->poolLock);
+  *stats = client->stats;
+  pthread_mutex_unlock(&client->poolLock);
+}
+
 void PandoraClientHeartBeatTask(void* handle) {
   PandoraClient* client = (PandoraClient*)handle;
   if (!client) {
@@ -196,7 +483,14 @@ void PandoraClientTask(void* handle) {
     return;
   }
 
+  int epfd = epoll_create(1);
+  if (epfd < 0) {
+    printf("Create epoll failed\n");
+    return;
+  }
+
   int connfd = client->cliSocket;
+  int idle = 0;
 
   while (!client->exit) {
     if (client->cliSocket == -1) {
@@ -207,142 +501,53 @@ void PandoraClientTask(void* handle) {
         sleep(1);
         continue;
       }
+      int rcvbuf = PANDORA_CLIENT_RCVBUF_SIZE;
+      setsockopt(connfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+      fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) | O_NONBLOCK);
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.fd = connfd;
+      if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &event) < 0) {
+        printf("Add socket to epoll failed\n");
+        close(connfd);
+        sleep(1);
+        continue;
+      }
       pthread_mutex_lock(&client->cliSocketLock);
       client->cliSocket = connfd;
       pthread_mutex_unlock(&client->cliSocketLock);
       printf("Camera: connect to server successfully!\n");
-      struct timeval tv;
-      tv.tv_sec = 5;   /* 5 Secs Timeout */
-      tv.tv_usec = 0;  // Not init'ing this can cause strange errors
-      setsockopt(client->cliSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv,
-                 sizeof(struct timeval));
-      connfd = client->cliSocket;
+      idle = 0;
     }
 
-    int ret = 0;
-    // printf("start select_fd for read\n");
-    ret = select_fd(connfd, 1, WAIT_FOR_READ);
-    if (ret == 0) {
-      printf("select for read wrong\n");
-      pthread_mutex_lock(&client->cliSocketLock);
-      close(client->cliSocket);
-      client->cliSocket = -1;
-      pthread_mutex_unlock(&client->cliSocketLock);
-      sleep(5);
+    struct epoll_event event;
+    int ret = epoll_wait(epfd, &event, 1, 1000);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      printf("epoll_wait wrong\n");
+      PandoraClientDisconnect(client, epfd);
+      sleep(1);
       continue;
-    } else if (ret > 0) {
-      char header[64];
-      int n = sys_readn(connfd, header, 2);
-      if (n < 0) {
-        printf("read header wrong!\n");
-        pthread_mutex_lock(&client->cliSocketLock);
-        close(client->cliSocket);
-        client->cliSocket = -1;
-        pthread_mutex_unlock(&client->cliSocketLock);
-        continue;
-      }
-
-      if (header[0] != 0x47 || header[1] != 0x74) {
-        printf("InValid Header SOP\n");
-        printf("%02x %02x \n", header[0], header[1]);
-        exit(0);
-        continue;
-      }
-
-      n = sys_readn(connfd, header + 2, PANDORA_CLIENT_HEADER_SIZE - 2);
-      if (n <= 0) {
-        printf("read header2 wrong!\n");
-        pthread_mutex_lock(&client->cliSocketLock);
-        close(client->cliSocket);
-        client->cliSocket = -1;
-        pthread_mutex_unlock(&client->cliSocketLock);
-        continue;
-      }
-      PandoraPic* pic = (PandoraPic*)malloc(sizeof(PandoraPic));
-      if (!pic) {
-        printf("No Memory\n");
-        continue;
-      }
-
-      parseHeader(header, n + 2, &pic->header);
-
-      pic->yuv = malloc(pic->header.len);
-      if (!pic->yuv) {
-        printf("No Memory\n");
-        free(pic);
-        continue;
-      }
-
-      n = sys_readn(connfd, pic->yuv, pic->header.len);
-      if (n <= 0) {
-        printf("read pic_yuv wrong!\n");
-        pthread_mutex_lock(&client->cliSocketLock);
-        close(client->cliSocket);
-        client->cliSocket = -1;
-        pthread_mutex_unlock(&client->cliSocketLock);
-        continue;
-      }
-      if (n != pic->header.len) {
-        printf("picLength wrong\n");
-        free(pic->yuv);
-        free(pic);
-        continue;
-      }
-
-      // check frame id
-      if (pic->header.pic_id < 0 || pic->header.pic_id >= PANDORA_CAMERA_UNIT) {
-        free(pic->yuv);
-        free(pic);
-        continue;
-      }
-
-      // check the desired frame position packet.
-      if (pic->header.position != client->position[pic->header.pic_id]) {
-        client->position[pic->header.pic_id] = 0;
-        free(pic->yuv);
-        free(pic);
-        continue;
-      }
-
-      if (!client->pics[pic->header.pic_id]) {
-        client->pics[pic->header.pic_id] = malloc(sizeof(PandoraPic));
-        memcpy(client->pics[pic->header.pic_id], pic, sizeof(PandoraPic));
-        client->pics[pic->header.pic_id]->yuv = malloc(pic->header.totalLen);
-      }
-
-      memcpy(client->pics[pic->header.pic_id]->yuv +
-                 client->position[pic->header.pic_id],
-             pic->yuv, pic->header.len);
-
-      if (client->position[pic->header.pic_id] == 0) {
-        client->startTimestamp[pic->header.pic_id] = pic->header.timestamp;
-      }
-
-      client->position[pic->header.pic_id] += pic->header.len;
-
-      if (client->position[pic->header.pic_id] == pic->header.totalLen) {
-        client->pics[pic->header.pic_id]->header.len = pic->header.totalLen;
-        client->pics[pic->header.pic_id]->header.timestamp =
-            pic->header.timestamp;
-        client->pics[pic->header.pic_id]->header.UTC_Time =
-            pic->header.UTC_Time;
-        // a whole frame
-        if (client->callback)
-          client->callback(client, 0, client->pics[pic->header.pic_id],
-                           client->userp);
-        client->pics[pic->header.pic_id] = NULL;
-        client->position[pic->header.pic_id] = 0;
+    }
+    if (ret == 0) {
+      if (++idle >= PANDORA_CLIENT_IDLE_TIMEOUT) {
+        printf("Camera: no data for %d seconds\n", idle);
+        PandoraClientDisconnect(client, epfd);
       }
-      free(pic->yuv);
-      free(pic);
+      continue;
+    }
 
-    } else {
-      printf("Read Error\n");
-      pthread_mutex_lock(&client->cliSocketLock);
-      close(client->cliSocket);
-      client->cliSocket = -1;
-      pthread_mutex_unlock(&client->cliSocketLock);
+    idle = 0;
+    if (PandoraClientReceive(client, connfd) != 0 ||
+        (event.events & (EPOLLERR | EPOLLHUP))) {
+      PandoraClientDisconnect(client, epfd);
       continue;
     }
   }
+
+  if (client->cliSocket != -1) {
+    PandoraClientDisconnect(client, epfd);
+  }
+  close(epfd);
 }
@@ -22,6 +22,10 @@ extern "C" {
 #endif
 
 #define PANDORA_CAMERA_UNIT (5)
+/* the largest picture, a 1280x720 YUV422 one */
+#define PANDORA_CLIENT_MAX_PIC_SIZE (1280 * 720 * 2)
+/* pictures of a camera that can be received or decoded at the same time */
+#define PANDORA_CLIENT_PICS_PER_CAMERA (3)
 
 #define UTC_TIME
 #ifdef UTC_TIME
@@ -60,11 +64,24 @@ typedef struct _PandoraPic {
 #define PANDORA_CLIENT_HEADER_SIZE (28)
 #endif
 
+typedef struct _PandoraClientStats_s {
+  unsigned long long frames;    /* whole pictures handed to the callback */
+  unsigned long long dropped;   /* pictures skipped, every buffer in use */
+  unsigned long long discarded; /* pictures with lost or bad fragments */
+} PandoraClientStats;
+
+/*
+ * The callback owns the PandoraPic it gets until it hands it back with
+ * PandoraClientReleasePic(). The pictures live in a fixed pool of the client,
+ * so they have to be released before PandoraClientDestroy().
+ */
 typedef int (*CallBack)(void* handle, int cmd, void* param, void* userp);
 
 void* PandoraClientNew(const char* ip, int port, CallBack callback,
                        void* userp);
 void PandoraClientDestroy(void* handle);
+void PandoraClientReleasePic(void* handle, PandoraPic* pic);
+void PandoraClientGetStats(void* handle, PandoraClientStats* stats);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,183 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "src/yuv422_rgb.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+
+namespace apollo {
+namespace drivers {
+namespace hesai {
+
+// coefficients scaled by 1 << YUV_FIX_BITS
+static const int kYuvOne = 1 << YUV_FIX_BITS;
+static const int kRV = 9338;
+static const int kGU = 3233;
+static const int kGV = 4756;
+static const int kBU = 16647;
+
+// remap sample positions have 1/32 pixel resolution, like OpenCV's
+// INTER_BITS
+static const int kRemapBits = 5;
+static const int kRemapSize = 1 << kRemapBits;
+
+static inline uint8_t clamp8(int v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline void yuvPixel(int y, int u, int v, uint8_t *rgb) {
+  const int luma = y << YUV_FIX_BITS;
+  rgb[0] = clamp8((luma + kBU * u) >> YUV_FIX_BITS);
+  rgb[1] = clamp8((luma - kGU * u - kGV * v) >> YUV_FIX_BITS);
+  rgb[2] = clamp8((luma + kRV * v) >> YUV_FIX_BITS);
+}
+
+void Yuv422ToRgb24Scalar(const uint8_t *uyvy422, uint8_t *rgb24,
+                         int pixels) {
+  for (int i = 0; i < pixels; i += 2) {
+    const int u = uyvy422[0] - 128;
+    const int v = uyvy422[2] - 128;
+    yuvPixel(uyvy422[1], u, v, rgb24);
+    yuvPixel(uyvy422[3], u, v, rgb24 + 3);
+    uyvy422 += 4;
+    rgb24 += 6;
+  }
+}
+
+#ifdef __SSE2__
+/**
+ * @brief B, G and R of 4 pixels, from the UYVY bytes of 2 pixel pairs
+ *        widened to 16 bits
+ */
+static inline void yuvPixels4(__m128i uyvy, __m128i *b, __m128i *g,
+                              __m128i *r) {
+  // pair every Y with the V, or the U, of its pixel pair, then one
+  // multiply-add per pixel computes Y * kYuvOne + c * chroma
+  const __m128i chroma_bias = _mm_set_epi16(128, 0, 128, 0, 128, 0, 128, 0);
+  __m128i yv = _mm_shufflelo_epi16(uyvy, _MM_SHUFFLE(2, 3, 2, 1));
+  yv = _mm_sub_epi16(_mm_shufflehi_epi16(yv, _MM_SHUFFLE(2, 3, 2, 1)),
+                     chroma_bias);
+  __m128i yu = _mm_shufflelo_epi16(uyvy, _MM_SHUFFLE(0, 3, 0, 1));
+  yu = _mm_sub_epi16(_mm_shufflehi_epi16(yu, _MM_SHUFFLE(0, 3, 0, 1)),
+                     chroma_bias);
+
+  const __m128i r_coef =
+      _mm_set_epi16(kRV, kYuvOne, kRV, kYuvOne, kRV, kYuvOne, kRV, kYuvOne);
+  const __m128i b_coef =
+      _mm_set_epi16(kBU, kYuvOne, kBU, kYuvOne, kBU, kYuvOne, kBU, kYuvOne);
+  const __m128i gu_coef = _mm_set_epi16(-kGU, kYuvOne, -kGU, kYuvOne, -kGU,
+                                        kYuvOne, -kGU, kYuvOne);
+  const __m128i gv_coef = _mm_set_epi16(-kGV, 0, -kGV, 0, -kGV, 0, -kGV, 0);
+
+  *r = _mm_srai_epi32(_mm_madd_epi16(yv, r_coef), YUV_FIX_BITS);
+  *b = _mm_srai_epi32(_mm_madd_epi16(yu, b_coef), YUV_FIX_BITS);
+  *g = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu, gu_coef),
+                                    _mm_madd_epi16(yv, gv_coef)),
+                      YUV_FIX_BITS);
+}
+
+/**
+ * @brief store 4 pixels held as B, G, R, 0 bytes as 12 bytes, writes 14
+ */
+static inline void storePixels4(uint8_t *rgb24, __m128i bgr0) {
+  const __m128i low = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+  const __m128i high = _mm_set_epi32(0xffff, 0xff000000, 0xffff, 0xff000000);
+  const __m128i packed = _mm_or_si128(
+      _mm_and_si128(bgr0, low), _mm_and_si128(_mm_srli_epi64(bgr0, 8), high));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(rgb24), packed);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(rgb24 + 6),
+                   _mm_unpackhi_epi64(packed, packed));
+}
+#endif
+
+void Yuv422ToRgb24(const uint8_t *uyvy422, uint8_t *rgb24, int pixels) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  // 8 pixels per step, the last store writes 2 bytes past the 8th pixel so
+  // the final pixels are left to the scalar loop
+  for (; i + 10 <= pixels; i += 8) {
+    const __m128i uyvy =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(uyvy422 + 2 * i));
+    __m128i b_lo, g_lo, r_lo, b_hi, g_hi, r_hi;
+    yuvPixels4(_mm_unpacklo_epi8(uyvy, zero), &b_lo, &g_lo, &r_lo);
+    yuvPixels4(_mm_unpackhi_epi8(uyvy, zero), &b_hi, &g_hi, &r_hi);
+
+    // saturate to 0..255, the low 8 bytes hold the 8 pixels
+    const __m128i b = _mm_packus_epi16(_mm_packs_epi32(b_lo, b_hi), zero);
+    const __m128i g = _mm_packus_epi16(_mm_packs_epi32(g_lo, g_hi), zero);
+    const __m128i r = _mm_packus_epi16(_mm_packs_epi32(r_lo, r_hi), zero);
+
+    const __m128i bg = _mm_unpacklo_epi8(b, g);
+    const __m128i r0 = _mm_unpacklo_epi8(r, zero);
+    storePixels4(rgb24 + 3 * i, _mm_unpacklo_epi16(bg, r0));
+    storePixels4(rgb24 + 3 * i + 12, _mm_unpackhi_epi16(bg, r0));
+  }
+#endif
+  Yuv422ToRgb24Scalar(uyvy422 + 2 * i, rgb24 + 3 * i, pixels - i);
+}
+
+void Yuv422ToRgb24Remap(const uint8_t *uyvy422, int width, int height,
+                        const cv::Mat &map1, const cv::Mat &map2,
+                        cv::Mat *dst) {
+  dst->create(map1.rows, map1.cols, CV_8UC3);
+  const uint8_t black[3] = {0, 0, 0};
+
+  for (int row = 0; row < map1.rows; ++row) {
+    const int16_t *xy = map1.ptr<int16_t>(row);
+    const uint16_t *fraction = map2.ptr<uint16_t>(row);
+    uint8_t *out = dst->ptr<uint8_t>(row);
+
+    for (int col = 0; col < map1.cols; ++col, out += 3) {
+      const int x0 = xy[2 * col];
+      const int y0 = xy[2 * col + 1];
+      const int ax = fraction[col] & (kRemapSize - 1);
+      const int ay = (fraction[col] >> kRemapBits) & (kRemapSize - 1);
+      const int weight[4] = {
+          (kRemapSize - ax) * (kRemapSize - ay), ax * (kRemapSize - ay),
+          (kRemapSize - ax) * ay, ax * ay};
+
+      // the 2x2 neighbourhood, converted on the fly
+      uint8_t rgb[4][3];
+      for (int k = 0; k < 4; ++k) {
+        const int x = x0 + (k & 1);
+        const int y = y0 + (k >> 1);
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+          std::copy(black, black + 3, rgb[k]);
+          continue;
+        }
+        const uint8_t *pair = uyvy422 + 2 * (y * width + (x & ~1));
+        yuvPixel(pair[1 + 2 * (x & 1)], pair[0] - 128, pair[2] - 128,
+                 rgb[k]);
+      }
+
+      for (int c = 0; c < 3; ++c) {
+        const int sum = rgb[0][c] * weight[0] + rgb[1][c] * weight[1] +
+                        rgb[2][c] * weight[2] + rgb[3][c] * weight[3];
+        out[c] = static_cast<uint8_t>(
+            (sum + (1 << (2 * kRemapBits - 1))) >> (2 * kRemapBits));
+      }
+    }
+  }
+}
+
+}  // namespace hesai
+}  // namespace drivers
+}  // namespace apollo
@@ -0,0 +1,65 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef SRC_YUV422_RGB_H_
+#define SRC_YUV422_RGB_H_
+
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+
+namespace apollo {
+namespace drivers {
+namespace hesai {
+
+/**
+ * Conversion of the UYVY 4:2:2 pictures of camera 0 into 8 bit, 3 channel
+ * pictures stored B, G, R, as the camera always did. The colour math is
+ * fixed point with YUV_FIX_BITS fraction bits:
+ *   R = Y + 1.13983 (V - 128)
+ *   G = Y - 0.39465 (U - 128) - 0.58060 (V - 128)
+ *   B = Y + 2.03211 (U - 128)
+ */
+#define YUV_FIX_BITS 13
+
+/**
+ * @brief scalar reference, converts a number of pixels, which must be even
+ */
+void Yuv422ToRgb24Scalar(const uint8_t *uyvy422, uint8_t *rgb24, int pixels);
+
+/**
+ * @brief same result as Yuv422ToRgb24Scalar, SSE2 when available
+ */
+void Yuv422ToRgb24(const uint8_t *uyvy422, uint8_t *rgb24, int pixels);
+
+/**
+ * @brief convert and undistort in one pass, dst(y, x) is the bilinear
+ *        sample of the converted source at the 1/32 pixel position given by
+ *        the maps. Samples outside the source are black.
+ * @param uyvy422    source picture, width x height
+ *        map1, map2 CV_16SC2 and CV_16UC1 maps from cv::convertMaps, they
+ *                   give the size of dst
+ *        dst        CV_8UC3 result
+ */
+void Yuv422ToRgb24Remap(const uint8_t *uyvy422, int width, int height,
+                        const cv::Mat &map1, const cv::Mat &map2,
+                        cv::Mat *dst);
+
+}  // namespace hesai
+}  // namespace drivers
+}  // namespace apollo
+
+#endif  // SRC_YUV422_RGB_H_
@@ -0,0 +1,163 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cmath>
+#include <vector>
+
+#include "src/yuv422_rgb.h"
+
+using apollo::drivers::hesai::Yuv422ToRgb24;
+using apollo::drivers::hesai::Yuv422ToRgb24Remap;
+using apollo::drivers::hesai::Yuv422ToRgb24Scalar;
+
+static const int kWidth = 1280;
+static const int kHeight = 720;
+
+// the floating point conversion the fixed point one replaces
+static int referenceChannel(double value) {
+  int v = value;
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static int checkScalarAgainstFloat() {
+  // every Y, U, V combination
+  std::vector<uint8_t> uyvy(256 * 256 * 256 * 2);
+  std::vector<uint8_t> rgb(256 * 256 * 256 * 3);
+  size_t i = 0;
+  for (int y = 0; y < 256; ++y) {
+    for (int u = 0; u < 256; ++u) {
+      for (int v = 0; v < 256; v += 2) {
+        uyvy[i++] = u;
+        uyvy[i++] = y;
+        uyvy[i++] = v;
+        uyvy[i++] = y;
+      }
+    }
+  }
+  const int pixels = uyvy.size() / 2;
+  Yuv422ToRgb24Scalar(&uyvy[0], &rgb[0], pixels);
+
+  for (int p = 0; p < pixels; p += 2) {
+    const int u = uyvy[2 * p] - 128;
+    const int y = uyvy[2 * p + 1];
+    const int v = uyvy[2 * p + 2] - 128;
+    const int expected[3] = {
+        referenceChannel(y + 2.03211 * u),
+        referenceChannel(y - 0.39465 * u - 0.58060 * v),
+        referenceChannel(y + 1.13983 * v)};
+    for (int c = 0; c < 3; ++c) {
+      if (abs(rgb[3 * p + c] - expected[c]) > 1) {
+        printf("scalar: pixel Y %d U %d V %d channel %d is %d, expected %d\n",
+               y, u + 128, v + 128, c, rgb[3 * p + c], expected[c]);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int checkSimdAgainstScalar() {
+  std::vector<uint8_t> uyvy(kWidth * kHeight * 2 + 16);
+  for (size_t i = 0; i < uyvy.size(); ++i) {
+    uyvy[i] = rand() & 0xff;
+  }
+  // one byte of slack shows writes past the last pixel
+  std::vector<uint8_t> expected(kWidth * kHeight * 3 + 1);
+  std::vector<uint8_t> actual(kWidth * kHeight * 3 + 1);
+
+  // whole picture, short rows hitting the scalar tail, unaligned input
+  const int counts[] = {kWidth * kHeight, 2, 8, 10, 12, 16, 18, 30, 1278};
+  for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); ++n) {
+    for (int offset = 0; offset < 16; offset += 4) {
+      const int pixels = counts[n];
+      expected.assign(expected.size(), 0x5a);
+      actual.assign(actual.size(), 0x5a);
+      Yuv422ToRgb24Scalar(&uyvy[offset], &expected[0], pixels);
+      Yuv422ToRgb24(&uyvy[offset], &actual[0], pixels);
+      for (size_t i = 0; i < actual.size(); ++i) {
+        if (actual[i] != expected[i]) {
+          printf("simd: %d pixels at offset %d differ at byte %zu, %d != %d\n",
+                 pixels, offset, i, actual[i], expected[i]);
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static int checkFusedRemap() {
+  std::vector<uint8_t> uyvy(kWidth * kHeight * 2);
+  for (size_t i = 0; i < uyvy.size(); ++i) {
+    uyvy[i] = rand() & 0xff;
+  }
+  std::vector<uint8_t> rgb(kWidth * kHeight * 3);
+  Yuv422ToRgb24(&uyvy[0], &rgb[0], kWidth * kHeight);
+
+  // a shifted, slightly scaled picture, partly outside the source
+  cv::Mat mapx(kHeight, kWidth, CV_32FC1);
+  cv::Mat mapy(kHeight, kWidth, CV_32FC1);
+  for (int row = 0; row < kHeight; ++row) {
+    for (int col = 0; col < kWidth; ++col) {
+      mapx.at<float>(row, col) = col * 1.013f - 7.3f;
+      mapy.at<float>(row, col) = row * 0.987f + 4.61f;
+    }
+  }
+  cv::Mat map1, map2, fused;
+  cv::convertMaps(mapx, mapy, map1, map2, CV_16SC2);
+  Yuv422ToRgb24Remap(&uyvy[0], kWidth, kHeight, map1, map2, &fused);
+
+  // bilinear sampling of the converted picture with the same 1/32 pixel grid
+  for (int row = 0; row < kHeight; ++row) {
+    for (int col = 0; col < kWidth; ++col) {
+      const int sx = lrintf(mapx.at<float>(row, col) * 32);
+      const int sy = lrintf(mapy.at<float>(row, col) * 32);
+      const int x = sx >> 5, y = sy >> 5, ax = sx & 31, ay = sy & 31;
+      for (int c = 0; c < 3; ++c) {
+        int sum = 0;
+        for (int k = 0; k < 4; ++k) {
+          const int px = x + (k & 1), py = y + (k >> 1);
+          const int w = ((k & 1) ? ax : 32 - ax) * ((k >> 1) ? ay : 32 - ay);
+          if (px >= 0 && px < kWidth && py >= 0 && py < kHeight) {
+            sum += rgb[3 * (py * kWidth + px) + c] * w;
+          }
+        }
+        const int expected = (sum + 512) >> 10;
+        const int actual = fused.ptr<uint8_t>(row)[3 * col + c];
+        if (actual != expected) {
+          printf("remap: (%d, %d) channel %d is %d, expected %d\n", col, row,
+                 c, actual, expected);
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  srand(42);
+  if (checkScalarAgainstFloat() != 0 || checkSimdAgainstScalar() != 0 ||
+      checkFusedRemap() != 0) {
+    printf("yuv test failed\n");
+    return 1;
+  }
+  printf("yuv test passed\n");
+  return 0;
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef MODULES_DRIVERS_ROBOSENSE_RSLIDAR_DRIVER_PACKET_RING_H_
+#define MODULES_DRIVERS_ROBOSENSE_RSLIDAR_DRIVER_PACKET_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace apollo {
+namespace drivers {
+namespace rslidar {
+
+/** @brief Lock-free single-producer/single-consumer ring of packet slots.
+ *
+ *  All slots are allocated up front. The producer receives straight into
+ *  the slot returned by write_slot() and makes it visible with push(); the
+ *  consumer reads the slot returned by read_slot() in place and hands it
+ *  back with pop(). Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class PacketRing {
+ public:
+  explicit PacketRing(size_t capacity)
+      : head_(0), tail_(0), dropped_(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_.resize(size);
+  }
+
+  size_t capacity() const { return slots_.size(); }
+
+  /// producer: slot to fill next, or nullptr if the ring is full
+  T *write_slot() {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= slots_.size()) {
+      return nullptr;
+    }
+    return &slots_[head & mask_];
+  }
+
+  /// producer: a packet was received while the ring was full
+  void drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+  /// producer: publish the slot returned by write_slot()
+  void push() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  /// consumer: oldest filled slot, or nullptr if the ring is empty
+  T *read_slot() {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots_[tail & mask_];
+  }
+
+  /// consumer: release the slot returned by read_slot()
+  void pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  /// number of packets the producer could not store because the ring was full
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  std::vector<T> slots_;
+  size_t mask_;
+  // keep producer and consumer indices on separate cache lines
+  alignas(64) std::atomic<uint64_t> head_;
+  alignas(64) std::atomic<uint64_t> tail_;
+  std::atomic<uint64_t> dropped_;
+};
+
+}  // namespace rslidar
+}  // namespace drivers
+}  // namespace apollo
+
+#endif
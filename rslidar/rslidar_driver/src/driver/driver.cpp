@@ -16,8 +16,11 @@
 
 #include "driver.h"
 
+#include <pthread.h>
 #include <ros/ros.h>
+#include <string.h>
 #include <time.h>
+#include <chrono>
 #include <cmath>
 #include <string>
 
@@ -25,7 +28,22 @@ namespace apollo {
 namespace drivers {
 namespace rslidar {
 
-RslidarDriver::RslidarDriver() : basetime_(0), last_gps_time_(0) {}
+RslidarDriver::RslidarDriver()
+    : basetime_(0),
+      last_gps_time_(0),
+      recv_running_(false),
+      recv_error_(0),
+      difop_running_(false) {}
+
+RslidarDriver::~RslidarDriver() {
+  stop_recv_thread();
+  if (difop_running_) {
+    difop_running_ = false;
+    if (difop_thread_.joinable()) {
+      difop_thread_.join();
+    }
+  }
+}
 
 void RslidarDriver::set_base_time_from_nmea_time(const NMEATimePtr& nmea_time,
                                                   uint64_t& basetime) {
@@ -54,6 +72,10 @@ bool RslidarDriver::set_base_time() {
 }
 
 int RslidarDriver::poll_standard(rslidar_msgs::rslidarScanPtr& scan) {
+  if (ring_) {
+    return poll_ring(scan);
+  }
+
   scan->packets.resize(config_.npackets);
   for (int i = 0; i < config_.npackets; ++i) {
     while (true) {
@@ -71,25 +93,152 @@ int RslidarDriver::poll_standard(rslidar_msgs::rslidarScanPtr& scan) {
   return 0;
 }
 
+/** Collect one scan from the receive ring.
+ *
+ *  Waits up to POLL_TIMEOUT for each packet, so a dead socket still surfaces
+ *  as SOCKET_TIMEOUT to the caller.
+ */
+int RslidarDriver::poll_ring(rslidar_msgs::rslidarScanPtr& scan) {
+  scan->packets.resize(config_.npackets);
+  for (int i = 0; i < config_.npackets; ++i) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(POLL_TIMEOUT);
+    rslidar_msgs::rslidarPacket* slot = nullptr;
+    while ((slot = ring_->read_slot()) == nullptr) {
+      int rc = recv_error_.exchange(0);
+      if (rc < 0) {
+        return rc;
+      }
+      if (std::chrono::steady_clock::now() > deadline) {
+        return SOCKET_TIMEOUT;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    scan->packets[i] = *slot;
+    ring_->pop();
+  }
+
+  return 0;
+}
+
+void RslidarDriver::recv_loop() {
+  rslidar_msgs::rslidarPacket overflow;
+  uint64_t reported_drops = 0;
+  while (recv_running_.load(std::memory_order_relaxed)) {
+    rslidar_msgs::rslidarPacket* slot = ring_->write_slot();
+    // keep draining the socket when the ring is full so the kernel buffer
+    // does not back up; only a packet actually received is counted as
+    // dropped, not a timeout while the lidar is idle
+    int rc = input_->get_msop_data_packet(slot ? slot : &overflow);
+    if (rc == 0) {
+      if (slot) {
+        ring_->push();
+      } else {
+        ring_->drop();
+      }
+    } else if (rc < 0) {
+      recv_error_.store(rc);
+    }
+
+    uint64_t drops = ring_->dropped();
+    if (drops != reported_drops) {
+      ROS_WARN_STREAM_THROTTLE(1.0, "Packet ring full on port "
+                                        << config_.msop_data_port << ", "
+                                        << drops << " packets dropped");
+      reported_drops = drops;
+    }
+  }
+}
+
+void RslidarDriver::start_recv_thread() {
+  if (!config_.recv_thread || recv_running_) {
+    return;
+  }
+
+  // default to two revolutions of buffering
+  size_t slots = config_.ring_size > 0 ? config_.ring_size
+                                       : 2 * config_.npackets;
+  ring_.reset(new PacketRing<rslidar_msgs::rslidarPacket>(slots));
+  ROS_INFO_STREAM("receiving on a dedicated thread, ring of "
+                  << ring_->capacity() << " packets");
+
+  recv_running_ = true;
+  recv_thread_ = std::thread(&RslidarDriver::recv_loop, this);
+
+  if (config_.recv_thread_cpu >= 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(config_.recv_thread_cpu, &cpuset);
+    int ret = pthread_setaffinity_np(recv_thread_.native_handle(),
+                                     sizeof(cpu_set_t), &cpuset);
+    if (ret != 0) {
+      ROS_WARN_STREAM("Failed to pin receive thread to cpu "
+                      << config_.recv_thread_cpu << ": " << strerror(ret));
+    }
+  }
+}
+
+void RslidarDriver::stop_recv_thread() {
+  if (!recv_running_) {
+    return;
+  }
+  recv_running_ = false;
+  // the receive loop wakes up at least every POLL_TIMEOUT
+  if (recv_thread_.joinable()) {
+    recv_thread_.join();
+  }
+}
+
+void RslidarDriver::start_difop_thread(ros::NodeHandle& node) {
+  if (config_.difop_topic.empty() || difop_running_) {
+    return;
+  }
+
+  positioning_input_.reset(new SocketInput());
+  positioning_input_->init(config_.difop_data_port);
+  difop_output_ =
+      node.advertise<rslidar_msgs::rslidarPacket>(config_.difop_topic, 10);
+
+  difop_running_ = true;
+  difop_thread_ =
+      std::thread(&RslidarDriver::poll_positioning_packet, this);
+}
+
+/** @brief DIFOP poll thread main loop.
+ *
+ *  The device broadcasts a DIFOP packet about once per second; each one is
+ *  republished as is and parsed by the pointcloud converter.
+ */
+void RslidarDriver::poll_positioning_packet() {
+  while (difop_running_.load(std::memory_order_relaxed) && ros::ok()) {
+    rslidar_msgs::rslidarPacketPtr packet(new rslidar_msgs::rslidarPacket);
+    int rc = positioning_input_->get_msop_data_packet(packet.get());
+    if (rc == 0) {
+      difop_output_.publish(packet);
+    }
+  }
+}
+
 void RslidarDriver::update_gps_top_hour(uint32_t current_time) {
-  if (last_gps_time_ == 0) {
-    last_gps_time_ = current_time;
+  uint32_t last_gps_time = last_gps_time_.load(std::memory_order_acquire);
+  if (last_gps_time == 0) {
+    last_gps_time_.store(current_time, std::memory_order_release);
     return;
   }
-  if (last_gps_time_ > current_time) {
-    if (std::abs(last_gps_time_ - current_time) > 3599000000) {
+  if (last_gps_time > current_time) {
+    if (last_gps_time - current_time > 3599000000u) {
       basetime_ += 3600 * 1e6;
       ROS_INFO_STREAM("Base time plus 3600s. Model: "
                       << config_.model << std::fixed << ". current:"
-                      << current_time << ", last time:" << last_gps_time_);
+                      << current_time << ", last time:" << last_gps_time);
     } else {
       ROS_WARN_STREAM("Currrnt stamp:" << std::fixed << current_time
                                        << " less than previous statmp:"
-                                       << last_gps_time_
+                                       << last_gps_time
                                        << ". GPS time stamp maybe incorrect!");
     }
   }
-  last_gps_time_ = current_time;
+  last_gps_time_.store(current_time, std::memory_order_release);
 }
 
 RslidarDriver* RslidarDriverFactory::create_driver(
@@ -100,24 +249,33 @@ RslidarDriver* RslidarDriverFactory::create_driver(
   private_nh.param("model", config.model, std::string("RS16"));
 
   private_nh.param("topic", config.topic, std::string("rslidar_packets"));
+  private_nh.param("difop_topic", config.difop_topic, std::string(""));
   private_nh.param("msop_data_port", config.msop_data_port,
                    MSOP_DATA_PORT);
   private_nh.param("difop_data_port", config.difop_data_port,
                    DIFOP_DATA_PORT);
   
   private_nh.param("rpm", config.rpm, 600.0);
+  private_nh.param("recv_thread", config.recv_thread, false);
+  private_nh.param("recv_thread_cpu", config.recv_thread_cpu, -1);
+  private_nh.param("ring_size", config.ring_size, 0);
 
-  double packet_rate;
+  // packet frequency (Hz) in single return mode
   if (config.model == "RS16") {
-  	 packet_rate = 840;
-     return new Rslidar16Driver(config);
+    config.packet_rate = 840;
+    return new Rslidar16Driver(config);
   } else if (config.model == "RS32") {
-  	 packet_rate = 1690;
-     return new Rslidar32Driver(config);
+    config.packet_rate = 1690;
+    return new Rslidar32Driver(config);
+  } else if (config.model == "RSBP") {
+    config.packet_rate = 1500;
+    return new Rslidar32Driver(config);
+  } else if (config.model == "RS128") {
+    config.packet_rate = 6000;
+    return new Rslidar32Driver(config);
   } else {
-       ROS_ERROR_STREAM("unknown LIDAR model: " << config.model);
-       packet_rate = 2600.0;
-	   return nullptr;
+    ROS_ERROR_STREAM("unknown LIDAR model: " << config.model);
+    return nullptr;
   }
 }
 
@@ -18,8 +18,12 @@
 #define RSLIDAR_DRIVER_H
 
 #include <ros/ros.h>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
 
+#include "rslidar_driver/packet_ring.h"
 #include "rslidar_driver/socket_input.h"
 #include "rslidar_msgs/rslidarScan.h"
 
@@ -30,20 +34,32 @@ namespace rslidar {
 // configuration parameters
 struct Config {
   Config()
-      : npackets(0), rpm(0.0), msop_data_port(0), difop_data_port(0) {}
+      : npackets(0),
+        packet_rate(0.0),
+        rpm(0.0),
+        msop_data_port(0),
+        difop_data_port(0),
+        recv_thread(false),
+        recv_thread_cpu(-1),
+        ring_size(0) {}
   std::string frame_id;  ///< tf frame ID
   std::string model;     ///< device model name
   std::string topic;
+  std::string difop_topic;  ///< republish DIFOP packets here, empty to disable
   int npackets;  ///< number of packets to collect
+  double packet_rate;  ///< packets per second, set per model
   double rpm;    ///< device rotation rate (RPMs)
   int msop_data_port;
   int difop_data_port;
+  bool recv_thread;     ///< receive MSOP packets on a dedicated thread
+  int recv_thread_cpu;  ///< core to pin the receive thread to, -1 for none
+  int ring_size;        ///< packet slots between receive and publish threads
 };
 
 class RslidarDriver {
  public:
   RslidarDriver();
-  virtual ~RslidarDriver() {}
+  virtual ~RslidarDriver();
 
   virtual bool poll(void) = 0;
   virtual void init(ros::NodeHandle &node) = 0;
@@ -54,13 +70,36 @@ class RslidarDriver {
   ros::Publisher output_;
   std::string topic_;
 
+  // written by the positioning poll, read by the packet path
   uint64_t basetime_;
-  uint32_t last_gps_time_;
+  std::atomic<uint32_t> last_gps_time_;
   int poll_standard(rslidar_msgs::rslidarScanPtr &scan);
   bool set_base_time();
   void set_base_time_from_nmea_time(const NMEATimePtr &nmea_time,
                                     uint64_t &basetime);
   void update_gps_top_hour(unsigned int current_time);
+
+  void start_recv_thread();
+  void stop_recv_thread();
+
+  // DIFOP packets carry the device calibration, forward them to the decoder
+  void start_difop_thread(ros::NodeHandle &node);
+  void poll_positioning_packet();
+
+ private:
+  void recv_loop();
+  int poll_ring(rslidar_msgs::rslidarScanPtr &scan);
+
+  std::unique_ptr<PacketRing<rslidar_msgs::rslidarPacket>> ring_;
+  std::thread recv_thread_;
+  std::atomic<bool> recv_running_;
+  // last socket error seen by the receive thread, 0 if none
+  std::atomic<int> recv_error_;
+
+  std::shared_ptr<Input> positioning_input_;
+  ros::Publisher difop_output_;
+  std::thread difop_thread_;
+  std::atomic<bool> difop_running_;
 };
 
 class Rslidar64Driver : public RslidarDriver {
@@ -80,9 +119,6 @@ public:
     virtual ~Rslidar32Driver() {}
     void init(ros::NodeHandle &node);
     bool poll(void);
-    void poll_positioning_packet();
-private:
-  std::shared_ptr<Input> positioning_input_;
 };
 
 class Rslidar16Driver : public RslidarDriver {
@@ -92,10 +128,6 @@ class Rslidar16Driver : public RslidarDriver {
 
   void init(ros::NodeHandle &node);
   bool poll(void);
-  void poll_positioning_packet();
-
- private:
-  std::shared_ptr<Input> positioning_input_;
 };
 
 class RslidarDriverFactory {
@@ -31,10 +31,9 @@ Rslidar16Driver::Rslidar16Driver(const Config &config) {
 }
 
 void Rslidar16Driver::init(ros::NodeHandle &node) {
-  const double packet_rate = 840;                 // packet frequency (Hz)
   const double frequency = (config_.rpm / 60.0);  // expected Hz rate
 
-  config_.npackets = (int)ceil(packet_rate / frequency);
+  config_.npackets = (int)ceil(config_.packet_rate / frequency);
   ROS_INFO_STREAM("publishing " << config_.npackets << " packets per scan");
 
 
@@ -42,7 +41,9 @@ void Rslidar16Driver::init(ros::NodeHandle &node) {
   input_->init(config_.msop_data_port);
 
    output_ = node.advertise<rslidar_msgs::rslidarScan>(config_.topic, 10);
- 
+
+  start_recv_thread();
+  start_difop_thread(node);
 }
 
 /** poll the device
@@ -71,21 +72,6 @@ bool Rslidar16Driver::poll(void) {
   return true;
 }
 
-/** poll the device
- *
- *  @returns true unless end of file reached
- */
-void Rslidar16Driver::poll_positioning_packet(void) {
-  while (true) {
-    NMEATimePtr nmea_time(new NMEATime);
-    bool ret = true;
-    if (basetime_ == 0 && ret) {
-      set_base_time_from_nmea_time(nmea_time, basetime_);
-    }
-  }
-// TO DO
-}
-
 }  // namespace rslidar
 }  // namespace drivers
 }  // namespace apollo
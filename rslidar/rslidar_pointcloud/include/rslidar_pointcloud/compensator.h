@@ -27,10 +27,22 @@
 #include <tf2_ros/transform_listener.h>
 #include <Eigen/Eigen>
 
+#include <vector>
+
 namespace apollo {
 namespace drivers {
 namespace rslidar {
 
+// how the points of the pointcloud2 are read, detected once per field list
+enum PointLayout {
+  LAYOUT_INVALID,
+  // float x, y, z at 0, 4, 8 and double timestamp at 24, the driver's points
+  LAYOUT_XYZIT,
+  // any offsets, float or double coordinates
+  LAYOUT_FLOAT,
+  LAYOUT_DOUBLE
+};
+
 class Compensator {
  public:
   Compensator(ros::NodeHandle node, ros::NodeHandle private_nh);
@@ -50,14 +62,26 @@ class Compensator {
                                   Eigen::Affine3d& pose);
   /**
   * @brief check if message is valid, check width, height, timesatmp.
-  *   set timestamp_offset and point data type
+  *   set timestamp_offset and point layout, the fields are only parsed
+  *   when they differ from the previous message
   */
   bool check_message(const sensor_msgs::PointCloud2ConstPtr& msg);
   /**
+  * @brief parse the fields of the message into the offsets and layout_
+  */
+  bool parse_fields(const sensor_msgs::PointCloud2ConstPtr& msg);
+  /**
+  * @brief compensate and publish the message, reading the points with layout
+  */
+  template <typename Layout>
+  void compensate(const sensor_msgs::PointCloud2ConstPtr& msg,
+                  const Layout& layout);
+  /**
   * @brief motion compensation for point cloud
   */
-  template <typename Scalar>
-  void motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
+  template <typename Layout>
+  void motion_compensation(const Layout& layout,
+                           sensor_msgs::PointCloud2::Ptr& msg,
                            const double timestamp_min,
                            const double timestamp_max,
                            const Eigen::Affine3d& pose_min_time,
@@ -65,9 +89,10 @@ class Compensator {
   /**
   * @brief get min timestamp and max timestamp from points in pointcloud2
   */
-  inline void get_timestamp_interval(
-      const sensor_msgs::PointCloud2ConstPtr& msg, double& timestamp_min,
-      double& timestamp_max);
+  template <typename Layout>
+  void get_timestamp_interval(const Layout& layout,
+                              const sensor_msgs::PointCloud2ConstPtr& msg,
+                              double& timestamp_min, double& timestamp_max);
   /**
   * @brief get point field size by sensor_msgs::datatype
   */
@@ -92,6 +117,10 @@ class Compensator {
   int z_offset_;
   int timestamp_offset_;
   uint timestamp_data_size_;
+  // fields and point step the offsets were parsed from
+  std::vector<sensor_msgs::PointField> fields_;
+  uint32_t point_step_;
+  PointLayout layout_;
 
   // topic names
   std::string topic_compensated_pointcloud_;
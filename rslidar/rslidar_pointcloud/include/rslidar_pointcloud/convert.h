@@ -44,14 +44,22 @@ class Convert {
   void convert_packets_to_pointcloud(
       const rslidar_msgs::rslidarScan::ConstPtr& scan_msg);
 
+  // parse device calibration from DIFOP packets
+  void difop_callback(const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg);
+
   // RawData class for converting data to point cloud
   rslidarParser* data_;
   
   ros::Subscriber rslidar_scan_;
+  ros::Subscriber rslidar_difop_;
   ros::Publisher pointcloud_pub_;
+  // downsampled copy of the pointcloud, only advertised with a reduction
+  ros::Publisher reduced_pub_;
 
   std::string topic_packets_;
   std::string topic_pointcloud_;
+  std::string topic_reduced_pointcloud_;
+  std::string topic_difop_;
  
   int queue_size_;
 };
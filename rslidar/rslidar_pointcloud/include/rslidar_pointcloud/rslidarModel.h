@@ -0,0 +1,161 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+/** \file
+ *
+ *  MSOP/DIFOP layout descriptors of the supported Robosense models.
+ *
+ *  Every descriptor is a set of compile time constants consumed by
+ *  RslidarDecoder<Model>, so the decode loop is instantiated once per model
+ *  and all layout arithmetic folds into immediates. Adding a model means
+ *  adding a descriptor here and an entry in RslidarParserFactory.
+ */
+
+#ifndef MODULES_DRIVERS_ROBOSENSE_RSLIDAR_POINTCLOUD_RSLIDAR_MODEL_H_
+#define MODULES_DRIVERS_ROBOSENSE_RSLIDAR_POINTCLOUD_RSLIDAR_MODEL_H_
+
+#include <stdint.h>
+
+namespace apollo {
+namespace drivers {
+namespace rslidar {
+
+/** RS-LiDAR-16: 12 blocks of two 16 laser firings, 0xffee block header. */
+struct RS16Model {
+  static constexpr const char *NAME = "RS16";
+  static const int LASERS = 16;
+  static const int HEADER_SIZE = 42;          ///< bytes before the first block
+  static const int BLOCKS_PER_PACKET = 12;
+  static const int BLOCK_SIZE = 100;          ///< 4 byte header + channels
+  static const int FIRINGS_PER_BLOCK = 2;
+  static const int DSR_GROUP = 16;            ///< lasers firing in sequence
+  static constexpr float BLOCK_TDURATION = 100.0f;  // [µs]
+  static constexpr float DSR_TOFFSET = 3.0f;        // [µs]
+  static constexpr float FIRING_TOFFSET = 50.0f;    // [µs]
+  static constexpr float DISTANCE_RESOLUTION = 0.01f;  // [m]
+  static const int MAX_AZIMUTH_DIFF = 75;     ///< 0.01 degree between blocks
+  static const int POINTS_PER_SCAN = 40000;   ///< large enough for 5Hz
+  static const int TEMPERATURE_RANGE = 40;
+  static const bool TEMPERATURE_CALIBRATED = true;  ///< distance/intensity
+                                                     ///< need curves.csv
+  static const bool AB_FLAG = false;          ///< A/B block halves swapped
+  static const bool HORI_CORRECTION = false;  ///< per laser azimuth offset
+  static const int DIFOP_VERT_OFFSET = 1165;
+  static const int DIFOP_HORI_OFFSET = -1;    ///< -1 if not broadcast
+  static const bool DIFOP_SIGN_BYTE = false;  ///< false: lower half negative
+  static const bool DIFOP_ANGLE_24BIT = true;  ///< magnitude uses all 3 bytes
+  static constexpr float DIFOP_ANGLE_RESOLUTION = 0.0001f;  // [deg]
+
+  static inline bool valid_block(const uint8_t *block) {
+    return block[0] == 0xff && block[1] == 0xee;
+  }
+};
+
+/** RS-LiDAR-32: 12 blocks of one 32 laser firing with A/B halves. */
+struct RS32Model {
+  static constexpr const char *NAME = "RS32";
+  static const int LASERS = 32;
+  static const int HEADER_SIZE = 42;
+  static const int BLOCKS_PER_PACKET = 12;
+  static const int BLOCK_SIZE = 100;
+  static const int FIRINGS_PER_BLOCK = 1;
+  static const int DSR_GROUP = 16;
+  static constexpr float BLOCK_TDURATION = 50.0f;
+  static constexpr float DSR_TOFFSET = 3.0f;
+  static constexpr float FIRING_TOFFSET = 50.0f;
+  static constexpr float DISTANCE_RESOLUTION = 0.01f;
+  static const int MAX_AZIMUTH_DIFF = 25;
+  static const int POINTS_PER_SCAN = 70000;
+  static const int TEMPERATURE_RANGE = 50;
+  static const bool TEMPERATURE_CALIBRATED = true;
+  static const bool AB_FLAG = true;
+  static const bool HORI_CORRECTION = true;
+  static const int DIFOP_VERT_OFFSET = 468;
+  static const int DIFOP_HORI_OFFSET = 564;
+  static const bool DIFOP_SIGN_BYTE = true;
+  static const bool DIFOP_ANGLE_24BIT = false;
+  static constexpr float DIFOP_ANGLE_RESOLUTION = 0.01f;  // [deg]
+
+  static inline bool valid_block(const uint8_t *block) {
+    return block[0] == 0xff && block[1] == 0xee;
+  }
+};
+
+/** RS-Bpearl: 32 lasers, 12 blocks, distances already calibrated. */
+struct RSBPModel {
+  static constexpr const char *NAME = "RSBP";
+  static const int LASERS = 32;
+  static const int HEADER_SIZE = 42;
+  static const int BLOCKS_PER_PACKET = 12;
+  static const int BLOCK_SIZE = 100;
+  static const int FIRINGS_PER_BLOCK = 1;
+  static const int DSR_GROUP = 32;
+  static constexpr float BLOCK_TDURATION = 55.52f;
+  static constexpr float DSR_TOFFSET = 1.44f;
+  static constexpr float FIRING_TOFFSET = 0.0f;
+  static constexpr float DISTANCE_RESOLUTION = 0.005f;
+  static const int MAX_AZIMUTH_DIFF = 50;
+  static const int POINTS_PER_SCAN = 70000;
+  static const int TEMPERATURE_RANGE = 50;
+  static const bool TEMPERATURE_CALIBRATED = false;
+  static const bool AB_FLAG = false;
+  static const bool HORI_CORRECTION = true;
+  static const int DIFOP_VERT_OFFSET = 468;
+  static const int DIFOP_HORI_OFFSET = 564;
+  static const bool DIFOP_SIGN_BYTE = true;
+  static const bool DIFOP_ANGLE_24BIT = false;
+  static constexpr float DIFOP_ANGLE_RESOLUTION = 0.01f;  // [deg]
+
+  static inline bool valid_block(const uint8_t *block) {
+    return block[0] == 0xff && block[1] == 0xee;
+  }
+};
+
+/** RS-Ruby: 128 lasers, 80 byte header, 3 blocks tagged 0xfe. */
+struct RS128Model {
+  static constexpr const char *NAME = "RS128";
+  static const int LASERS = 128;
+  static const int HEADER_SIZE = 80;
+  static const int BLOCKS_PER_PACKET = 3;
+  static const int BLOCK_SIZE = 388;
+  static const int FIRINGS_PER_BLOCK = 1;
+  static const int DSR_GROUP = 64;   ///< two banks firing interleaved
+  static constexpr float BLOCK_TDURATION = 55.55f;
+  static constexpr float DSR_TOFFSET = 0.8f;
+  static constexpr float FIRING_TOFFSET = 0.0f;
+  static constexpr float DISTANCE_RESOLUTION = 0.005f;
+  static const int MAX_AZIMUTH_DIFF = 50;
+  static const int POINTS_PER_SCAN = 256000;
+  static const int TEMPERATURE_RANGE = 50;
+  static const bool TEMPERATURE_CALIBRATED = false;
+  static const bool AB_FLAG = false;
+  static const bool HORI_CORRECTION = true;
+  static const int DIFOP_VERT_OFFSET = 468;
+  static const int DIFOP_HORI_OFFSET = 852;
+  static const bool DIFOP_SIGN_BYTE = true;
+  static const bool DIFOP_ANGLE_24BIT = false;
+  static constexpr float DIFOP_ANGLE_RESOLUTION = 0.01f;  // [deg]
+
+  static inline bool valid_block(const uint8_t *block) {
+    return block[0] == 0xfe;
+  }
+};
+
+}  // namespace rslidar
+}  // namespace drivers
+}  // namespace apollo
+
+#endif  // MODULES_DRIVERS_ROBOSENSE_RSLIDAR_POINTCLOUD_RSLIDAR_MODEL_H_
@@ -55,6 +55,7 @@
 #include <math.h>
 #include <stdint.h>
 #include <boost/format.hpp>
+#include <memory>
 #include <string>
 
 #include <nav_msgs/Odometry.h>
@@ -63,7 +64,9 @@
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <std_msgs/Time.h>
+#include "lidar_downsample/downsample.h"
 #include "rslidar_pointcloud/point_types.h"
+#include "rslidar_pointcloud/rslidarModel.h"
 #include "rslidar_msgs/rslidarScan.h"
 #include "rslidar_msgs/rslidarPic.h"
 
@@ -72,6 +75,10 @@ namespace apollo {
 namespace drivers {
 namespace rslidar {
 
+	using lidar_downsample::Downsampler;
+	using lidar_downsample::ReductionMode;
+	using lidar_downsample::reduction_mode;
+
 	typedef PointXYZIT VPoint;
 	typedef pcl::PointCloud<VPoint> VPointCloud;
 	class calibration_parse;
@@ -84,7 +91,7 @@ namespace rslidar {
   		double view_width;
   		bool calibration_online;
   		std::string calibration_file;
-  		std::string model;  // RS16,RS32
+  		std::string model;  // RS16,RS32,RSBP,RS128
   		bool organized;     // is point cloud order
 	};
     
@@ -105,26 +112,32 @@ namespace rslidar {
 	static const uint16_t UPPER_BANK = 0xeeff; //
 	static const uint16_t LOWER_BANK = 0xddff;
 	
-	/** Special Defines for RS16 support **/
-	static const int RS16_FIRINGS_PER_BLOCK = 2;
-	static const int RS16_SCANS_PER_FIRING = 16;
-	static const float RS16_BLOCK_TDURATION = 100.0f;	// [µs]
-	static const float RS16_DSR_TOFFSET = 3.0f;   // [µs]
-	static const float RS16_FIRING_TOFFSET = 50.0f;   // [µs]
-	static const int RS16_DATA_NUMBER_PER_SCAN = 40000; //Set 40000 to be large enough
-	
-	/** Special Defines for RS32 support **/
-	static const int RS32_FIRINGS_PER_BLOCK = 1;
-	static const int RS32_SCANS_PER_FIRING = 32;
-	static const float RS32_BLOCK_TDURATION = 50.0f;   // [µs]
-	static const float RS32_DSR_TOFFSET = 3.0f;   // [µs]
-	static const float RL32_FIRING_TOFFSET = 50.0f;   // [µs]
-	static const int RS32_DATA_NUMBER_PER_SCAN = 70000; //Set 70000 to be large enough
-	
 	static const int TEMPERATURE_MIN = 31;
-	
-	
-	static calibration_parse* calibration_;
+
+	static const int MAX_LASERS = 128;
+	static const int INTENSITY_CURVE_SIZE = 7;
+	static const int MAX_TEMPERATURE_RANGE = 51;
+
+	/** Device calibration. Tables are immutable once published; the parser
+	 *  swaps the whole table when a new calibration arrives. */
+	struct CalibrationTable {
+		float vert_angle[MAX_LASERS];	///< radians
+		float hori_angle[MAX_LASERS];	///< 0.01 degree
+		float intensity_cal[INTENSITY_CURVE_SIZE][MAX_LASERS];
+		int channel_num[MAX_LASERS][MAX_TEMPERATURE_RANGE];
+		float curves_rate[MAX_LASERS];
+		bool angles_loaded;	///< false while waiting for the first DIFOP
+		uint32_t version;
+	};
+	typedef std::shared_ptr<const CalibrationTable> CalibrationTablePtr;
+
+	/** DIFOP packet layout */
+	static const uint8_t DIFOP_HEADER[4] = {0xa5, 0xff, 0x00, 0x5a};
+	static const int DIFOP_CURVES_OFFSET = 50;	///< 15 bytes per laser
+	static const int DIFOP_CURVE_BYTES = 15;
+	static const int DIFOP_ANGLE_BYTES = 3;	///< per laser, see rslidarModel.h
+	static const float DIFOP_MAX_ANGLE = 90.0f;	///< degrees
+
 	typedef struct raw_block {
 		uint16_t header;		///< UPPER_BANK or LOWER_BANK
 		uint8_t rotation_1;
@@ -149,6 +162,29 @@ namespace rslidar {
 		uint8_t status[PACKET_STATUS_SIZE];
 	} raw_packet_t;
 	
+/** Temperature dependent corrections. Each decoder owns one, so the
+ *  temperature of one lidar never leaks into another. */
+class calibration_parse
+{
+	public:
+ 	  calibration_parse(int num_lasers, int temperature_range)
+	      : temper_(TEMPERATURE_MIN), num_lasers_(num_lasers),
+	        temperature_range_(temperature_range) {}
+	  ~calibration_parse() {}
+	  /*latest temperature reported in the MSOP header*/
+	  void setTemperature(float temper) { temper_ = temper; }
+	  float calibrateIntensity(const CalibrationTable &table, float intensity, int calIdx, int distance);
+	  float pixelToDistance(const CalibrationTable &table, int pixelValue, int passageway);
+	  int isABPacket(int distance);
+	  float computeTemperature(unsigned char bit1, unsigned char bit2);
+	  int estimateTemperature(float Temper);
+
+	private:
+	  float temper_;
+	  int num_lasers_;
+	  int temperature_range_;
+};
+
 		/** \brief RSLIDAR data conversion class */
 class rslidarParser {
 	public:
@@ -156,15 +192,34 @@ class rslidarParser {
 	
 		virtual ~rslidarParser() {}
 
+		/*current calibration snapshot, nullptr until one was loaded*/
+		CalibrationTablePtr calibration() const { return std::atomic_load(&table_); }
+
+		/*publish a new calibration, picked up by the next packet*/
+		void set_calibration(const std::shared_ptr<CalibrationTable> &table);
+
+		/*parse the calibration broadcast in a DIFOP packet and swap it in if
+		  it is valid and differs from the current one*/
+		bool processDifop(const rslidar_msgs::rslidarPacket &pkt);
+
 		/*init the size of the scan point size */
 		virtual void init_setup() = 0;
 	
 		/*load the cablibrated files: angle, distance, intensity*/
 		virtual void loadConfigFile(ros::NodeHandle private_nh) = 0;
 
-		/*unpack the RS16 UDP packet and opuput PCL PointXYZI type*/
+		/*unpack the RS16 UDP packet and opuput PCL PointXYZI type, the
+		  points picked by the downsampler also go to reduced if given*/
 		virtual void unpack(const rslidar_msgs::rslidarPacket &pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud,
-						bool finish_packets_parse) = 0;
+						bool finish_packets_parse,
+						pcl::PointCloud<pcl::PointXYZI>::Ptr reduced = pcl::PointCloud<pcl::PointXYZI>::Ptr()) = 0;
+
+		/*pick the points of the reduced cloud, see downsample.h*/
+		void set_reduction(ReductionMode mode, double leaf_size, int ring_stride,
+						int azimuth_stride) {
+			downsampler_.configure(mode, leaf_size, ring_stride, azimuth_stride);
+		}
+		bool reduction_enabled() const { return downsampler_.enabled(); }
 
 	
 	
@@ -172,86 +227,76 @@ class rslidarParser {
 		virtual int correctAzimuth(float azimuth_f, int passageway)= 0;
 
 		void sed_out_passage();
-		
+
+	protected:
+		/*number of lasers described by the DIFOP angle table*/
+		virtual int num_lasers() const = 0;
+
+		/*whether DIFOP carries temperature intensity curves*/
+		virtual bool difop_has_curves() const = 0;
+
+		/*read the per-laser angles from a DIFOP packet, false if not flashed*/
+		virtual bool parseDifopAngles(const uint8_t *data, CalibrationTable *table) = 0;
+
+		/*start a new table from the current one, or zeros if there is none*/
+		std::shared_ptr<CalibrationTable> copy_calibration() const;
+
+		// snapshot used by the packet being unpacked
+		CalibrationTablePtr current_;
+
+		Downsampler downsampler_;
+
+	private:
+		CalibrationTablePtr table_;
 	};
-	
-	static float VERT_ANGLE[32];
-    static float HORI_ANGLE[32];
-    static float aIntensityCal[7][32];
-    static int g_ChannelNum[32][51];
-    static float CurvesRate[32];
-
-    static float temper = 31.0;
-    static int tempPacketNum = 0;
-    static int numOfLasers = 16;
-    static int TEMPERATURE_RANGE = 40;
-
-    static rslidar_msgs::rslidarPic pic;
-	
 
-class rslidar16Parser : public rslidarParser {
+
+/** \brief Table driven decoder, instantiated once per model descriptor
+ *  (see rslidarModel.h). */
+template <typename Model>
+class RslidarDecoder : public rslidarParser {
 	public:
-	
-	  	rslidar16Parser();
-	  	~rslidar16Parser() {}
-	
-	 	void init_setup();
-	
+		RslidarDecoder();
+		~RslidarDecoder() {}
+
+		void init_setup();
+
 		/*load the cablibrated files: angle, distance, intensity*/
 		void loadConfigFile(ros::NodeHandle private_nh);
-	
-		/*unpack the RS16 UDP packet and opuput PCL PointXYZI type*/
+
+		/*unpack the UDP packet and opuput PCL PointXYZI type*/
 		void unpack(const rslidar_msgs::rslidarPacket &pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud,
-						bool finish_packets_parse);
+						bool finish_packets_parse,
+						pcl::PointCloud<pcl::PointXYZI>::Ptr reduced = pcl::PointCloud<pcl::PointXYZI>::Ptr());
 
-	
-	
 		/*calibrated the azimuth*/
 		int correctAzimuth(float azimuth_f, int passageway);
-	
 
-};
+	protected:
+		int num_lasers() const { return Model::LASERS; }
+		bool difop_has_curves() const { return Model::TEMPERATURE_CALIBRATED; }
+		bool parseDifopAngles(const uint8_t *data, CalibrationTable *table);
 
-class rslidar32Parser : public rslidarParser {
-	public:
-	
-	  	rslidar32Parser(){}
-	  	~rslidar32Parser() {}
-	 
-	 	void init_setup();
-	
-		/*load the cablibrated files: angle, distance, intensity*/
-		void loadConfigFile(ros::NodeHandle private_nh);
-	
-		/*unpack the RS16 UDP packet and opuput PCL PointXYZI type*/
-		void unpack(const rslidar_msgs::rslidarPacket &pkt, pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud,
-						bool finish_packets_parse);
-	
-	
-		/*calibrated the azimuth*/
-		int correctAzimuth(float azimuth_f, int passageway);
-	
-		
+	private:
+		static const int CHANNELS_PER_BLOCK = Model::LASERS * Model::FIRINGS_PER_BLOCK;
+
+		// per instance so several lidars can share one process
+		rslidar_msgs::rslidarPic pic_;
+		calibration_parse calib_;
+		int temp_packet_num_;	///< packets since the temperature was read
 };
 
+typedef RslidarDecoder<RS16Model> rslidar16Parser;
+typedef RslidarDecoder<RS32Model> rslidar32Parser;
+typedef RslidarDecoder<RSBPModel> rslidarBpearlParser;
+typedef RslidarDecoder<RS128Model> rslidar128Parser;
+
 
 class RslidarParserFactory {
  public:
    static rslidarParser *create_parser(Config_p config);
 };
 
-class calibration_parse
-{
-	public:
- 	  calibration_parse() {}
-	  ~calibration_parse() {}
-	  float calibrateIntensity(float intensity, int calIdx, int distance);
-	  float pixelToDistance(int pixelValue, int passageway);
-	  int isABPacket(int distance);
-	  float computeTemperature(unsigned char bit1, unsigned char bit2);
-	  int estimateTemperature(float Temper);
-};
-
 }  // namespacejiexi rslidar//our suanfa
 }  // namespace drivers
 }  // namespace apollo
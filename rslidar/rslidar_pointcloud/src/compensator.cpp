@@ -21,13 +21,84 @@ namespace apollo {
 namespace drivers {
 namespace rslidar {
 
+// point step of the driver's PointXYZIT
+const int kXYZITPointStep = 32;
+
+// the coordinates are read as float or double only
+static bool is_coordinate_type(int datatype) {
+  return datatype == sensor_msgs::PointField::FLOAT32 ||
+         datatype == sensor_msgs::PointField::FLOAT64;
+}
+
+/**
+ * @brief the driver's point, the offsets are constants the compiler folds
+ *   into the loops
+ */
+template <int PointStep>
+struct XYZITLayout {
+  typedef float Scalar;
+  int step() const { return PointStep; }
+  float* x(uint8_t* point) const { return reinterpret_cast<float*>(point); }
+  float* y(uint8_t* point) const {
+    return reinterpret_cast<float*>(point + 4);
+  }
+  float* z(uint8_t* point) const {
+    return reinterpret_cast<float*>(point + 8);
+  }
+  double timestamp(const uint8_t* point) const {
+    double t;
+    memcpy(&t, point + 24, sizeof(t));
+    return t;
+  }
+};
+
+/**
+ * @brief any layout, with the offsets parsed from the fields
+ */
+template <typename ScalarType>
+struct GenericLayout {
+  typedef ScalarType Scalar;
+  GenericLayout(int point_step, int x_offset, int y_offset, int z_offset,
+                int timestamp_offset, uint timestamp_size)
+      : point_step_(point_step),
+        x_offset_(x_offset),
+        y_offset_(y_offset),
+        z_offset_(z_offset),
+        timestamp_offset_(timestamp_offset),
+        timestamp_size_(timestamp_size) {}
+  int step() const { return point_step_; }
+  Scalar* x(uint8_t* point) const {
+    return reinterpret_cast<Scalar*>(point + x_offset_);
+  }
+  Scalar* y(uint8_t* point) const {
+    return reinterpret_cast<Scalar*>(point + y_offset_);
+  }
+  Scalar* z(uint8_t* point) const {
+    return reinterpret_cast<Scalar*>(point + z_offset_);
+  }
+  double timestamp(const uint8_t* point) const {
+    double t = 0.0;
+    memcpy(&t, point + timestamp_offset_, timestamp_size_);
+    return t;
+  }
+
+  int point_step_;
+  int x_offset_;
+  int y_offset_;
+  int z_offset_;
+  int timestamp_offset_;
+  uint timestamp_size_;
+};
+
 Compensator::Compensator(ros::NodeHandle node, ros::NodeHandle private_nh)
     : tf2_transform_listener_(tf2_buffer_, node),
       x_offset_(-1),
       y_offset_(-1),
       z_offset_(-1),
       timestamp_offset_(-1),
-      timestamp_data_size_(0) {
+      timestamp_data_size_(0),
+      point_step_(0),
+      layout_(LAYOUT_INVALID) {
   private_nh.param("child_frame_id", child_frame_id_,
                    std::string("rslidar64"));
   
@@ -49,12 +120,32 @@ void Compensator::pointcloud_callback(
     return;
   }
 
+  switch (layout_) {
+    case LAYOUT_XYZIT:
+      compensate(msg, XYZITLayout<kXYZITPointStep>());
+      break;
+    case LAYOUT_FLOAT:
+      compensate(msg, GenericLayout<float>(point_step_, x_offset_, y_offset_,
+                                           z_offset_, timestamp_offset_,
+                                           timestamp_data_size_));
+      break;
+    default:
+      compensate(msg, GenericLayout<double>(point_step_, x_offset_, y_offset_,
+                                            z_offset_, timestamp_offset_,
+                                            timestamp_data_size_));
+      break;
+  }
+}
+
+template <typename Layout>
+void Compensator::compensate(const sensor_msgs::PointCloud2ConstPtr& msg,
+                             const Layout& layout) {
   Eigen::Affine3d pose_min_time;
   Eigen::Affine3d pose_max_time;
 
   double timestamp_min = 0;
   double timestamp_max = 0;
-  get_timestamp_interval(msg, timestamp_min, timestamp_max);
+  get_timestamp_interval(layout, msg, timestamp_min, timestamp_max);
 
   // compensate point cloud, remove nan point
   if (query_pose_affine_from_tf2(timestamp_min, pose_min_time) &&
@@ -62,75 +153,100 @@ void Compensator::pointcloud_callback(
     // we change message after motion compesation
     sensor_msgs::PointCloud2::Ptr q_msg(new sensor_msgs::PointCloud2());
     *q_msg = *msg;
-    motion_compensation<float>(q_msg, timestamp_min, timestamp_max,
-                               pose_min_time, pose_max_time);
+    motion_compensation(layout, q_msg, timestamp_min, timestamp_max,
+                        pose_min_time, pose_max_time);
     q_msg->header.stamp.fromSec(timestamp_max);
     compensation_pub_.publish(q_msg);
   }
 }
 
-inline void Compensator::get_timestamp_interval(
-    const sensor_msgs::PointCloud2ConstPtr& msg, double& timestamp_min,
-    double& timestamp_max) {
+template <typename Layout>
+void Compensator::get_timestamp_interval(
+    const Layout& layout, const sensor_msgs::PointCloud2ConstPtr& msg,
+    double& timestamp_min, double& timestamp_max) {
   timestamp_max = 0.0;
   timestamp_min = std::numeric_limits<double>::max();
   int total = msg->width * msg->height;
 
   // get min time and max time
-  for (int i = 0; i < total; ++i) {
-    double timestamp = 0.0;
-    memcpy(&timestamp, &msg->data[i * msg->point_step + timestamp_offset_],
-           timestamp_data_size_);
-
-    if (timestamp < timestamp_min) {
-      timestamp_min = timestamp;
-    }
-    if (timestamp > timestamp_max) {
-      timestamp_max = timestamp;
-    }
+  const uint8_t* point = &msg->data[0];
+  for (int i = 0; i < total; ++i, point += layout.step()) {
+    double timestamp = layout.timestamp(point);
+    timestamp_min = std::min(timestamp_min, timestamp);
+    timestamp_max = std::max(timestamp_max, timestamp);
   }
 }
 
-// TODO: if point type is always float, and timestamp is always double?
 inline bool Compensator::check_message(
     const sensor_msgs::PointCloud2ConstPtr& msg) {
   // check msg width and height
   if (msg->width == 0 || msg->height == 0) {
     return false;
   }
+  if (msg->data.size() < msg->width * msg->height * msg->point_step) {
+    return false;
+  }
+
+  // the fields of a topic rarely change, reuse the offsets of the previous
+  // message if they are the same
+  bool same_fields = layout_ != LAYOUT_INVALID &&
+                     msg->point_step == point_step_ &&
+                     msg->fields.size() == fields_.size();
+  for (size_t i = 0; same_fields && i < fields_.size(); ++i) {
+    const sensor_msgs::PointField& f = msg->fields[i];
+    same_fields = f.offset == fields_[i].offset &&
+                  f.datatype == fields_[i].datatype &&
+                  f.count == fields_[i].count && f.name == fields_[i].name;
+  }
+  if (same_fields) {
+    return true;
+  }
+
+  fields_ = msg->fields;
+  point_step_ = msg->point_step;
+  layout_ = LAYOUT_INVALID;
+  x_offset_ = y_offset_ = z_offset_ = timestamp_offset_ = -1;
+  if (!parse_fields(msg)) {
+    return false;
+  }
+  return layout_ != LAYOUT_INVALID;
+}
 
+bool Compensator::parse_fields(const sensor_msgs::PointCloud2ConstPtr& msg) {
   int x_data_type = 0;
   int y_data_type = 0;
   int z_data_type = 0;
+  int timestamp_data_type = 0;
 
-  // TODO: will use a new datastruct with interface to get offset,
-  // datatype,datasize...
   for (size_t i = 0; i < msg->fields.size(); ++i) {
     const sensor_msgs::PointField& f = msg->fields[i];
 
     if (f.name == "x") {
       x_offset_ = f.offset;
       x_data_type = f.datatype;
-      if ((x_data_type != 7 && x_data_type != 8) || f.count != 1 ||
+      if (!is_coordinate_type(x_data_type) || f.count != 1 ||
           x_offset_ == -1) {
         return false;
       }
     } else if (f.name == "y") {
       y_offset_ = f.offset;
       y_data_type = f.datatype;
-      if (f.count != 1 || y_offset_ == -1) {
+      if (!is_coordinate_type(y_data_type) || f.count != 1 ||
+          y_offset_ == -1) {
         return false;
       }
     } else if (f.name == "z") {
       z_offset_ = f.offset;
       z_data_type = f.datatype;
-      if (f.count != 1 || z_offset_ == -1) {
+      if (!is_coordinate_type(z_data_type) || f.count != 1 ||
+          z_offset_ == -1) {
         return false;
       }
     } else if (f.name == "timestamp") {
       timestamp_offset_ = f.offset;
+      timestamp_data_type = f.datatype;
       timestamp_data_size_ = f.count * get_field_size(f.datatype);
-      if (timestamp_offset_ == -1 || timestamp_data_size_ == -1) {
+      if (timestamp_offset_ == -1 || timestamp_data_size_ == 0) {
         return false;
       }
     } else {
@@ -140,12 +256,26 @@ inline bool Compensator::check_message(
 
   // check offset if valid
   if (x_offset_ == -1 || y_offset_ == -1 || z_offset_ == -1 ||
-      timestamp_offset_ == -1 || timestamp_data_size_ == -1) {
+      timestamp_offset_ == -1 || timestamp_data_size_ == 0) {
     return false;
   }
   if (!(x_data_type == y_data_type && y_data_type == z_data_type)) {
     return false;
   }
+
+  if (x_data_type == sensor_msgs::PointField::FLOAT32 && x_offset_ == 0 &&
+      y_offset_ == 4 && z_offset_ == 8 && timestamp_offset_ == 24 &&
+      timestamp_data_type == sensor_msgs::PointField::FLOAT64 &&
+      timestamp_data_size_ == sizeof(double) &&
+      point_step_ == kXYZITPointStep) {
+    layout_ = LAYOUT_XYZIT;
+  } else if (x_data_type == sensor_msgs::PointField::FLOAT32) {
+    layout_ = LAYOUT_FLOAT;
+  } else if (x_data_type == sensor_msgs::PointField::FLOAT64) {
+    layout_ = LAYOUT_DOUBLE;
+  } else {
+    return false;
+  }
   return true;
 }
 
@@ -203,12 +333,14 @@ inline uint Compensator::get_field_size(const int datatype) {
   }
 }
 
-template <typename Scalar>
-void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
+template <typename Layout>
+void Compensator::motion_compensation(const Layout& layout,
+                                      sensor_msgs::PointCloud2::Ptr& msg,
                                       const double timestamp_min,
                                       const double timestamp_max,
                                       const Eigen::Affine3d& pose_min_time,
                                       const Eigen::Affine3d& pose_max_time) {
+  typedef typename Layout::Scalar Scalar;
   using std::abs;
   using std::sin;
   using std::acos;
@@ -223,6 +355,7 @@ void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
   translation = q_max.conjugate() * translation;
 
   int total = msg->width * msg->height;
+  uint8_t* point = &msg->data[0];
 
   double d = q0.dot(q1);
   double abs_d = abs(d);
@@ -238,24 +371,16 @@ void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
     double theta = acos(abs_d);
     double sin_theta = sin(theta);
     double c1_sign = (d > 0) ? 1 : -1;
-    for (int i = 0; i < total; ++i) {
-      size_t offset = i * msg->point_step;
-      Scalar* x_scalar =
-          reinterpret_cast<Scalar*>(&msg->data[offset + x_offset_]);
+    for (int i = 0; i < total; ++i, point += layout.step()) {
+      Scalar* x_scalar = layout.x(point);
       if (std::isnan(*x_scalar)) {
-        ROS_DEBUG_STREAM("nan point do not need motion compensation");
         continue;
       }
-      Scalar* y_scalar =
-          reinterpret_cast<Scalar*>(&msg->data[offset + y_offset_]);
-      Scalar* z_scalar =
-          reinterpret_cast<Scalar*>(&msg->data[offset + z_offset_]);
+      Scalar* y_scalar = layout.y(point);
+      Scalar* z_scalar = layout.z(point);
       Eigen::Vector3d p(*x_scalar, *y_scalar, *z_scalar);
 
-      double tp = 0.0;
-      memcpy(&tp, &msg->data[i * msg->point_step + timestamp_offset_],
-             timestamp_data_size_);
-      double t = (timestamp_max - tp) * f;
+      double t = (timestamp_max - layout.timestamp(point)) * f;
 
       Eigen::Translation3d ti(t * translation);
 
@@ -272,29 +397,18 @@ void Compensator::motion_compensation(sensor_msgs::PointCloud2::Ptr& msg,
     return;
   }
   // Not a "significant" rotation. Do translation only.
-  for (int i = 0; i < total; ++i) {
-    Scalar* x_scalar =
-        reinterpret_cast<Scalar*>(&msg->data[i * msg->point_step + x_offset_]);
+  for (int i = 0; i < total; ++i, point += layout.step()) {
+    Scalar* x_scalar = layout.x(point);
     if (std::isnan(*x_scalar)) {
-      ROS_DEBUG_STREAM("nan point do not need motion compensation");
       continue;
     }
-    Scalar* y_scalar =
-        reinterpret_cast<Scalar*>(&msg->data[i * msg->point_step + y_offset_]);
-    Scalar* z_scalar =
-        reinterpret_cast<Scalar*>(&msg->data[i * msg->point_step + z_offset_]);
-    Eigen::Vector3d p(*x_scalar, *y_scalar, *z_scalar);
-
-    double tp = 0.0;
-    memcpy(&tp, &msg->data[i * msg->point_step + timestamp_offset_],
-           timestamp_data_size_);
-    double t = (timestamp_max - tp) * f;
-    Eigen::Translation3d ti(t * translation);
-
-    p = ti * p;
-    *x_scalar = p.x();
-    *y_scalar = p.y();
-    *z_scalar = p.z();
+    Scalar* y_scalar = layout.y(point);
+    Scalar* z_scalar = layout.z(point);
+
+    double t = (timestamp_max - layout.timestamp(point)) * f;
+    *x_scalar += t * translation.x();
+    *y_scalar += t * translation.y();
+    *z_scalar += t * translation.z();
   }
 }
 
@@ -33,27 +33,42 @@ namespace rslidar {
   	private_nh.param("model", config_switch_.model, std::string("RS16"));
 	private_nh.param("topic_packets", topic_packets_, std::string("rslidar_packets"));
 	private_nh.param("topic_pointcloud", topic_pointcloud_, std::string("rslidar_points"));
+	private_nh.param("calibration_online", config_switch_.calibration_online, false);
+	private_nh.param("topic_difop", topic_difop_, std::string("rslidar_packets_difop"));
+	std::string reduction;
+	double reduction_leaf_size;
+	int reduction_ring_stride;
+	int reduction_azimuth_stride;
+	private_nh.param("reduction", reduction, std::string("none"));
+	private_nh.param("reduction_leaf_size", reduction_leaf_size, 0.2);
+	private_nh.param("reduction_ring_stride", reduction_ring_stride, 2);
+	private_nh.param("reduction_azimuth_stride", reduction_azimuth_stride, 4);
+	private_nh.param("topic_reduced_pointcloud", topic_reduced_pointcloud_, std::string("rslidar_points_reduced"));
 
    	data_ = RslidarParserFactory::create_parser(config_switch_);
 
-	calibration_ = new calibration_parse();
-	if (config_switch_.model  == "RS16") {
-		TEMPERATURE_RANGE = 40;
-	} else if (config_switch_.model  == "RS32") {
-		TEMPERATURE_RANGE = 50;
-	}
-	
   	data_->loadConfigFile(private_nh);            //load lidar parameters
   	data_->init_setup();
+	data_->set_reduction(reduction_mode(reduction), reduction_leaf_size,
+			reduction_ring_stride, reduction_azimuth_stride);
   
   	pointcloud_pub_ =
       node.advertise<sensor_msgs::PointCloud2>(topic_pointcloud_, queue_size_);
+	if (data_->reduction_enabled()) {
+		reduced_pub_ = node.advertise<sensor_msgs::PointCloud2>(
+			topic_reduced_pointcloud_, queue_size_);
+	}
 
   	// subscribe to rslidarScan packets
   	rslidar_scan_ = node.subscribe(
 		topic_packets_, queue_size_, &Convert::convert_packets_to_pointcloud,
       (Convert*)this, ros::TransportHints().tcpNoDelay(true));
- 
+
+	if (config_switch_.calibration_online) {
+		rslidar_difop_ = node.subscribe(
+			topic_difop_, queue_size_, &Convert::difop_callback,
+			(Convert*)this, ros::TransportHints().tcpNoDelay(true));
+	}
 }
 
 
@@ -63,6 +78,16 @@ Convert::~Convert() {
   	}
 }
 
+/** @brief Callback for DIFOP packets.
+ *
+ *  Parsing happens off the scan path; a changed calibration is swapped in
+ *  atomically and used from the next packet on.
+ */
+void Convert::difop_callback(
+    const rslidar_msgs::rslidarPacket::ConstPtr& difop_msg) {
+  data_->processDifop(*difop_msg);
+}
+
 /** @brief Callback for raw scan messages. */
 void Convert::convert_packets_to_pointcloud(
     const rslidar_msgs::rslidarScan::ConstPtr& scan_msg) {
@@ -75,6 +100,13 @@ void Convert::convert_packets_to_pointcloud(
   pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud(new pcl::PointCloud<pcl::PointXYZI>);
   pointcloud->header.frame_id = scan_msg->header.frame_id;
   pointcloud->header.stamp = pcl_conversions::toPCL(scan_msg->header).stamp;
+
+  // the reduced cloud is only filled while somebody listens
+  pcl::PointCloud<pcl::PointXYZI>::Ptr reduced;
+  if (reduced_pub_.getNumSubscribers() > 0) {
+    reduced.reset(new pcl::PointCloud<pcl::PointXYZI>);
+    reduced->header = pointcloud->header;
+  }
   
   //sensor_msgs::PointCloud2 outMsg;
   //use rslidar method
@@ -84,7 +116,7 @@ void Convert::convert_packets_to_pointcloud(
          // ROS_INFO_STREAM("Packets per scan: "<< scanMsg->packets.size());
          finish_packets_parse = true;
      	}
-     	data_->unpack(scan_msg->packets[i], pointcloud, finish_packets_parse);  //wait
+     	data_->unpack(scan_msg->packets[i], pointcloud, finish_packets_parse, reduced);  //wait
    }
   
   if (pointcloud->empty()) {
@@ -94,6 +126,9 @@ void Convert::convert_packets_to_pointcloud(
 
   // publish the accumulated cloud message
   pointcloud_pub_.publish(pointcloud);
+  if (reduced) {
+    reduced_pub_.publish(reduced);
+  }
 }
 
 }  // namespace rslidar
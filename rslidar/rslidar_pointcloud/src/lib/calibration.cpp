@@ -9,7 +9,7 @@ namespace rslidar {
 
 //------------------------------------------------------------
 //校准反射强度值
-float calibration_parse::calibrateIntensity(float intensity, int calIdx, int distance) {
+float calibration_parse::calibrateIntensity(const CalibrationTable &table, float intensity, int calIdx, int distance) {
 	int algDist;
 	int sDist;
 	int uplimitDist;
@@ -19,7 +19,7 @@ float calibration_parse::calibrateIntensity(float intensity, int calIdx, int dis
 	float distance_f;
 	float endOfSection1;
 
-	int temp = estimateTemperature(temper);
+	int temp = estimateTemperature(temper_);
 
 	realPwr = std::max( (float)( intensity / (1+(temp-TEMPERATURE_MIN)/24.0f) ), 1.0f );
 	
@@ -30,13 +30,13 @@ float calibration_parse::calibrateIntensity(float intensity, int calIdx, int dis
 	else
 		realPwr = (realPwr - 225.0f) * 256.0f + 2100.0f;
 
-	int indexTemper = estimateTemperature(temper) - TEMPERATURE_MIN;
-	uplimitDist = g_ChannelNum[calIdx][indexTemper] + 20000;
+	int indexTemper = estimateTemperature(temper_) - TEMPERATURE_MIN;
+	uplimitDist = table.channel_num[calIdx][indexTemper] + 20000;
 	//limit sDist
-	sDist = (distance > g_ChannelNum[calIdx][indexTemper]) ? distance : g_ChannelNum[calIdx][indexTemper];
+	sDist = (distance > table.channel_num[calIdx][indexTemper]) ? distance : table.channel_num[calIdx][indexTemper];
 	sDist = (sDist < uplimitDist) ? sDist : uplimitDist;
 	//minus the static offset (this data is For the intensity cal useage only)
-	algDist = sDist - g_ChannelNum[calIdx][indexTemper];
+	algDist = sDist - table.channel_num[calIdx][indexTemper];
 
 	// calculate intensity ref curves
 	float refPwr_temp = 0.0f;
@@ -45,34 +45,34 @@ float calibration_parse::calibrateIntensity(float intensity, int calIdx, int dis
 	distance_f = (float)algDist;
 	if(distance_f <= endOfSection1)
 	{
-	  refPwr_temp = aIntensityCal[0][calIdx] * exp(aIntensityCal[1][calIdx] - 
-	  aIntensityCal[2][calIdx] * distance_f/100.0f) + aIntensityCal[3][calIdx];
+	  refPwr_temp = table.intensity_cal[0][calIdx] * exp(table.intensity_cal[1][calIdx] - 
+	  table.intensity_cal[2][calIdx] * distance_f/100.0f) + table.intensity_cal[3][calIdx];
 	}
 	else
 	{
 	  for(int i = 0; i < order; i++)
 	  {
-		refPwr_temp +=aIntensityCal[i+4][calIdx]*(pow(distance_f/100.0f,order-1-i));
+		refPwr_temp +=table.intensity_cal[i+4][calIdx]*(pow(distance_f/100.0f,order-1-i));
 	  }
 	}
 
 	refPwr = std::max(std::min(refPwr_temp,500.0f),4.0f);
 
 	tempInten = (51* refPwr) / realPwr;
-	if(numOfLasers == 32){
-		tempInten = tempInten * CurvesRate[calIdx];
+	if(num_lasers_ == 32){
+		tempInten = tempInten * table.curves_rate[calIdx];
 	}
 	tempInten = (int) tempInten > 255 ? 255.0f : tempInten;
 	return tempInten;
 }
 
-float calibration_parse::pixelToDistance(int pixelValue, int passageway) {
+float calibration_parse::pixelToDistance(const CalibrationTable &table, int pixelValue, int passageway) {
 	float DistanceValue;
-	int indexTemper = estimateTemperature(temper) - TEMPERATURE_MIN;
-	if (pixelValue <= g_ChannelNum[passageway][indexTemper]) {
+	int indexTemper = estimateTemperature(temper_) - TEMPERATURE_MIN;
+	if (pixelValue <= table.channel_num[passageway][indexTemper]) {
 		DistanceValue = 0.0;
 	} else {
-		DistanceValue = (float) (pixelValue - g_ChannelNum[passageway][indexTemper]);
+		DistanceValue = (float) (pixelValue - table.channel_num[passageway][indexTemper]);
 	}
 	return DistanceValue;
 }
@@ -107,8 +107,8 @@ int calibration_parse::estimateTemperature(float Temper) {
 	int temp = (int)floor(Temper + 0.5);
 	if (temp < TEMPERATURE_MIN) {
 		temp = TEMPERATURE_MIN;
-	} else if (temp > TEMPERATURE_MIN + TEMPERATURE_RANGE) {
-		temp = TEMPERATURE_MIN + TEMPERATURE_RANGE;
+	} else if (temp > TEMPERATURE_MIN + temperature_range_) {
+		temp = TEMPERATURE_MIN + temperature_range_;
 	}
 	
 	return temp;
@@ -0,0 +1,401 @@
+/******************************************************************************
+ * Copyright 2018 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "rslidar_pointcloud/rslidarParser.h"
+
+#include <stdlib.h>
+#include <pcl/common/time.h>
+#include <ros/package.h>
+#include <ros/ros.h>
+
+#include "rslidar_pointcloud/util.h"
+
+namespace apollo {
+namespace drivers {
+namespace rslidar {
+
+namespace {
+
+/** Read one comma separated row into values, returns the number read. */
+int read_csv_row(FILE *file, float *values, int n) {
+  char line[4096];
+  if (fgets(line, sizeof(line), file) == NULL) {
+    return 0;
+  }
+  int count = 0;
+  char *cursor = line;
+  while (count < n) {
+    char *end = NULL;
+    float value = strtof(cursor, &end);
+    if (end == cursor) {
+      break;
+    }
+    values[count++] = value;
+    cursor = end;
+    while (*cursor == ',' || *cursor == ' ') {
+      ++cursor;
+    }
+  }
+  return count;
+}
+
+inline int block_azimuth(const uint8_t *block) {
+  return 256 * block[2] + block[3];
+}
+
+}  // namespace
+
+template <typename Model>
+RslidarDecoder<Model>::RslidarDecoder()
+    : calib_(Model::LASERS, Model::TEMPERATURE_RANGE), temp_packet_num_(0) {}
+
+template <typename Model>
+void RslidarDecoder<Model>::loadConfigFile(ros::NodeHandle private_nh) {
+  std::string anglePath, curvesPath, channelPath, curvesRatePath;
+
+  private_nh.param("curves_path", curvesPath, std::string(""));
+  private_nh.param("angle_path", anglePath, std::string(""));
+  private_nh.param("channel_path", channelPath, std::string(""));
+  private_nh.param("curves_rate_path", curvesRatePath, std::string(""));
+
+  // with online calibration the curves and angles come from DIFOP
+  bool calibration_online = false;
+  private_nh.param("calibration_online", calibration_online, false);
+  if (calibration_online) {
+    curvesPath.clear();
+    anglePath.clear();
+  }
+  std::shared_ptr<CalibrationTable> table = copy_calibration();
+  table->angles_loaded = !calibration_online;
+
+  float row[MAX_TEMPERATURE_RANGE > MAX_LASERS ? MAX_TEMPERATURE_RANGE
+                                               : MAX_LASERS];
+
+  // intensity curves: one row per coefficient, one column per laser
+  if (Model::TEMPERATURE_CALIBRATED && !curvesPath.empty()) {
+    FILE *f_inten = fopen(curvesPath.c_str(), "r");
+    if (!f_inten) {
+      ROS_ERROR_STREAM(curvesPath << " does not exist");
+    } else {
+      for (int i = 0; i < INTENSITY_CURVE_SIZE; ++i) {
+        if (read_csv_row(f_inten, row, Model::LASERS) < Model::LASERS) {
+          ROS_ERROR_STREAM(curvesPath << " is incomplete at row " << i);
+          break;
+        }
+        for (int laser = 0; laser < Model::LASERS; ++laser) {
+          table->intensity_cal[i][laser] = row[laser];
+        }
+      }
+      fclose(f_inten);
+    }
+  }
+
+  // angles: one row per laser, vertical[,horizontal] in degrees
+  if (!anglePath.empty()) {
+    FILE *f_angle = fopen(anglePath.c_str(), "r");
+    if (!f_angle) {
+      ROS_ERROR_STREAM(anglePath << " does not exist");
+    } else {
+      for (int laser = 0; laser < Model::LASERS; ++laser) {
+        row[1] = 0.0f;
+        if (read_csv_row(f_angle, row, 2) < 1) {
+          ROS_ERROR_STREAM(anglePath << " is incomplete at row " << laser);
+          break;
+        }
+        table->vert_angle[laser] = row[0] / 180 * M_PI;
+        table->hori_angle[laser] = row[1] * 100;
+      }
+      fclose(f_angle);
+    }
+  }
+
+  // channel offsets: one row per laser, one column per degree celsius
+  if (Model::TEMPERATURE_CALIBRATED && !channelPath.empty()) {
+    FILE *f_channel = fopen(channelPath.c_str(), "r");
+    if (!f_channel) {
+      ROS_ERROR_STREAM(channelPath << " does not exist");
+    } else {
+      for (int laser = 0; laser < Model::LASERS; ++laser) {
+        int columns = read_csv_row(f_channel, row, MAX_TEMPERATURE_RANGE);
+        if (columns < Model::TEMPERATURE_RANGE + 1) {
+          ROS_ERROR_STREAM(channelPath << " is incomplete at row " << laser);
+          break;
+        }
+        for (int t = 0; t < Model::TEMPERATURE_RANGE + 1; ++t) {
+          table->channel_num[laser][t] = static_cast<int>(row[t]);
+        }
+      }
+      fclose(f_channel);
+    }
+  }
+
+  if (Model::TEMPERATURE_CALIBRATED && !curvesRatePath.empty()) {
+    FILE *f_curvesRate = fopen(curvesRatePath.c_str(), "r");
+    if (!f_curvesRate) {
+      ROS_ERROR_STREAM(curvesRatePath << " does not exist");
+    } else {
+      for (int laser = 0; laser < Model::LASERS; ++laser) {
+        if (read_csv_row(f_curvesRate, row, 1) < 1) {
+          break;
+        }
+        table->curves_rate[laser] = row[0];
+      }
+      fclose(f_curvesRate);
+    }
+  }
+
+  set_calibration(table);
+}
+
+/** Set up for on-line operation. */
+template <typename Model>
+void RslidarDecoder<Model>::init_setup() {
+  pic_.col = 0;
+  pic_.distance.resize(Model::POINTS_PER_SCAN);
+  pic_.intensity.resize(Model::POINTS_PER_SCAN);
+  pic_.azimuthforeachP.resize(Model::POINTS_PER_SCAN);
+}
+
+template <typename Model>
+int RslidarDecoder<Model>::correctAzimuth(float azimuth_f, int passageway) {
+  int azimuth;
+  if (azimuth_f > 0.0 && azimuth_f < 3000.0) {
+    azimuth_f = azimuth_f + current_->hori_angle[passageway] + 36000.0f;
+  } else {
+    azimuth_f = azimuth_f + current_->hori_angle[passageway];
+  }
+  azimuth = (int)azimuth_f;
+  azimuth %= 36000;
+
+  return azimuth;
+}
+
+template <typename Model>
+bool RslidarDecoder<Model>::parseDifopAngles(const uint8_t *data,
+                                             CalibrationTable *table) {
+  const uint8_t *vert = data + Model::DIFOP_VERT_OFFSET;
+  // the angle region reads all 0x00 or all 0xff until the device is flashed
+  bool flashed = false;
+  for (int i = 0; i < 4; ++i) {
+    if (vert[i] != 0x00 && vert[i] != 0xff) {
+      flashed = true;
+    }
+  }
+  if (!flashed) {
+    return false;
+  }
+
+  for (int laser = 0; laser < Model::LASERS; ++laser) {
+    const uint8_t *v = vert + laser * DIFOP_ANGLE_BYTES;
+    float sign;
+    if (Model::DIFOP_SIGN_BYTE) {
+      sign = v[0] == 0 ? 1.0f : -1.0f;
+    } else {
+      // no sign byte, the lower half of the lasers looks down
+      sign = laser < Model::LASERS / 2 ? -1.0f : 1.0f;
+    }
+    int magnitude = v[1] * 256 + v[2];
+    if (Model::DIFOP_ANGLE_24BIT) {
+      magnitude += v[0] * 65536;
+    }
+    float degree = magnitude * sign * Model::DIFOP_ANGLE_RESOLUTION;
+    table->vert_angle[laser] = degree / 180 * M_PI;
+
+    if (Model::DIFOP_HORI_OFFSET >= 0) {
+      const uint8_t *h =
+          data + Model::DIFOP_HORI_OFFSET + laser * DIFOP_ANGLE_BYTES;
+      float h_degree = (h[1] * 256 + h[2]) * (h[0] == 0 ? 1.0f : -1.0f) *
+                      Model::DIFOP_ANGLE_RESOLUTION;
+      table->hori_angle[laser] = h_degree * 100;
+    }
+  }
+  table->angles_loaded = true;
+  return true;
+}
+
+/** @brief convert raw packet to point cloud
+ *
+ *  @param pkt raw packet to unpack
+ *  @param pc shared pointer to point cloud (points are appended)
+ *  @param reduced unorganized cloud of the points picked by the
+ *         downsampler, filled with the last packet, or null
+ */
+template <typename Model>
+void RslidarDecoder<Model>::unpack(
+    const rslidar_msgs::rslidarPacket &pkt,
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pointcloud,
+    bool finish_packets_parse,
+    pcl::PointCloud<pcl::PointXYZI>::Ptr reduced) {
+  // one calibration snapshot per packet, DIFOP updates land in between
+  current_ = calibration();
+  if (!current_ || !current_->angles_loaded) {
+    ROS_WARN_STREAM_THROTTLE(5, "Waiting for DIFOP calibration");
+    return;
+  }
+  const CalibrationTable &table = *current_;
+  const uint8_t *data = &pkt.data[Model::HEADER_SIZE];
+
+  for (int block = 0; block < Model::BLOCKS_PER_PACKET; block++) {
+    const uint8_t *raw_block = data + block * Model::BLOCK_SIZE;
+    if (!Model::valid_block(raw_block)) {
+      ROS_INFO_STREAM_THROTTLE(180, "skipping RSLIDAR DIFOP packet");
+      break;
+    }
+
+    if ((pic_.col + 1) * CHANNELS_PER_BLOCK > Model::POINTS_PER_SCAN) {
+      ROS_WARN_STREAM_THROTTLE(10, "Too many blocks in one scan, drop rest");
+      break;
+    }
+
+    if (Model::TEMPERATURE_CALIBRATED) {
+      // update temperature information per 20000 packets
+      if (temp_packet_num_ < 20000 && temp_packet_num_ > 0) {
+        temp_packet_num_++;
+      } else {
+        calib_.setTemperature(
+            calib_.computeTemperature(pkt.data[38], pkt.data[39]));
+        temp_packet_num_ = 1;
+      }
+    }
+
+    int azimuth = block_azimuth(raw_block);
+    int azimuth_diff;
+    if (block < Model::BLOCKS_PER_PACKET - 1) {
+      azimuth_diff =
+          (36000 + block_azimuth(raw_block + Model::BLOCK_SIZE) - azimuth) %
+          36000;
+    } else {
+      azimuth_diff =
+          (36000 + azimuth - block_azimuth(raw_block - Model::BLOCK_SIZE)) %
+          36000;
+    }
+    // ignore the block if the azimuth change abnormal
+    if (azimuth_diff <= 0 || azimuth_diff > Model::MAX_AZIMUTH_DIFF) {
+      continue;
+    }
+
+    const uint8_t *channels = raw_block + 4;
+    int ab_flag = 0;
+    if (Model::AB_FLAG) {
+      ab_flag = calib_.isABPacket(channels[0] * 256 + channels[1]);
+    }
+
+    const int base = pic_.col * CHANNELS_PER_BLOCK;
+    for (int firing = 0; firing < Model::FIRINGS_PER_BLOCK; firing++) {
+      for (int dsr = 0; dsr < Model::LASERS; dsr++) {
+        const int channel = firing * Model::LASERS + dsr;
+        int k = channel * RAW_SCAN_SIZE;
+        if (Model::AB_FLAG && ab_flag) {
+          // B blocks carry the two laser halves swapped
+          const int half = Model::LASERS / 2 * RAW_SCAN_SIZE;
+          k += dsr < Model::LASERS / 2 ? half : -half;
+        }
+
+        float azimuth_corrected_f =
+            azimuth + azimuth_diff *
+                          ((dsr % Model::DSR_GROUP) * Model::DSR_TOFFSET +
+                           firing * Model::FIRING_TOFFSET) /
+                          Model::BLOCK_TDURATION;
+        int azimuth_corrected =
+            Model::HORI_CORRECTION
+                ? correctAzimuth(azimuth_corrected_f, dsr)
+                : ((int)round(azimuth_corrected_f)) % 36000;
+
+        int distance = channels[k] * 256 + channels[k + 1];
+        float intensity = channels[k + 2];
+        float distance2;
+        if (Model::TEMPERATURE_CALIBRATED) {
+          if (Model::AB_FLAG) {
+            distance -= calib_.isABPacket(distance) * 32768;
+          }
+          intensity = calib_.calibrateIntensity(table, intensity, dsr, distance);
+          distance2 = calib_.pixelToDistance(table, distance, dsr) *
+                      Model::DISTANCE_RESOLUTION;
+        } else {
+          distance2 = distance * Model::DISTANCE_RESOLUTION;
+        }
+
+        pic_.azimuthforeachP[base + channel] = azimuth_corrected;
+        pic_.distance[base + channel] = distance2;
+        pic_.intensity[base + channel] = intensity;
+      }
+    }
+    pic_.col++;
+  }
+
+  if (finish_packets_parse) {
+    float cos_vert[Model::LASERS];
+    float sin_vert[Model::LASERS];
+    for (int dsr = 0; dsr < Model::LASERS; dsr++) {
+      cos_vert[dsr] = cosf(table.vert_angle[dsr]);
+      sin_vert[dsr] = sinf(table.vert_angle[dsr]);
+    }
+
+    pointcloud->clear();
+    pointcloud->height = Model::LASERS;
+    pointcloud->width = Model::FIRINGS_PER_BLOCK * pic_.col;
+    pointcloud->is_dense = false;
+    pointcloud->resize(pointcloud->height * pointcloud->width);
+    if (!downsampler_.enabled()) {
+      reduced.reset();
+    }
+    if (reduced) {
+      downsampler_.reset();
+      reduced->clear();
+      // the downsampler never keeps a NaN point
+      reduced->is_dense = true;
+    }
+    for (int block_num = 0; block_num < static_cast<int>(pic_.col);
+         block_num++) {
+      for (int firing = 0; firing < Model::FIRINGS_PER_BLOCK; firing++) {
+        const int column = Model::FIRINGS_PER_BLOCK * block_num + firing;
+        for (int dsr = 0; dsr < Model::LASERS; dsr++) {
+          int point_count =
+              block_num * CHANNELS_PER_BLOCK + firing * Model::LASERS + dsr;
+          float dis = pic_.distance[point_count];
+          pcl::PointXYZI &point = pointcloud->at(column, dsr);
+          if (dis > DISTANCE_MAX || dis < DISTANCE_MIN) {  // invalid data
+            point.x = NAN;
+            point.y = NAN;
+            point.z = NAN;
+            point.intensity = 0;
+          } else {
+            // X axis to the front side of the cable
+            float arg_horiz = pic_.azimuthforeachP[point_count] / 18000 * M_PI;
+            point.y = -dis * cos_vert[dsr] * sin(arg_horiz);
+            point.x = dis * cos_vert[dsr] * cos(arg_horiz);
+            point.z = dis * sin_vert[dsr];
+            point.intensity = pic_.intensity[point_count];
+          }
+          if (reduced && downsampler_.keep(point.x, point.y, point.z, dsr)) {
+            reduced->push_back(point);
+          }
+        }
+      }
+    }
+    init_setup();
+    pic_.header.stamp = pkt.stamp;
+  }
+}
+
+template class RslidarDecoder<RS16Model>;
+template class RslidarDecoder<RS32Model>;
+template class RslidarDecoder<RSBPModel>;
+template class RslidarDecoder<RS128Model>;
+
+}  // namespace rslidar
+}  // namespace drivers
+}  // namespace apollo
@@ -16,6 +16,7 @@
 
 #include "rslidar_pointcloud/rslidarParser.h"
 
+#include <string.h>
 #include <pcl/common/time.h>
 #include <ros/package.h>
 #include <ros/ros.h>
@@ -30,17 +31,105 @@ void rslidarParser::sed_out_passage(){
 	ROS_INFO_ONCE("start");
 }
 
+std::shared_ptr<CalibrationTable> rslidarParser::copy_calibration() const {
+  std::shared_ptr<CalibrationTable> table(new CalibrationTable());
+  CalibrationTablePtr current = calibration();
+  if (current) {
+    // memcpy keeps padding identical so tables can be compared bytewise
+    memcpy(table.get(), current.get(), sizeof(CalibrationTable));
+  } else {
+    memset(table.get(), 0, sizeof(CalibrationTable));
+  }
+  return table;
+}
+
+void rslidarParser::set_calibration(
+    const std::shared_ptr<CalibrationTable> &table) {
+  CalibrationTablePtr current = calibration();
+  table->version = current ? current->version + 1 : 1;
+  std::atomic_store(&table_, CalibrationTablePtr(table));
+}
+
+bool rslidarParser::processDifop(const rslidar_msgs::rslidarPacket &pkt) {
+  const uint8_t *data = &pkt.data[0];
+  if (memcmp(data, DIFOP_HEADER, sizeof(DIFOP_HEADER)) != 0) {
+    ROS_WARN_STREAM_THROTTLE(10, "Drop DIFOP packet with invalid header");
+    return false;
+  }
+
+  std::shared_ptr<CalibrationTable> table = copy_calibration();
+
+  // the curve region reads all 0x00 or all 0xff until the device is flashed
+  const uint8_t *curves = data + DIFOP_CURVES_OFFSET;
+  bool curves_flashed = false;
+  for (int i = 0; i < 4; ++i) {
+    if (curves[i] != 0x00 && curves[i] != 0xff) {
+      curves_flashed = true;
+    }
+  }
+  if (curves_flashed && difop_has_curves()) {
+    for (int laser = 0; laser < num_lasers(); ++laser) {
+      const uint8_t *curve = curves + laser * DIFOP_CURVE_BYTES;
+      // each 16 bit coefficient is checked against the trailing xor byte
+      for (int i = 0; i < INTENSITY_CURVE_SIZE; ++i) {
+        if ((curve[i * 2] ^ curve[i * 2 + 1]) !=
+            curve[DIFOP_CURVE_BYTES - 1]) {
+          ROS_WARN_STREAM_THROTTLE(
+              10, "Drop DIFOP packet, bad intensity curve of laser " << laser);
+          return false;
+        }
+      }
+      for (int i = 0; i < INTENSITY_CURVE_SIZE; ++i) {
+        table->intensity_cal[i][laser] =
+            (curve[i * 2] * 256 + curve[i * 2 + 1]) * 0.001f;
+      }
+    }
+  }
+
+  bool angles_valid = parseDifopAngles(data, table.get());
+  if (angles_valid) {
+    for (int laser = 0; laser < num_lasers(); ++laser) {
+      if (fabs(table->vert_angle[laser]) > DIFOP_MAX_ANGLE / 180 * M_PI) {
+        ROS_WARN_STREAM_THROTTLE(
+            10, "Drop DIFOP packet, bad vertical angle of laser " << laser);
+        return false;
+      }
+    }
+  }
+
+  if (!curves_flashed && !angles_valid) {
+    return false;
+  }
+
+  // only swap when the device calibration actually changed
+  CalibrationTablePtr current = calibration();
+  if (current) {
+    table->version = current->version;
+    if (memcmp(table.get(), current.get(), sizeof(CalibrationTable)) == 0) {
+      return false;
+    }
+  }
+
+  set_calibration(table);
+  ROS_INFO_STREAM("Calibration updated from DIFOP, version "
+                  << calibration()->version);
+  return true;
+}
+
 rslidarParser *RslidarParserFactory::create_parser(Config_p config) {
 
-  if (config.model == "RS16") {
+  if (config.model == RS16Model::NAME) {
     return new rslidar16Parser();
-  } else if (config.model == "RS32") {
+  } else if (config.model == RS32Model::NAME) {
    // config.calibration_online = false;
     return new rslidar32Parser();
+  } else if (config.model == RSBPModel::NAME) {
+    return new rslidarBpearlParser();
+  } else if (config.model == RS128Model::NAME) {
+    return new rslidar128Parser();
   } else {
-    ROS_ERROR_STREAM(
-        "invalid model, must be 64E_S2|64E_S3S"
-        << "|64E_S3D_STRONGEST|64E_S3D_LAST|64E_S3D_DUAL|HDL32E|VLP16");
+    ROS_ERROR_STREAM("invalid model " << config.model
+                                      << ", must be RS16|RS32|RSBP|RS128");
     return nullptr;
   }
 }
@@ -0,0 +1,124 @@
+/* -*- mode: C++ -*-
+ *
+ *  License: Modified BSD Software License Agreement
+ *
+ *  $Id$
+ */
+
+/** @file
+ *
+ *  @brief Splits the points of a packet into ground and obstacle points,
+ *  column by column, from the slope between the rings of a column.
+ */
+
+#ifndef __VELODYNE_GROUND_H
+#define __VELODYNE_GROUND_H
+
+#include <math.h>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <velodyne_pointcloud/point_types.h>
+
+namespace velodyne_pointcloud
+{
+  /** \brief Labels the points of every column as ground or obstacle.
+   *
+   *  A column holds the points fired at the same azimuth, one per ring, and
+   *  ring 0 is the lowest laser. Walking a column upwards, a point is ground
+   *  when the slope from the last ground point below it, or from the ground
+   *  under the sensor for the first one, is at most max_slope. Obstacle
+   *  points do not move the reference, so the ground behind a low obstacle
+   *  is still found.
+   *
+   *  The points of a packet are in firing order, a column ends where a ring
+   *  repeats. The banks of a HDL-64E and the four blocks of a VLS-128 firing
+   *  fill one column this way.
+   */
+  class GroundSplitter
+  {
+  public:
+
+    GroundSplitter():
+      enabled_(false), tan_max_slope_(0), sensor_height_(0)
+    {}
+
+    /** @param max_slope steepest ground [degrees]
+     *  @param sensor_height height of the sensor above the ground [m]
+     */
+    void configure(bool enabled, double max_slope, double sensor_height)
+    {
+      enabled_ = enabled;
+      tan_max_slope_ = tan(max_slope * M_PI / 180.0);
+      sensor_height_ = sensor_height;
+    }
+
+    bool enabled() const
+    {
+      return enabled_;
+    }
+
+    /** \brief Append the points [begin, pc.size()) to ground or obstacle.
+     *
+     *  Either output may be NULL.
+     */
+    void split(const pcl::PointCloud<PointXYZIR> &pc, size_t begin,
+               pcl::PointCloud<PointXYZIR> *ground,
+               pcl::PointCloud<PointXYZIR> *obstacle)
+    {
+      for (size_t i = begin; i < pc.points.size(); ++i)
+        {
+          const uint16_t ring = pc.points[i].ring;
+          if (ring >= column_.size())
+            column_.resize(ring + 1, -1);
+          if (column_[ring] >= 0)
+            splitColumn(pc, ground, obstacle);
+          column_[ring] = i;
+        }
+      splitColumn(pc, ground, obstacle);
+    }
+
+  private:
+
+    void splitColumn(const pcl::PointCloud<PointXYZIR> &pc,
+                     pcl::PointCloud<PointXYZIR> *ground,
+                     pcl::PointCloud<PointXYZIR> *obstacle)
+    {
+      // the ground right under the sensor
+      float ground_range = 0;
+      float ground_z = -sensor_height_;
+      for (size_t ring = 0; ring < column_.size(); ++ring)
+        {
+          if (column_[ring] < 0)
+            continue;
+          const PointXYZIR &point = pc.points[column_[ring]];
+          column_[ring] = -1;
+
+          const float range = sqrtf(point.x * point.x + point.y * point.y);
+          const float run = range - ground_range;
+          const bool is_ground =
+            run > 0 && fabsf(point.z - ground_z) <= run * tan_max_slope_;
+          pcl::PointCloud<PointXYZIR> *out = obstacle;
+          if (is_ground)
+            {
+              ground_range = range;
+              ground_z = point.z;
+              out = ground;
+            }
+          if (out)
+            {
+              out->points.push_back(point);
+              ++out->width;
+            }
+        }
+    }
+
+    bool enabled_;
+    float tan_max_slope_;
+    float sensor_height_;
+    std::vector<int> column_;  ///< point index per ring, -1 for none
+  };
+
+} // namespace velodyne_pointcloud
+
+#endif // __VELODYNE_GROUND_H
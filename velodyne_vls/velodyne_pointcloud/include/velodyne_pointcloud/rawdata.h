@@ -33,6 +33,8 @@
 #include <velodyne_msgs/VelodyneScan.h>
 #include <velodyne_pointcloud/point_types.h>
 #include <velodyne_pointcloud/calibration.h>
+#include <lidar_downsample/downsample.h>
+#include <velodyne_pointcloud/ground.h>
 
 namespace velodyne_rawdata
 {
@@ -165,12 +167,49 @@ namespace velodyne_rawdata
      */
     int setupOffline(std::string calibration_file, double max_range_, double min_range_);
 
-    void unpack(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+    /** \brief Convert a packet, appending its points to pc.
+     *
+     *  @param reduced if not NULL, the points picked by the reduction are
+     *         appended to it too, see setReduction() and startReduction()
+     *  @param ground if not NULL, the ground points of the packet are
+     *         appended to it too, see setGroundSplit()
+     *  @param obstacle same for the points that are not ground
+     */
+    void unpack(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc,
+                VPointCloud *reduced = NULL, VPointCloud *ground = NULL,
+                VPointCloud *obstacle = NULL);
 //    void unpack(const velodyne_msgs::VelodynePacket &pkt, XYZIRBPointCloud &pc);
     
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width);
 
+    /** \brief Configure the reduced cloud built by unpack().
+     *
+     *  @param mode REDUCTION_NONE, REDUCTION_VOXEL or REDUCTION_STRIDE
+     *  @param leaf_size voxel edge [m]
+     *  @param ring_stride keep every ring_stride-th ring
+     *  @param azimuth_stride keep every azimuth_stride-th firing of a ring
+     */
+    void setReduction(apollo::drivers::lidar_downsample::ReductionMode mode,
+                      double leaf_size, int ring_stride, int azimuth_stride)
+    {
+      downsampler_.configure(mode, leaf_size, ring_stride, azimuth_stride);
+    }
+    bool reductionEnabled() const { return downsampler_.enabled(); }
+    /** \brief Start a new reduced cloud, once per scan. */
+    void startReduction() { downsampler_.reset(); }
+
+    /** \brief Configure the ground and obstacle clouds built by unpack().
+     *
+     *  @param max_slope steepest ground [degrees]
+     *  @param sensor_height height of the sensor above the ground [m]
+     */
+    void setGroundSplit(bool enabled, double max_slope, double sensor_height)
+    {
+      ground_splitter_.configure(enabled, max_slope, sensor_height);
+    }
+    bool groundSplitEnabled() const { return ground_splitter_.enabled(); }
+
   private:
 
     /** configuration parameters */
@@ -192,14 +231,21 @@ namespace velodyne_rawdata
      * Calibration file
      */
     velodyne_pointcloud::Calibration calibration_;
+    apollo::drivers::lidar_downsample::Downsampler downsampler_;
+    velodyne_pointcloud::GroundSplitter ground_splitter_;
     float sin_rot_table_[ROTATION_MAX_UNITS];
     float cos_rot_table_[ROTATION_MAX_UNITS];
     /** add private function to handle each sensor **/ 
-    void unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
-    void unpack_vlp32(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
-    void unpack_hdl32(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
-    void unpack_hdl64(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
-    void unpack_vls128(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+    void unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc,
+                      VPointCloud *reduced);
+    void unpack_vlp32(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc,
+                      VPointCloud *reduced);
+    void unpack_hdl32(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc,
+                      VPointCloud *reduced);
+    void unpack_hdl64(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc,
+                      VPointCloud *reduced);
+    void unpack_vls128(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc,
+                       VPointCloud *reduced);
     void compute_xyzi( const uint8_t chan_id
                      , const uint16_t azimuth_uint
                      , const float distance
@@ -209,6 +255,19 @@ namespace velodyne_rawdata
                      , float &z_coord
                      ); 
 
+    /** append a point to pc, and to reduced if the reduction picks it */
+    void addPoint(const VPoint &point, VPointCloud &pc, VPointCloud *reduced)
+    {
+      pc.points.push_back(point);
+      ++pc.width;
+      if (reduced &&
+          downsampler_.keep(point.x, point.y, point.z, point.ring))
+        {
+          reduced->points.push_back(point);
+          ++reduced->width;
+        }
+    }
+
     /** in-line test whether a point is in range */
     bool pointInRange(float range)
     {
@@ -25,6 +25,38 @@ namespace velodyne_pointcloud
   {
     data_->setup(private_nh);
 
+    // optional reduced copy of the cloud, picked while the packets are
+    // unpacked, for subscribers that do not need the full resolution
+    std::string reduction;
+    double leaf_size;
+    int ring_stride, azimuth_stride;
+    private_nh.param("reduction", reduction, std::string("none"));
+    private_nh.param("reduction_leaf_size", leaf_size, 0.2);
+    private_nh.param("reduction_ring_stride", ring_stride, 2);
+    private_nh.param("reduction_azimuth_stride", azimuth_stride, 4);
+    data_->setReduction(
+        apollo::drivers::lidar_downsample::reduction_mode(reduction),
+        leaf_size, ring_stride, azimuth_stride);
+    if (data_->reductionEnabled())
+      reduced_output_ =
+        node.advertise<sensor_msgs::PointCloud2>("velodyne_points_reduced", 10);
+
+    // optional ground and obstacle clouds, split column by column while the
+    // packets are unpacked
+    bool ground_split;
+    double max_slope, sensor_height;
+    private_nh.param("ground_split", ground_split, false);
+    private_nh.param("ground_max_slope", max_slope, 10.0);
+    private_nh.param("ground_sensor_height", sensor_height, 1.8);
+    data_->setGroundSplit(ground_split, max_slope, sensor_height);
+    if (data_->groundSplitEnabled())
+      {
+        ground_output_ =
+          node.advertise<sensor_msgs::PointCloud2>("velodyne_points_ground", 10);
+        obstacle_output_ =
+          node.advertise<sensor_msgs::PointCloud2>("velodyne_points_obstacle",
+                                                   10);
+      }
 
     // advertise output point cloud (before subscribing to input data)
     output_ =
@@ -55,12 +87,27 @@ namespace velodyne_pointcloud
   /** @brief Callback for raw scan messages. */
   void Convert::processScan(const velodyne_msgs::VelodyneScan::ConstPtr &scanMsg)
   {
-    if (output_.getNumSubscribers() == 0)         // no one listening?
+    const bool reduce = reduced_output_.getNumSubscribers() > 0;
+    const bool ground = ground_output_.getNumSubscribers() > 0;
+    const bool obstacle = obstacle_output_.getNumSubscribers() > 0;
+    if (output_.getNumSubscribers() == 0 && !reduce   // no one listening?
+        && !ground && !obstacle)
       return;                                     // avoid much work
 
     // allocate a point cloud with same time and frame ID as raw data
     velodyne_rawdata::VPointCloud::Ptr
     outMsg(new velodyne_rawdata::VPointCloud());
+    velodyne_rawdata::VPointCloud::Ptr reducedMsg;
+    if (reduce)
+      {
+        reducedMsg.reset(new velodyne_rawdata::VPointCloud());
+        data_->startReduction();
+      }
+    velodyne_rawdata::VPointCloud::Ptr groundMsg, obstacleMsg;
+    if (ground)
+      groundMsg.reset(new velodyne_rawdata::VPointCloud());
+    if (obstacle)
+      obstacleMsg.reset(new velodyne_rawdata::VPointCloud());
    //   velodyne_rawdata::XYZIRBPointCloud::Ptr
    //   outMsg(new velodyne_rawdata::XYZIRBPointCloud());
     // outMsg's header is a pcl::PCLHeader, convert it before stamp assignment
@@ -71,13 +118,33 @@ namespace velodyne_pointcloud
     // process each packet provided by the driver
     for (size_t i = 0; i < scanMsg->packets.size(); ++i)
       {
-        data_->unpack(scanMsg->packets[i], *outMsg);
+        data_->unpack(scanMsg->packets[i], *outMsg, reducedMsg.get(),
+                      groundMsg.get(), obstacleMsg.get());
       }
 
     // publish the accumulated cloud message
     ROS_DEBUG_STREAM("Publishing " << outMsg->height * outMsg->width
                      << " Velodyne points, time: " << outMsg->header.stamp);
     output_.publish(outMsg);
+
+    if (reduce)
+      {
+        reducedMsg->header = outMsg->header;
+        reducedMsg->height = 1;
+        reduced_output_.publish(reducedMsg);
+      }
+    if (ground)
+      {
+        groundMsg->header = outMsg->header;
+        groundMsg->height = 1;
+        ground_output_.publish(groundMsg);
+      }
+    if (obstacle)
+      {
+        obstacleMsg->header = outMsg->header;
+        obstacleMsg->height = 1;
+        obstacle_output_.publish(obstacleMsg);
+      }
   }
 
 } // namespace velodyne_pointcloud
@@ -47,6 +47,9 @@ namespace velodyne_pointcloud
     boost::shared_ptr<velodyne_rawdata::RawData> data_;
     ros::Subscriber velodyne_scan_;
     ros::Publisher output_;
+    ros::Publisher reduced_output_;
+    ros::Publisher ground_output_;
+    ros::Publisher obstacle_output_;
 
     /// configuration parameters
     typedef struct {
@@ -162,21 +162,33 @@ int RawData::setupOffline(std::string calibration_file, double max_range_,
  *
  *  @param pkt raw packet to unpack
  *  @param pc shared pointer to point cloud (points are appended)
+ *  @param reduced the points picked by the reduction are appended, or NULL
+ *  @param ground the ground points are appended, or NULL
+ *  @param obstacle the other points are appended, or NULL
  */
 void RawData::unpack(const velodyne_msgs::VelodynePacket &pkt,
-                     VPointCloud &pc) {
+                     VPointCloud &pc, VPointCloud *reduced,
+                     VPointCloud *ground, VPointCloud *obstacle) {
   ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
+  if (!downsampler_.enabled()) {
+    reduced = NULL;
+  }
+  // the columns of the packet are split once its points are in pc
+  const size_t first_point = pc.points.size();
   // std::cerr << "Sensor ID = " << (unsigned int)(pkt.data[1205]) << std::endl;
   if (pkt.data[1205] == 34) {  // VLP16
-    unpack_vlp16(pkt, pc);
+    unpack_vlp16(pkt, pc, reduced);
   } else if (pkt.data[1205] == 40) {  // VLP32 C
-    unpack_vlp32(pkt, pc);
+    unpack_vlp32(pkt, pc, reduced);
   } else if (pkt.data[1205] == 33) {  // HDL-32E (NOT TESTED YET)
-    unpack_hdl32(pkt, pc);
+    unpack_hdl32(pkt, pc, reduced);
   } else if (pkt.data[1205] == 161) {  // VLS 128
-    unpack_vls128(pkt, pc);
+    unpack_vls128(pkt, pc, reduced);
   } else {  // HDL-64E without azimuth compensation from the firing order
-    unpack_hdl64(pkt, pc);
+    unpack_hdl64(pkt, pc, reduced);
+  }
+  if (ground_splitter_.enabled() && (ground || obstacle)) {
+    ground_splitter_.split(pc, first_point, ground, obstacle);
   }
 }
 
@@ -291,7 +303,7 @@ void RawData::compute_xyzi(const uint8_t chan_id, const uint16_t azimuth_uint,
  *  @param pc shared pointer to point cloud (points are appended)
  */
 void RawData::unpack_hdl64(const velodyne_msgs::VelodynePacket &pkt,
-                           VPointCloud &pc) {
+                           VPointCloud &pc, VPointCloud *reduced) {
   const raw_packet_t *raw = (const raw_packet_t *)&pkt.data[0];
   for (int i = 0; i < NUM_BLOCKS_PER_PACKET; i++) {
     // upper bank lasers are numbered [0..31]
@@ -337,8 +349,7 @@ void RawData::unpack_hdl64(const velodyne_msgs::VelodynePacket &pkt,
           point.y = y_coord;
           point.z = z_coord;
           point.intensity = intensity;
-          pc.points.push_back(point);
-          ++pc.width;
+          addPoint(point, pc, reduced);
         }
       }
     }
@@ -351,7 +362,7 @@ void RawData::unpack_hdl64(const velodyne_msgs::VelodynePacket &pkt,
  *  @param pc shared pointer to point cloud (points are appended)
  */
 void RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
-                           VPointCloud &pc) {
+                           VPointCloud &pc, VPointCloud *reduced) {
   float azimuth_diff, azimuth_corrected_f;
   float last_azimuth_diff = 0;
   uint16_t azimuth, azimuth_next, azimuth_corrected;
@@ -426,8 +437,7 @@ void RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
             point.z = z_coord;
             point.intensity = intensity;
 
-            pc.points.push_back(point);
-            ++pc.width;
+            addPoint(point, pc, reduced);
           }
         }
       }
@@ -525,7 +535,7 @@ void RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
  *  @param pc shared pointer to point cloud (points are appended)
  */
 void RawData::unpack_vlp32(const velodyne_msgs::VelodynePacket &pkt,
-                           VPointCloud &pc) {
+                           VPointCloud &pc, VPointCloud *reduced) {
   float azimuth_diff, azimuth_corrected_f;
   float last_azimuth_diff = 0;
   uint16_t azimuth, azimuth_next, azimuth_corrected;
@@ -600,8 +610,7 @@ void RawData::unpack_vlp32(const velodyne_msgs::VelodynePacket &pkt,
           point.z = z_coord;
           point.intensity = intensity;
 
-          pc.points.push_back(point);
-          ++pc.width;
+          addPoint(point, pc, reduced);
         }
       }
     }
@@ -614,7 +623,7 @@ void RawData::unpack_vlp32(const velodyne_msgs::VelodynePacket &pkt,
  *  @param pc shared pointer to point cloud (points are appended)
  */
 void RawData::unpack_vls128(const velodyne_msgs::VelodynePacket &pkt,
-                            VPointCloud &pc) {
+                            VPointCloud &pc, VPointCloud *reduced) {
   float azimuth_diff, azimuth_corrected_f;
   float last_azimuth_diff = 0;
   uint16_t azimuth, azimuth_next, azimuth_corrected;
@@ -704,8 +713,7 @@ void RawData::unpack_vls128(const velodyne_msgs::VelodynePacket &pkt,
           point.z = z_coord;
           point.intensity = intensity;
 
-          pc.points.push_back(point);
-          ++pc.width;
+          addPoint(point, pc, reduced);
         }
       }
     }
@@ -731,7 +739,7 @@ unsigned int swizzle_bytes_in_word(unsigned int a) {
  *  @param pc shared pointer to point cloud (points are appended)
  */
 void RawData::unpack_hdl32(const velodyne_msgs::VelodynePacket &pkt,
-                           VPointCloud &pc) {
+                           VPointCloud &pc, VPointCloud *reduced) {
   float azimuth_diff, azimuth_corrected_f;
   float last_azimuth_diff = 0;
   uint16_t azimuth, azimuth_next, azimuth_corrected;
@@ -805,8 +813,7 @@ void RawData::unpack_hdl32(const velodyne_msgs::VelodynePacket &pkt,
           point.z = z_coord;
           point.intensity = intensity;
 
-          pc.points.push_back(point);
-          ++pc.width;
+          addPoint(point, pc, reduced);
         }
       }
     }